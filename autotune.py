@@ -0,0 +1,82 @@
+import itertools
+import os
+import subprocess
+from pathlib import Path
+
+import typer
+
+ROOT = Path(__file__).parent.resolve()
+
+
+def parse_list(values: str) -> list:
+    return [int(v) for v in values.split(",")]
+
+
+def autotune(
+    unroll: str = "1,2,4,8",
+    compute_units: str = "1,2",
+    batch_sizes: str = "1,16,64,256",
+    inflight: str = "1,2,4",
+    target: str = "hw_emu",
+    platform: str = None,
+    out: str = "tuning.json",
+    builddir: str = "_tune",
+):
+    """
+    Sweeps the kernel parameters (MATMUL_UNROLL, MATMUL_COMPUTE_UNITS) by
+    rebuilding the xclbin for each combination and running the `autotune`
+    binary, which tunes the host parameters and keeps the best configuration
+    per model shape in `out`.
+
+    Use sw_emu or hw_emu targets to compare kernel configurations on the
+    simulated timeline; hw measures wall clock throughput.
+    """
+    out = Path(out).resolve()
+    platform = platform or os.environ.get("AWS_PLATFORM")
+    env = dict(os.environ)
+    if target != "hw":
+        env["XCL_EMULATION_MODE"] = target
+
+    for u, cu in itertools.product(parse_list(unroll), parse_list(compute_units)):
+        build = Path(builddir).resolve() / f"{target}-unroll{u}-cu{cu}"
+        print(f"==> MATMUL_UNROLL={u} MATMUL_COMPUTE_UNITS={cu} in {build}")
+        subprocess.run(
+            [
+                "cmake",
+                "-S",
+                str(ROOT),
+                "-B",
+                str(build),
+                f"-DTARGET={target}",
+                f"-DHW_PLATFORM={platform}",
+                f"-DMATMUL_UNROLL={u}",
+                f"-DMATMUL_COMPUTE_UNITS={cu}",
+            ],
+            check=True,
+        )
+        targets = ["kernels", "autotune"] + (["emconfig.json"] if target != "hw" else [])
+        for t in targets:
+            subprocess.run(["cmake", "--build", str(build), "--target", t], check=True)
+
+        subprocess.run(
+            [
+                str(build / "autotune"),
+                "--weights",
+                str(ROOT / "weights"),
+                "--out",
+                str(out),
+                "--batch-sizes",
+                batch_sizes,
+                "--inflight",
+                inflight,
+            ],
+            cwd=build,
+            env=env,
+            check=True,
+        )
+
+    print(f"Best configurations written to {out}")
+
+
+if __name__ == "__main__":
+    typer.run(autotune)
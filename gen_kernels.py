@@ -0,0 +1,67 @@
+from pathlib import Path
+
+import numpy as np
+import typer
+
+ROOT = Path(__file__).parent.resolve()
+
+HEADER = "// Generated by gen_kernels.py from the model weights, do not edit\n"
+
+WRAPPER = """{header}#include "../matmul_fixed.hpp"
+
+extern "C" void {name}(const float *const matrixA, const float *const matrixB, const uint rowsA, const uint colsA, const uint colsB, float *const out)
+{{
+   matmul_fixed<{k}, {n}>(matrixA, matrixB, rowsA, colsA, colsB, out);
+}}
+"""
+
+
+def gen_kernels(
+    weights: str = "weights",
+    out: str = "src/generated",
+    max_weights: int = 65536,
+):
+    """
+    Emits shape-specialized matmul kernels (see src/matmul_fixed.hpp) for the
+    layers w1.npy, w2.npy, ... in `weights`:
+
+    - `matmul_kernel_<K>x<N>.cpp`, an `extern "C"` wrapper per weight shape
+    - `kernels.cmake`, the matching compile_kernel() calls
+    - `specialized_kernels.hpp`, the shapes for the host, which falls back to
+      the generic matmul_kernel for everything else
+
+    Layers with more than `max_weights` weights are skipped, since their
+    weights wouldn't fit on chip.
+    """
+    out = Path(out)
+    out.mkdir(parents=True, exist_ok=True)
+    for old in out.glob("matmul_kernel_*.cpp"):
+        old.unlink()
+
+    shapes = []
+    layer = 0
+    while (Path(weights) / f"w{layer + 1}.npy").exists():
+        k, n = np.load(Path(weights) / f"w{layer + 1}.npy", mmap_mode="r").shape
+        if k * n > max_weights:
+            print(f"Skipping layer {layer} ({k}x{n}), more than {max_weights} weights")
+        elif all((k, n) != (sk, sn) for sk, sn, _ in shapes):
+            shapes.append((k, n, layer))
+        layer += 1
+
+    cmake = [HEADER.replace("//", "#")]
+    for k, n, layer in shapes:
+        name = f"matmul_kernel_{k}x{n}"
+        (out / f"{name}.cpp").write_text(WRAPPER.format(header=HEADER, name=name, k=k, n=n))
+        cmake.append(f"compile_kernel({name} ${{CMAKE_CURRENT_LIST_DIR}}/{name}.cpp)\n")
+        print(f"Generated {name} for layer {layer}")
+    (out / "kernels.cmake").write_text("".join(cmake))
+
+    entries = ", ".join(f"{{{k}, {n}, {layer}}}" for k, n, layer in shapes)
+    (out / "specialized_kernels.hpp").write_text(
+        HEADER + "// {colsA, colsB, layer} of every matmul_kernel_<colsA>x<colsB> in the xclbin\n"
+        f"#define SPECIALIZED_MATMUL_SHAPES {{{entries}}}\n"
+    )
+
+
+if __name__ == "__main__":
+    typer.run(gen_kernels)
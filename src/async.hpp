@@ -0,0 +1,157 @@
+#ifndef NNONFPGA_ASYNC
+#define NNONFPGA_ASYNC
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <CL/cl2.hpp>
+#include "matrix.hpp"
+
+// State shared between an InferenceHandle and the OpenCL completion callback
+struct InferenceState
+{
+    std::mutex mutex;
+    std::condition_variable completed;
+    bool done;
+    cl_int status;
+    Matrix result;
+    cl::Event event;
+    // Run with the result, or with the failed status if the request failed
+    struct Continuation
+    {
+        std::function<void(Matrix &)> on_result;
+        std::function<void(cl_int)> on_error;
+
+        void operator()(Matrix &result, const cl_int status) const
+        {
+            if (status == CL_COMPLETE)
+            {
+                on_result(result);
+            }
+            else if (on_error)
+            {
+                on_error(status);
+            }
+        }
+    };
+    std::vector<Continuation> continuations;
+
+    InferenceState(Matrix &&result, const cl::Event &event) : done(false), status(CL_COMPLETE), result(std::move(result)), event(event) {}
+};
+
+// Called by the runtime once the readback of a request finished or failed.
+// Continuations run on the runtime's callback thread before waiters are
+// released, so they must not block on the queue.
+static void CL_CALLBACK on_inference_complete(cl_event, cl_int status, void *user_data)
+{
+    std::unique_ptr<std::shared_ptr<InferenceState>> owner(static_cast<std::shared_ptr<InferenceState> *>(user_data));
+    InferenceState &state = **owner;
+
+    std::unique_lock<std::mutex> lock(state.mutex);
+    state.status = status;
+    // Continuations may be attached while we run the previous ones
+    while (!state.continuations.empty())
+    {
+        std::vector<InferenceState::Continuation> continuations;
+        continuations.swap(state.continuations);
+        lock.unlock();
+        for (auto &continuation : continuations)
+        {
+            continuation(state.result, status);
+        }
+        lock.lock();
+    }
+    state.done = true;
+    lock.unlock();
+    state.completed.notify_all();
+}
+
+// Handle to a single in-flight inference request. The result is read back to
+// the host automatically; waiting or polling only concerns this request and
+// never drains the rest of the queue.
+class InferenceHandle
+{
+private:
+    std::shared_ptr<InferenceState> state;
+
+    InferenceState &checked_state() const
+    {
+        if (!state)
+        {
+            throw std::runtime_error("InferenceHandle is not attached to a request");
+        }
+        return *state;
+    }
+
+public:
+    InferenceHandle() {}
+
+    // Takes ownership of `result`, whose readback to the host is `readback`
+    InferenceHandle(Matrix &&result, const cl::Event &readback)
+        : state(std::make_shared<InferenceState>(std::move(result), readback))
+    {
+        auto *user_data = new std::shared_ptr<InferenceState>(state);
+        if (clSetEventCallback(readback(), CL_COMPLETE, on_inference_complete, user_data) != CL_SUCCESS)
+        {
+            delete user_data;
+            throw std::runtime_error("Could not register inference completion callback");
+        }
+    }
+
+    bool valid() const
+    {
+        return static_cast<bool>(state);
+    }
+
+    bool ready() const
+    {
+        InferenceState &state = checked_state();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        return state.done;
+    }
+
+    // Blocks until this request finished and returns the host-side result
+    Matrix &wait()
+    {
+        InferenceState &state = checked_state();
+        std::unique_lock<std::mutex> lock(state.mutex);
+        state.completed.wait(lock, [&state]() { return state.done; });
+        if (state.status != CL_COMPLETE)
+        {
+            throw std::runtime_error("Inference request failed with status " + std::to_string(state.status));
+        }
+        return state.result;
+    }
+
+    // Runs `continuation` on the result once available, or `on_error` with the
+    // status if the request failed, so that callers can release what they hold
+    // for it. If the request already finished, it runs immediately on the
+    // calling thread.
+    InferenceHandle &then(const std::function<void(Matrix &)> &continuation,
+                          const std::function<void(cl_int)> &on_error = std::function<void(cl_int)>())
+    {
+        InferenceState &state = checked_state();
+        const InferenceState::Continuation both = {continuation, on_error};
+        std::unique_lock<std::mutex> lock(state.mutex);
+        if (!state.done)
+        {
+            state.continuations.push_back(both);
+            return *this;
+        }
+        lock.unlock();
+        both(state.result, state.status);
+        return *this;
+    }
+
+    // Event of the final readback, e.g. to chain further device work
+    const cl::Event &event() const
+    {
+        return checked_state().event;
+    }
+};
+
+#endif /* end of include guard: NNONFPGA_ASYNC */
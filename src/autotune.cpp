@@ -0,0 +1,107 @@
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "cli.hpp"
+#include "matrix.hpp"
+#include "net.hpp"
+#include "tuning.hpp"
+#include "utils.hpp"
+#include "xcl2.hpp"
+
+// Searches the host-side parameters (batch size and number of batches in
+// flight) for the kernels in the current xclbin and merges the best result
+// into the tuning file. Kernel parameters are swept by autotune.py, which
+// rebuilds the xclbin and calls this binary once per configuration.
+//
+// Usage: autotune [--weights DIR] [--out tuning.json] [--batch-sizes 1,16,64]
+//                 [--inflight 1,2,4] [--repeats 5]
+int main(int argc, const char *argv[])
+{
+  const CliArgs args(argc, argv);
+  const std::string weights_dir = args.get("weights", "../weights");
+  const std::string out = args.get("out", DEFAULT_TUNING_FILE);
+  const auto batch_sizes = args.get_uint_list("batch-sizes", {1, 16, 64, 256});
+  const auto inflights = args.get_uint_list("inflight", {1, 2, 4});
+  const uint repeats = args.get_uint("repeats", 5);
+  const bool emulation = xcl::is_emulation();
+
+  init_kernels();
+  FCNN model(weights_dir);
+  const std::string key = shape_key(model.shape());
+
+  std::cout << "Tuning " << key << " for " << tuning_target()
+            << " with MATMUL_UNROLL=" << MATMUL_UNROLL
+            << " MATMUL_COMPUTE_UNITS=" << MATMUL_COMPUTE_UNITS << std::endl;
+  std::cout << std::setw(8) << "batch" << std::setw(10) << "inflight"
+            << std::setw(16) << "samples/s" << std::endl;
+
+  TuningConfig best = {MATMUL_UNROLL, MATMUL_COMPUTE_UNITS, 0, 0, 0.};
+  for (const uint batch_size : batch_sizes)
+  {
+    for (const uint inflight : inflights)
+    {
+      std::vector<Matrix> inputs;
+      inputs.reserve(inflight);
+      for (uint i = 0; i < inflight; i++)
+      {
+        inputs.push_back(Matrix::random(batch_size, model.shape()[0], i));
+        inputs.back().to_device(HANDLE, bank_for(ROLE_INPUT));
+      }
+      finish_cl_queue();
+
+      double best_score = 0.;
+      // First round is a warmup and not scored
+      for (uint r = 0; r <= repeats; r++)
+      {
+        std::vector<cl::Event> kernel_events;
+        std::vector<Matrix> results;
+        results.reserve(inflight);
+        const auto start = std::chrono::steady_clock::now();
+        for (auto &input : inputs)
+        {
+          results.push_back(model(input, &kernel_events));
+        }
+        finish_cl_queue();
+        const auto stop = std::chrono::steady_clock::now();
+
+        // Wall clock is meaningless in emulation, use the simulated device
+        // timeline instead
+        const double seconds = emulation
+                                   ? events_span_ns(kernel_events) * 1e-9
+                                   : std::chrono::duration<double>(stop - start).count();
+        const double score = batch_size * inflight / seconds;
+        if (r > 0 && score > best_score)
+        {
+          best_score = score;
+        }
+      }
+
+      std::cout << std::setw(8) << batch_size << std::setw(10) << inflight
+                << std::setw(16) << std::fixed << std::setprecision(1) << best_score << std::endl;
+      if (best_score > best.score)
+      {
+        best.batch_size = batch_size;
+        best.inflight = inflight;
+        best.score = best_score;
+      }
+    }
+  }
+
+  std::cout << "Best: batch_size=" << best.batch_size << " inflight=" << best.inflight
+            << " (" << best.score << " samples/s)" << std::endl;
+  if (!valid_tuning(best))
+  {
+    std::cout << "Nothing was measured, " << out << " is left as it is" << std::endl;
+  }
+  else if (store_tuning_if_better(out, key, best))
+  {
+    std::cout << "Updated " << out << std::endl;
+  }
+  else
+  {
+    std::cout << out << " already contains a better configuration" << std::endl;
+  }
+}
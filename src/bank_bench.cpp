@@ -0,0 +1,124 @@
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "cli.hpp"
+#include "matrix.hpp"
+#include "net.hpp"
+#include "stats.hpp"
+#include "utils.hpp"
+#include "xcl2.hpp"
+
+// Compares host-to-device bandwidth when concurrent transfers all target one
+// DDR bank against spreading them over all banks, then measures FCNN
+// throughput under the placement the binary was built with.
+//
+// Usage: bank_bench [--mb 64] [--repeats 10] [--batch 256] [--inflight 4]
+//                   [--weights DIR]
+
+// Migrates one buffer per entry of `banks` at once, returns the median GB/s
+double concurrent_bandwidth(const std::vector<int> &banks, const uint rows, const uint repeats)
+{
+  std::vector<Matrix> buffers;
+  buffers.reserve(banks.size());
+  for (std::size_t i = 0; i < banks.size(); i++)
+  {
+    buffers.push_back(Matrix::random(rows, 1024, i));
+  }
+
+  std::vector<double> samples;
+  for (uint r = 0; r <= repeats; r++)
+  {
+    std::vector<cl::Event> events(banks.size());
+    for (std::size_t i = 0; i < banks.size(); i++)
+    {
+      buffers[i].to_device(HANDLE, banks[i], &events[i]);
+    }
+    finish_cl_queue();
+    // First round is a warmup
+    if (r > 0)
+    {
+      const double bytes = sizeof(float) * 1024. * rows * banks.size();
+      samples.push_back(bytes / events_span_ns(events));
+    }
+  }
+  return median(samples);
+}
+
+int main(int argc, const char *argv[])
+{
+  const CliArgs args(argc, argv);
+  const uint rows = args.get_uint("mb", 64) * 256;
+  const uint repeats = args.get_uint("repeats", 10);
+  const uint batch_size = args.get_uint("batch", 256);
+  const uint inflight = args.get_uint("inflight", 4);
+
+  init_kernels();
+  std::cout << std::fixed << std::setprecision(2);
+
+  if (xcl::is_emulation())
+  {
+    std::cout << "Skipping bandwidth comparison, emulation only has one usable bank" << std::endl;
+  }
+  else
+  {
+    // Only banks the xclbin connects to can be allocated in, so stay in the
+    // input bank unless the placement spreads the roles over all of them
+    const std::vector<int> same(NUM_DDR_BANKS, PLACEMENT.flags(ROLE_INPUT));
+    std::cout << NUM_DDR_BANKS << " concurrent transfers to one bank:   "
+              << concurrent_bandwidth(same, rows, repeats) << " GB/s" << std::endl;
+    std::vector<int> spread;
+    for (uint role = 0; role < NUM_ROLES; role++)
+    {
+      const int flags = PLACEMENT.flags(static_cast<TensorRole>(role));
+      if (std::find(spread.begin(), spread.end(), flags) == spread.end())
+      {
+        spread.push_back(flags);
+      }
+    }
+    if (spread.size() < NUM_DDR_BANKS)
+    {
+      std::cout << "Skipping transfers to own banks, the '" << PLACEMENT.name << "' placement only uses "
+                << spread.size() << " of " << NUM_DDR_BANKS << " banks" << std::endl;
+    }
+    else
+    {
+      std::cout << NUM_DDR_BANKS << " concurrent transfers to own banks:  "
+                << concurrent_bandwidth(spread, rows, repeats) << " GB/s" << std::endl;
+    }
+  }
+
+  FCNN model(args.get("weights", "../weights"));
+  std::vector<Matrix> inputs;
+  inputs.reserve(inflight);
+  for (uint i = 0; i < inflight; i++)
+  {
+    inputs.push_back(Matrix::random(batch_size, model.shape()[0], i));
+    inputs.back().to_device(HANDLE, bank_for(ROLE_INPUT));
+  }
+  finish_cl_queue();
+
+  std::vector<double> samples;
+  for (uint r = 0; r <= repeats; r++)
+  {
+    std::vector<cl::Event> kernel_events;
+    std::vector<Matrix> results;
+    results.reserve(inflight);
+    const auto start = std::chrono::steady_clock::now();
+    for (auto &input : inputs)
+    {
+      results.push_back(model(input, &kernel_events));
+    }
+    finish_cl_queue();
+    const auto stop = std::chrono::steady_clock::now();
+    const double seconds = xcl::is_emulation() ? events_span_ns(kernel_events) * 1e-9
+                                               : std::chrono::duration<double>(stop - start).count();
+    if (r > 0)
+    {
+      samples.push_back(batch_size * inflight / seconds);
+    }
+  }
+  std::cout << "FCNN with '" << PLACEMENT.name << "' placement: " << median(samples) << " samples/s" << std::endl;
+}
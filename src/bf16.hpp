@@ -0,0 +1,44 @@
+#ifndef NNONFPGA_BF16
+#define NNONFPGA_BF16
+
+typedef unsigned int uint;
+
+// bfloat16 storage type shared by the host and the *_bf16 kernels: the upper
+// half of an IEEE float, so it keeps FP32's exponent range and converting is
+// a shift. Values are only stored in it, arithmetic happens in FP32.
+typedef unsigned short bf16;
+
+// Rounds to nearest, ties to even. NaNs stay NaNs.
+inline bf16 float_to_bf16(const float value)
+{
+   union
+   {
+      float f;
+      uint u;
+   } bits;
+   bits.f = value;
+   if ((bits.u & 0x7fffffffu) > 0x7f800000u)
+   {
+      return (bits.u >> 16) | 0x40u;
+   }
+   bits.u += 0x7fffu + ((bits.u >> 16) & 1u);
+   return bits.u >> 16;
+}
+
+inline float bf16_to_float(const bf16 value)
+{
+   union
+   {
+      float f;
+      uint u;
+   } bits;
+   bits.u = static_cast<uint>(value) << 16;
+   return bits.f;
+}
+
+extern "C" void matmul_bf16_kernel(
+    const bf16 *const matrixA, const bf16 *const matrixB, const uint rowsA, const uint colsA, const uint colsB, float *const out);
+extern "C" void bias_relu6_bf16_kernel(
+    const float *const activation, const float *const bias, const uint batch_size, const uint dim, bf16 *const out);
+
+#endif /* end of include guard: NNONFPGA_BF16 */
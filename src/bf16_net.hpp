@@ -0,0 +1,275 @@
+#ifndef NNONFPGA_BF16_NET
+#define NNONFPGA_BF16_NET
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <CL/cl2.hpp>
+#include <nonstd/optional.hpp>
+#include "bf16.hpp"
+#include "matrix.hpp"
+#include "net.hpp"
+#include "utils.hpp"
+
+// FCNN with weights, inputs and hidden activations stored as bfloat16, which
+// halves their memory traffic and footprint. The kernels accumulate in FP32
+// and biases, logits and probabilities stay FP32. Weights are converted once
+// when they are loaded.
+
+// Row-major bfloat16 matrix in page-aligned host memory, handed to the device
+// with CL_MEM_USE_HOST_PTR like Matrix
+class Bf16Matrix
+{
+private:
+    bf16 *data;
+    nonstd::optional<cl::Buffer> device_buffer;
+    // See BufferAccesses, like Matrix
+    std::shared_ptr<BufferAccesses> accesses;
+
+public:
+    uint rows, cols;
+
+    Bf16Matrix(const uint rows, const uint cols) : data(aligned_alloc<bf16>(rows * cols)), rows(rows), cols(cols) {}
+    Bf16Matrix(Bf16Matrix &&src) noexcept
+        : data(src.data), device_buffer(src.device_buffer), accesses(std::move(src.accesses)), rows(src.rows), cols(src.cols)
+    {
+        src.data = NULL;
+    }
+    Bf16Matrix(const Bf16Matrix &) = delete;
+    Bf16Matrix &operator=(const Bf16Matrix &) = delete;
+
+    ~Bf16Matrix()
+    {
+        if (data != NULL)
+        {
+            host_free(data);
+        }
+    }
+
+    // Rounds every element to the nearest bfloat16
+    static Bf16Matrix from_float(Matrix &src)
+    {
+        Bf16Matrix mat(src.rows, src.cols);
+        const float *values = src.raw_data();
+        for (uint i = 0; i < src.rows * src.cols; i++)
+        {
+            mat.data[i] = float_to_bf16(values[i]);
+        }
+        return mat;
+    }
+
+    static Bf16Matrix from_npy(const std::string &path)
+    {
+        Matrix values = Matrix::from_npy(path);
+        return from_float(values);
+    }
+
+    Matrix to_float() const
+    {
+        Matrix mat(rows, cols);
+        float *values = mat.raw_data();
+        for (uint i = 0; i < rows * cols; i++)
+        {
+            values[i] = bf16_to_float(data[i]);
+        }
+        return mat;
+    }
+
+    bf16 *raw_data()
+    {
+        return data;
+    }
+
+    std::size_t bytes() const
+    {
+        return sizeof(bf16) * rows * cols;
+    }
+
+    cl::Buffer &get_buffer()
+    {
+        if (!device_buffer.has_value())
+        {
+            throw std::runtime_error("Put data on device first");
+        }
+        return device_buffer.value();
+    }
+
+    void read_hazards(std::vector<cl::Event> &wait_on) const
+    {
+        if (accesses)
+        {
+            accesses->read_hazards(wait_on);
+        }
+    }
+
+    void write_hazards(std::vector<cl::Event> &wait_on) const
+    {
+        if (accesses)
+        {
+            accesses->write_hazards(wait_on);
+        }
+    }
+
+    void record_read(const cl::Event &event)
+    {
+        if (accesses)
+        {
+            accesses->record_read(event);
+        }
+    }
+
+    // Waits for commands still using the previous device buffer, if any,
+    // since they may read or write the same host memory
+    Bf16Matrix &to_device(DeviceHandle &handle = HANDLE, const int bank = DEFAULT_MEMORY_BANK, cl::Event *event = NULL)
+    {
+        std::vector<cl::Event> wait_on;
+        write_hazards(wait_on);
+        cl_mem_ext_ptr_t mext_io;
+        mext_io.flags = bank;
+        mext_io.obj = data;
+        mext_io.param = 0;
+        device_buffer = cl::Buffer(handle.context, CL_MEM_EXT_PTR_XILINX | CL_MEM_USE_HOST_PTR | CL_MEM_READ_WRITE, bytes(), &mext_io);
+        cl::Event migration;
+        handle.q.enqueueMigrateMemObjects({device_buffer.value()}, 0, wait_on.empty() ? NULL : &wait_on, &migration);
+        accesses = std::make_shared<BufferAccesses>();
+        accesses->record_write(migration);
+        if (event != NULL)
+        {
+            *event = migration;
+        }
+        return *this;
+    }
+
+    // Waits for the last command writing the device buffer on top of `wait_on`
+    Bf16Matrix &to_cpu(DeviceHandle &handle = HANDLE, const std::vector<cl::Event> *wait_on = NULL, cl::Event *event = NULL)
+    {
+        std::vector<cl::Event> dependencies = wait_on != NULL ? *wait_on : std::vector<cl::Event>();
+        read_hazards(dependencies);
+        cl::Event migration;
+        handle.q.enqueueMigrateMemObjects({get_buffer()}, CL_MIGRATE_MEM_OBJECT_HOST, dependencies.empty() ? NULL : &dependencies, &migration);
+        record_read(migration);
+        if (event != NULL)
+        {
+            *event = migration;
+        }
+        return *this;
+    }
+};
+
+class Bf16FCNN
+{
+private:
+    Bf16Matrix weight1, weight2;
+    Matrix bias1, bias2;
+
+    void upload_weights()
+    {
+        weight1.to_device(HANDLE, bank_for(ROLE_WEIGHT));
+        bias1.to_device(HANDLE, bank_for(ROLE_WEIGHT));
+        weight2.to_device(HANDLE, bank_for(ROLE_WEIGHT));
+        bias2.to_device(HANDLE, bank_for(ROLE_WEIGHT));
+    }
+
+    // Waits for `wait_on` and the last write of the weights, and records
+    // the read of them
+    static cl::Event enqueue_matmul(cl::Kernel &kernel, cl::Buffer &input, Bf16Matrix &weight, const uint rows, cl::Buffer &out, std::vector<cl::Event> wait_on)
+    {
+        kernel.setArg(0, input);
+        kernel.setArg(1, weight.get_buffer());
+        kernel.setArg(2, rows);
+        kernel.setArg(3, weight.rows);
+        kernel.setArg(4, weight.cols);
+        kernel.setArg(5, out);
+        weight.read_hazards(wait_on);
+        cl::Event event;
+        HANDLE.q.enqueueTask(kernel, wait_on.empty() ? NULL : &wait_on, &event);
+        weight.record_read(event);
+        return event;
+    }
+
+public:
+    // Converts w1.npy and w2.npy to bfloat16 while loading them
+    Bf16FCNN(const std::string &weights_dir)
+        : weight1(Bf16Matrix::from_npy(weights_dir + "/w1.npy")), weight2(Bf16Matrix::from_npy(weights_dir + "/w2.npy")),
+          bias1(Matrix::from_npy(weights_dir + "/b1.npy")), bias2(Matrix::from_npy(weights_dir + "/b2.npy"))
+    {
+        upload_weights();
+    }
+
+    // Same weights as `model`, e.g. to compare both
+    Bf16FCNN(FCNN &model)
+        : weight1(Bf16Matrix::from_float(model.weight(0))), weight2(Bf16Matrix::from_float(model.weight(1))),
+          bias1(model.bias(0)), bias2(model.bias(1))
+    {
+        upload_weights();
+    }
+
+    std::vector<uint> shape() const
+    {
+        return {weight1.rows, weight1.cols, weight2.cols};
+    }
+
+    std::size_t device_bytes() const
+    {
+        return weight1.bytes() + weight2.bytes() + sizeof(float) * (bias1.rows * bias1.cols + bias2.rows * bias2.cols);
+    }
+
+    // Same contract as FCNN::forward: `input` is on the device in the
+    // ROLE_INPUT bank, `output` zero-initialized in the ROLE_OUTPUT bank. The
+    // hidden layer only lives in device memory.
+    cl::Event forward(Bf16Matrix &input, Matrix &output, std::vector<cl::Event> *kernel_events = NULL, std::vector<cl::Event> *wait_on = NULL)
+    {
+        const uint rows = input.rows, hidden = weight1.cols;
+        cl::Buffer sums = device_scratch(sizeof(float) * rows * hidden, bank_for(ROLE_ACTIVATION));
+        cl::Buffer activations = device_scratch(sizeof(bf16) * rows * hidden, bank_for(ROLE_ACTIVATION));
+
+        // matmul_bf16_kernel accumulates into its output
+        std::vector<cl::Event> matmul1_wait_on(1);
+        HANDLE.q.enqueueFillBuffer(sums, 0.f, 0, sizeof(float) * rows * hidden, NULL, &matmul1_wait_on[0]);
+        if (wait_on != NULL)
+        {
+            matmul1_wait_on.insert(matmul1_wait_on.end(), wait_on->begin(), wait_on->end());
+        }
+        input.read_hazards(matmul1_wait_on);
+
+        std::vector<cl::Event> events(1);
+        events[0] = enqueue_matmul(MATMUL_BF16_KERNEL, input.get_buffer(), weight1, rows, sums, matmul1_wait_on);
+        input.record_read(events[0]);
+
+        BIAS_RELU6_BF16_KERNEL.setArg(0, sums);
+        BIAS_RELU6_BF16_KERNEL.setArg(1, bias1.get_buffer());
+        BIAS_RELU6_BF16_KERNEL.setArg(2, rows);
+        BIAS_RELU6_BF16_KERNEL.setArg(3, hidden);
+        BIAS_RELU6_BF16_KERNEL.setArg(4, activations);
+        std::vector<cl::Event> bias_wait_on = {events.back()};
+        bias1.read_hazards(bias_wait_on);
+        events.push_back(cl::Event());
+        HANDLE.q.enqueueTask(BIAS_RELU6_BF16_KERNEL, &bias_wait_on, &events.back());
+        bias1.record_read(events.back());
+
+        // Accumulates into `output`, so after its zero-fill and migration
+        std::vector<cl::Event> matmul2_wait_on = {events.back()};
+        output.write_hazards(matmul2_wait_on);
+        events.push_back(enqueue_matmul(MATMUL_BF16_OUTPUT_KERNEL, activations, weight2, rows, output.get_buffer(), matmul2_wait_on));
+        output.record_write(events.back());
+        std::vector<cl::Event> softmax_wait_on = {events.back()};
+        events.push_back(apply_bias(output, bias2, BIAS_SOFTMAX_KERNEL, &softmax_wait_on));
+
+        if (kernel_events != NULL)
+        {
+            kernel_events->insert(kernel_events->end(), events.begin(), events.end());
+        }
+        return events.back();
+    }
+
+    Matrix operator()(Bf16Matrix &input, std::vector<cl::Event> *kernel_events = NULL)
+    {
+        Matrix y = Matrix::constant(input.rows, weight2.cols, 0.0);
+        y.to_device(HANDLE, bank_for(ROLE_OUTPUT));
+        forward(input, y, kernel_events);
+        return y;
+    }
+};
+
+#endif /* end of include guard: NNONFPGA_BF16_NET */
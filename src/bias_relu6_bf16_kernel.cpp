@@ -0,0 +1,27 @@
+#include "bf16.hpp"
+
+inline float relu6(const float x)
+{
+   if (x < 0.f)
+      return 0.f;
+   if (x > 6.f)
+      return 6.f;
+   return x;
+}
+
+// bias_relu6_kernel for the bfloat16 path: reads the FP32 sums of
+// matmul_bf16_kernel and stores the activations as bfloat16 into `out`, the
+// left operand of the next layer
+extern "C" void bias_relu6_bf16_kernel(
+    const float *const activation, const float *const bias, const uint batch_size, const uint dim, bf16 *const out)
+{
+   for (uint b = 0; b < batch_size; b++)
+   {
+      for (uint d = 0; d < dim; d++)
+      {
+#pragma HLS PIPELINE II = 1
+         const uint ia = dim * b + d;
+         out[ia] = float_to_bf16(relu6(activation[ia] + bias[d]));
+      }
+   }
+}
@@ -0,0 +1,30 @@
+#include "stream_kernels.hpp"
+
+inline float relu6(const float x)
+{
+   if (x < 0.f)
+      return 0.f;
+   if (x > 6.f)
+      return 6.f;
+   return x;
+}
+
+extern "C" void bias_relu6_stream_kernel(
+    float_stream &in, const float *const bias, const uint batch_size, const uint dim, float_stream &out)
+{
+   float local_bias[STREAM_MAX_COLS];
+   for (uint d = 0; d < dim; d++)
+   {
+      local_bias[d] = bias[d];
+   }
+
+   for (uint b = 0; b < batch_size; b++)
+   {
+      for (uint d = 0; d < dim; d++)
+      {
+#pragma HLS PIPELINE II = 1
+         const float_packet packet = in.read();
+         out.write(to_packet(relu6(from_packet(packet) + local_bias[d]), packet.last));
+      }
+   }
+}
@@ -0,0 +1,29 @@
+#include "stream_kernels.hpp"
+#include "hls_math.h"
+
+// Rows are buffered since they can only be emitted once their sum is known
+extern "C" void bias_softmax_stream_kernel(
+    float_stream &in, const float *const bias, const uint batch_size, const uint dim, float_stream &out)
+{
+   float local_bias[STREAM_MAX_COLS];
+   float row[STREAM_MAX_COLS];
+   for (uint d = 0; d < dim; d++)
+   {
+      local_bias[d] = bias[d];
+   }
+
+   for (uint b = 0; b < batch_size; b++)
+   {
+      float accum = 0.;
+      for (uint d = 0; d < dim; d++)
+      {
+         row[d] = exp(from_packet(in.read()) + local_bias[d]);
+         accum += row[d];
+      }
+      for (uint d = 0; d < dim; d++)
+      {
+#pragma HLS PIPELINE II = 1
+         out.write(to_packet(row[d] / accum, b == batch_size - 1 && d == dim - 1));
+      }
+   }
+}
@@ -0,0 +1,114 @@
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "cli.hpp"
+#include "matrix.hpp"
+#include "net.hpp"
+#include "result_cache.hpp"
+#include "stats.hpp"
+#include "utils.hpp"
+
+// Requests of `--rows` rows each, where every row repeats one of the last
+// `--working-set` rows sent with probability `--repeat-fraction` and is new
+// otherwise. Sent once straight to the device and once through a
+// ResultCache of `--cache-mb` MB, reporting latency, throughput, hit rate and
+// the latency the cache estimates it saved.
+//
+// Usage: cache_bench [--weights DIR] [--requests 10000] [--rows 1]
+//                    [--repeat-fraction 0.3] [--working-set 1000] [--cache-mb 64]
+
+struct BenchResult
+{
+  std::vector<double> latencies_us;
+  double seconds;
+};
+
+void print_row(const std::string &mode, const BenchResult &result, const uint rows)
+{
+  std::cout << std::setw(8) << mode << std::setw(12) << percentile(result.latencies_us, 50.) << std::setw(12)
+            << percentile(result.latencies_us, 99.) << std::setw(14) << result.latencies_us.size() * rows / result.seconds
+            << std::endl;
+}
+
+int main(int argc, const char *argv[])
+{
+  const CliArgs args(argc, argv);
+  const uint requests = args.get_uint("requests", 10000);
+  const uint rows = args.get_uint("rows", 1);
+  const double repeat_fraction = args.get_double("repeat-fraction", 0.3);
+  const uint working_set = args.get_uint("working-set", 1000);
+
+  init_kernels();
+  FCNN model(args.get("weights", "../weights"));
+  finish_cl_queue();
+  const uint input_cols = model.shape()[0], output_cols = model.shape()[2];
+
+  // The same traffic for both runs
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> value(0.f, 1.f), coin(0.f, 1.f);
+  std::vector<Matrix> inputs;
+  std::vector<const float *> recent;
+  for (uint i = 0; i < requests; i++)
+  {
+    Matrix input(rows, input_cols);
+    for (uint r = 0; r < rows; r++)
+    {
+      float *row = input.raw_data() + r * input_cols;
+      if (!recent.empty() && coin(rng) < repeat_fraction)
+      {
+        memcpy(row, recent[std::uniform_int_distribution<std::size_t>(0, recent.size() - 1)(rng)], sizeof(float) * input_cols);
+        continue;
+      }
+      for (uint c = 0; c < input_cols; c++)
+      {
+        row[c] = value(rng);
+      }
+    }
+    inputs.push_back(std::move(input));
+    for (uint r = 0; r < rows; r++)
+    {
+      recent.push_back(inputs.back().raw_data() + r * input_cols);
+    }
+    if (recent.size() > working_set)
+    {
+      recent.erase(recent.begin(), recent.begin() + (recent.size() - working_set));
+    }
+  }
+
+  const auto run = [&](const std::function<void(Matrix &)> &infer) {
+    BenchResult result;
+    const auto start = std::chrono::steady_clock::now();
+    for (auto &input : inputs)
+    {
+      const auto request_start = std::chrono::steady_clock::now();
+      infer(input);
+      result.latencies_us.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - request_start).count());
+    }
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+  };
+
+  const BenchResult direct = run([&](Matrix &input) {
+    input.to_device(HANDLE, bank_for(ROLE_INPUT));
+    model.submit(input).wait();
+  });
+
+  ResultCache cache(static_cast<std::size_t>(args.get_uint("cache-mb", 64)) << 20, output_cols);
+  std::vector<float> output(rows * output_cols);
+  const BenchResult cached = run([&](Matrix &input) { infer_cached(model, cache, input.raw_data(), rows, output.data()); });
+
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << std::setw(8) << "mode" << std::setw(12) << "p50 us" << std::setw(12) << "p99 us" << std::setw(14)
+            << "rows/s" << std::endl;
+  print_row("direct", direct, rows);
+  print_row("cached", cached, rows);
+  const CacheStats stats = cache.stats();
+  std::cout << "Hit rate " << 100. * stats.hit_rate() << "%, " << stats.entries << " entries, " << stats.evictions
+            << " evictions, estimated " << stats.saved_seconds * 1e3 << "ms of device latency saved" << std::endl;
+}
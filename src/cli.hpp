@@ -0,0 +1,108 @@
+#ifndef NNONFPGA_CLI
+#define NNONFPGA_CLI
+
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+typedef unsigned int uint;
+
+// Minimal `--name value` / `--flag` parser shared by the command line tools.
+class CliArgs
+{
+private:
+    std::map<std::string, std::string> options;
+    std::vector<std::string> positional;
+
+public:
+    CliArgs(const int argc, const char *argv[])
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            const std::string arg = argv[i];
+            if (arg.compare(0, 2, "--") != 0)
+            {
+                positional.push_back(arg);
+                continue;
+            }
+
+            const auto eq = arg.find('=');
+            if (eq != std::string::npos)
+            {
+                options[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+            }
+            else if (i + 1 < argc && std::string(argv[i + 1]).compare(0, 2, "--") != 0)
+            {
+                options[arg.substr(2)] = argv[++i];
+            }
+            else
+            {
+                options[arg.substr(2)] = "";
+            }
+        }
+    }
+
+    bool has(const std::string &name) const
+    {
+        return options.find(name) != options.end();
+    }
+
+    std::string get(const std::string &name, const std::string &fallback) const
+    {
+        const auto it = options.find(name);
+        return it == options.end() ? fallback : it->second;
+    }
+
+    uint get_uint(const std::string &name, const uint fallback) const
+    {
+        return has(name) ? static_cast<uint>(std::stoul(options.at(name))) : fallback;
+    }
+
+    double get_double(const std::string &name, const double fallback) const
+    {
+        return has(name) ? std::stod(options.at(name)) : fallback;
+    }
+
+    // Comma separated lists, e.g. `--batch-sizes 1,16,256`
+    std::vector<uint> get_uint_list(const std::string &name, const std::vector<uint> &fallback) const
+    {
+        if (!has(name))
+        {
+            return fallback;
+        }
+        std::vector<uint> result;
+        std::istringstream stream(options.at(name));
+        std::string item;
+        while (std::getline(stream, item, ','))
+        {
+            result.push_back(static_cast<uint>(std::stoul(item)));
+        }
+        return result;
+    }
+
+    std::vector<double> get_double_list(const std::string &name, const std::vector<double> &fallback) const
+    {
+        if (!has(name))
+        {
+            return fallback;
+        }
+        std::vector<double> result;
+        std::istringstream stream(options.at(name));
+        std::string item;
+        while (std::getline(stream, item, ','))
+        {
+            result.push_back(std::stod(item));
+        }
+        return result;
+    }
+
+    const std::vector<std::string> &get_positional() const
+    {
+        return positional;
+    }
+};
+
+#endif /* end of include guard: NNONFPGA_CLI */
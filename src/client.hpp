@@ -0,0 +1,140 @@
+#ifndef NNONFPGA_CLIENT
+#define NNONFPGA_CLIENT
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "ipc.hpp"
+
+// Thrown by InferenceClient::wait_any for a request the server failed. The
+// slot is free again and may be resubmitted.
+class RequestFailed : public std::runtime_error
+{
+public:
+    const uint32_t slot;
+    const uint64_t sequence;
+
+    RequestFailed(const uint32_t slot, const uint64_t sequence)
+        : std::runtime_error("Inference failed on the server for slot " + std::to_string(slot)), slot(slot), sequence(sequence) {}
+};
+
+// Client side of fcnn_server. Inputs are written straight into the shared
+// ring (see input()), so submitting a request only sends a small message.
+// A client is meant to be used from a single thread, except that submit and
+// wait_any may each run on a thread of their own.
+class InferenceClient
+{
+private:
+    int fd;
+    uint64_t next_sequence;
+    SharedRing ring;
+
+public:
+    InferenceClient(const std::string &socket_path = DEFAULT_SOCKET_PATH, const uint32_t num_slots = 4, const uint32_t max_rows = 64)
+        : fd(-1), next_sequence(0)
+    {
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        const sockaddr_un addr = socket_address(socket_path);
+        if (fd < 0 || connect(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) != 0)
+        {
+            const std::string reason = strerror(errno);
+            if (fd >= 0)
+                close(fd);
+            throw std::runtime_error("Could not connect to " + socket_path + ": " + reason);
+        }
+
+        Message hello;
+        memset(&hello, 0, sizeof(hello));
+        hello.type = MSG_HELLO;
+        hello.num_slots = num_slots;
+        hello.rows = max_rows;
+        Message reply;
+        if (!send_message(fd, hello) || !receive_message(fd, reply) || reply.type != MSG_HELLO_OK)
+        {
+            close(fd);
+            throw std::runtime_error("Server rejected the connection");
+        }
+        ring.attach(std::string(reply.shm_name, strnlen(reply.shm_name, sizeof(reply.shm_name))));
+    }
+
+    InferenceClient(const InferenceClient &) = delete;
+    InferenceClient &operator=(const InferenceClient &) = delete;
+
+    ~InferenceClient()
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+    }
+
+    uint32_t num_slots() const { return ring.get_layout().num_slots; }
+    uint32_t max_rows() const { return ring.get_layout().max_rows; }
+    uint32_t input_cols() const { return ring.get_layout().input_cols; }
+    uint32_t output_cols() const { return ring.get_layout().output_cols; }
+
+    // Row-major input and output regions of a slot in shared memory
+    float *input(const uint32_t slot) { return ring.input(slot); }
+    const float *output(const uint32_t slot) { return ring.output(slot); }
+
+    // Starts inference on the first `rows` rows of `slot`'s input. The slot
+    // must not be touched until the matching completion arrives.
+    uint64_t submit(const uint32_t slot, const uint32_t rows)
+    {
+        if (slot >= num_slots() || rows == 0 || rows > max_rows())
+        {
+            throw std::runtime_error("Invalid slot or batch size");
+        }
+        Message msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.type = MSG_INFER;
+        msg.slot = slot;
+        msg.rows = rows;
+        msg.sequence = next_sequence++;
+        if (!send_message(fd, msg))
+        {
+            throw std::runtime_error("Lost connection to server");
+        }
+        return msg.sequence;
+    }
+
+    // Blocks until any submitted request finished; returns its slot.
+    // Completions may arrive out of submission order. Throws RequestFailed
+    // with the slot and sequence if the server failed the request.
+    uint32_t wait_any(uint64_t *sequence = NULL)
+    {
+        Message msg;
+        if (!receive_message(fd, msg))
+        {
+            throw std::runtime_error("Lost connection to server");
+        }
+        if (msg.type == MSG_ERROR)
+        {
+            throw RequestFailed(msg.slot, msg.sequence);
+        }
+        if (msg.type != MSG_DONE)
+        {
+            throw std::runtime_error("Unexpected message from the server");
+        }
+        if (sequence != NULL)
+        {
+            *sequence = msg.sequence;
+        }
+        return msg.slot;
+    }
+
+    // Synchronous convenience wrapper using slot 0; only valid while no
+    // other request is in flight
+    void infer(const float *in, const uint32_t rows, float *out)
+    {
+        memcpy(input(0), in, sizeof(float) * rows * input_cols());
+        submit(0, rows);
+        wait_any();
+        memcpy(out, output(0), sizeof(float) * rows * output_cols());
+    }
+};
+
+#endif /* end of include guard: NNONFPGA_CLIENT */
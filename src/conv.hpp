@@ -0,0 +1,84 @@
+#ifndef NNONFPGA_CONV
+#define NNONFPGA_CONV
+
+#include <CL/cl2.hpp>
+#include <utility>
+#include <vector>
+#include "conv_relu6_kernel.hpp"
+#include "matrix.hpp"
+#include "utils.hpp"
+
+// Shape of a conv_relu6_kernel invocation. Images are stored one per Matrix
+// row in CHW order.
+struct ConvShape
+{
+    uint channels, height, width;
+    uint filters;
+    bool pool;
+
+    uint conv_height() const { return height - CONV_KERNEL_SIZE + 1; }
+    uint conv_width() const { return width - CONV_KERNEL_SIZE + 1; }
+    uint out_height() const { return pool ? conv_height() / 2 : conv_height(); }
+    uint out_width() const { return pool ? conv_width() / 2 : conv_width(); }
+
+    uint input_size() const { return channels * height * width; }
+    uint output_size() const { return filters * out_height() * out_width(); }
+    // Number of columns of the (filters x weight_size) weight matrix
+    uint weight_size() const { return channels * CONV_KERNEL_SIZE * CONV_KERNEL_SIZE; }
+
+    bool fits_kernel() const
+    {
+        return width <= CONV_MAX_WIDTH && channels <= CONV_MAX_CHANNELS && filters <= CONV_MAX_FILTERS &&
+               height >= CONV_KERNEL_SIZE && width >= CONV_KERNEL_SIZE;
+    }
+};
+
+std::pair<Matrix, cl::Event> apply_conv(Matrix &input, Matrix &weights, Matrix &bias, const ConvShape &shape, cl::Kernel &kernel, std::vector<cl::Event> *wait_on = NULL, DeviceHandle &handle = HANDLE)
+{
+    assert(shape.fits_kernel());
+    assert(input.cols == shape.input_size());
+    assert(weights.rows == shape.filters && weights.cols == shape.weight_size());
+
+    Matrix result(input.rows, shape.output_size());
+    result.to_device(handle, bank_for(ROLE_ACTIVATION));
+    kernel.setArg(0, input.get_buffer());
+    kernel.setArg(1, weights.get_buffer());
+    kernel.setArg(2, bias.get_buffer());
+    kernel.setArg(3, input.rows);
+    kernel.setArg(4, shape.channels);
+    kernel.setArg(5, shape.height);
+    kernel.setArg(6, shape.width);
+    kernel.setArg(7, shape.filters);
+    kernel.setArg(8, static_cast<uint>(shape.pool));
+    kernel.setArg(9, result.get_buffer());
+
+    cl::Event event;
+    handle.q.enqueueTask(kernel, wait_on, &event);
+    return std::make_pair(std::move(result), event);
+}
+
+// Convolution layer with device-resident weights (filters x channels*3*3)
+// and bias (filters x 1)
+class ConvLayer
+{
+private:
+    Matrix weights, bias;
+    ConvShape shape;
+
+public:
+    ConvLayer(Matrix &&layer_weights, Matrix &&layer_bias, const ConvShape &layer_shape)
+        : weights(std::move(layer_weights)), bias(std::move(layer_bias)), shape(layer_shape)
+    {
+        weights.to_device(HANDLE, bank_for(ROLE_WEIGHT));
+        bias.to_device(HANDLE, bank_for(ROLE_WEIGHT));
+    }
+
+    const ConvShape &get_shape() const { return shape; }
+
+    std::pair<Matrix, cl::Event> operator()(Matrix &input, std::vector<cl::Event> *wait_on = NULL)
+    {
+        return apply_conv(input, weights, bias, shape, CONV_RELU6_KERNEL, wait_on);
+    }
+};
+
+#endif /* end of include guard: NNONFPGA_CONV */
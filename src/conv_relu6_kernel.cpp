@@ -0,0 +1,152 @@
+#include "conv_relu6_kernel.hpp"
+
+inline float relu6(const float x)
+{
+   if (x < 0.f)
+      return 0.f;
+   if (x > 6.f)
+      return 6.f;
+   return x;
+}
+
+inline float max(const float a, const float b)
+{
+   return a > b ? a : b;
+}
+
+// Valid 2D convolution with fused bias, relu6 and optional 2x2 max pooling.
+// Images are stored one per row in CHW order, weights as
+// (filters, channels, CONV_KERNEL_SIZE, CONV_KERNEL_SIZE). Every input pixel
+// is read exactly once: the last rows are kept in line buffers and the
+// current receptive field in a sliding window per channel.
+extern "C" void conv_relu6_kernel(
+    const float *const input, const float *const weights, const float *const bias,
+    const uint batch_size, const uint channels, const uint height, const uint width,
+    const uint filters, const uint pool, float *const out)
+{
+   const uint K = CONV_KERNEL_SIZE;
+   float local_weights[CONV_MAX_FILTERS][CONV_MAX_CHANNELS][K][K];
+#pragma HLS ARRAY_PARTITION variable = local_weights complete dim = 3
+#pragma HLS ARRAY_PARTITION variable = local_weights complete dim = 4
+   float local_bias[CONV_MAX_FILTERS];
+   float line_buffer[K - 1][CONV_MAX_CHANNELS][CONV_MAX_WIDTH];
+#pragma HLS ARRAY_PARTITION variable = line_buffer complete dim = 1
+   float window[CONV_MAX_CHANNELS][K][K];
+#pragma HLS ARRAY_PARTITION variable = window complete dim = 2
+#pragma HLS ARRAY_PARTITION variable = window complete dim = 3
+   // Row-wise maxima of the last even output row and the last even column
+   float pool_row[CONV_MAX_FILTERS][CONV_MAX_WIDTH / 2];
+   float pool_left[CONV_MAX_FILTERS];
+
+   for (uint f = 0; f < filters; f++)
+   {
+      local_bias[f] = bias[f];
+      for (uint c = 0; c < channels; c++)
+      {
+         for (uint ky = 0; ky < K; ky++)
+         {
+            for (uint kx = 0; kx < K; kx++)
+            {
+#pragma HLS PIPELINE II = 1
+               local_weights[f][c][ky][kx] = weights[((f * channels + c) * K + ky) * K + kx];
+            }
+         }
+      }
+   }
+
+   const uint out_height = height - K + 1;
+   const uint out_width = width - K + 1;
+   const uint image_size = channels * height * width;
+   const uint out_image_size = pool ? filters * (out_height / 2) * (out_width / 2)
+                                    : filters * out_height * out_width;
+
+   for (uint b = 0; b < batch_size; b++)
+   {
+      for (uint y = 0; y < height; y++)
+      {
+         for (uint x = 0; x < width; x++)
+         {
+            // Shift the new pixel column of every channel into the line
+            // buffers and the windows
+            for (uint c = 0; c < channels; c++)
+            {
+#pragma HLS PIPELINE II = 1
+               const float pixel = input[b * image_size + (c * height + y) * width + x];
+               float column[K];
+               for (uint r = 0; r < K - 1; r++)
+               {
+                  column[r] = line_buffer[r][c][x];
+               }
+               column[K - 1] = pixel;
+
+               for (uint r = 0; r < K - 2; r++)
+               {
+                  line_buffer[r][c][x] = line_buffer[r + 1][c][x];
+               }
+               line_buffer[K - 2][c][x] = pixel;
+
+               for (uint ky = 0; ky < K; ky++)
+               {
+                  for (uint kx = 0; kx < K - 1; kx++)
+                  {
+                     window[c][ky][kx] = window[c][ky][kx + 1];
+                  }
+                  window[c][ky][K - 1] = column[ky];
+               }
+            }
+
+            if (y < K - 1 || x < K - 1)
+            {
+               continue;
+            }
+
+            const uint oy = y - (K - 1);
+            const uint ox = x - (K - 1);
+            for (uint f = 0; f < filters; f++)
+            {
+               float acc = local_bias[f];
+               for (uint c = 0; c < channels; c++)
+               {
+#pragma HLS PIPELINE II = 1
+                  for (uint ky = 0; ky < K; ky++)
+                  {
+                     for (uint kx = 0; kx < K; kx++)
+                     {
+                        acc += local_weights[f][c][ky][kx] * window[c][ky][kx];
+                     }
+                  }
+               }
+               const float value = relu6(acc);
+
+               if (!pool)
+               {
+                  out[b * out_image_size + (f * out_height + oy) * out_width + ox] = value;
+                  continue;
+               }
+
+               // 2x2 max pooling with stride two, an odd last row or column
+               // is dropped
+               if (oy / 2 >= out_height / 2 || ox / 2 >= out_width / 2)
+               {
+                  continue;
+               }
+               if (ox % 2 == 0)
+               {
+                  pool_left[f] = value;
+                  continue;
+               }
+               const float row_max = max(pool_left[f], value);
+               if (oy % 2 == 0)
+               {
+                  pool_row[f][ox / 2] = row_max;
+               }
+               else
+               {
+                  out[b * out_image_size + (f * (out_height / 2) + oy / 2) * (out_width / 2) + ox / 2] =
+                      max(pool_row[f][ox / 2], row_max);
+               }
+            }
+         }
+      }
+   }
+}
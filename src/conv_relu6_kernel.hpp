@@ -0,0 +1,14 @@
+typedef unsigned int uint;
+
+// Compile-time limits of conv_relu6_kernel. Filters are CONV_KERNEL_SIZE^2,
+// applied without padding and with stride one. The line buffers hold
+// CONV_KERNEL_SIZE - 1 image rows of up to CONV_MAX_WIDTH pixels per channel.
+#define CONV_KERNEL_SIZE 3
+#define CONV_MAX_WIDTH 32
+#define CONV_MAX_CHANNELS 16
+#define CONV_MAX_FILTERS 32
+
+extern "C" void conv_relu6_kernel(
+    const float *const input, const float *const weights, const float *const bias,
+    const uint batch_size, const uint channels, const uint height, const uint width,
+    const uint filters, const uint pool, float *const out);
@@ -0,0 +1,32 @@
+#ifndef NNONFPGA_CPU_LAYERS
+#define NNONFPGA_CPU_LAYERS
+
+#include "expr.hpp"
+#include "matrix.hpp"
+
+// Host implementations of the fused layers, for layers too small to be worth
+// a kernel launch (see scheduler.hpp). Same math as matmul_kernel followed by
+// bias_relu6_kernel or bias_softmax_kernel, fused into one pass over the
+// rows (expr.hpp).
+
+enum Activation
+{
+    ACTIVATION_RELU6,
+    ACTIVATION_SOFTMAX
+};
+
+Matrix cpu_dense(Matrix &input, Matrix &weight, Matrix &bias, const Activation activation)
+{
+    Matrix result(input.rows, weight.cols);
+    if (activation == ACTIVATION_RELU6)
+    {
+        evaluate_into(relu6(matmul(input, weight) + as_row(bias)), result);
+    }
+    else
+    {
+        evaluate_into(softmax_rows(matmul(input, weight) + as_row(bias)), result);
+    }
+    return result;
+}
+
+#endif /* end of include guard: NNONFPGA_CPU_LAYERS */
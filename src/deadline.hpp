@@ -0,0 +1,336 @@
+#ifndef NNONFPGA_DEADLINE
+#define NNONFPGA_DEADLINE
+
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "async.hpp"
+#include "matrix.hpp"
+#include "metrics.hpp"
+#include "net.hpp"
+#include "scheduler.hpp"
+#include "utils.hpp"
+
+// Host-side scheduling of inference requests by deadline. Everything
+// submitted to HANDLE.q runs in submission order, so a large offline batch
+// would hold up an interactive request queued behind it. DeadlineScheduler
+// keeps requests on the host instead and splits them into chunks of at most
+// `chunk_rows` rows. Only a few chunks are on the device at a time, and each
+// free spot goes to the next chunk of the request with the earliest deadline
+// (EDF). A request that arrives later with a tighter deadline therefore waits
+// for at most the chunks already in flight.
+//
+//     DeadlineScheduler scheduler(model, calibrate_chunk_cost(model, 64), 64);
+//     auto outcome = scheduler.submit(sample, 1, probabilities, 1, now + 2ms);
+//     if (outcome.get() == REQUEST_DONE) ...
+//
+// Requests without a deadline sort after all others. Priority only breaks
+// ties between equal deadlines, e.g. between bulk jobs. The chunk cost model
+// predicts when a request would finish. If it would miss its deadline,
+// submit() rejects the request up front. A request that falls behind while
+// queued is dropped at its next chunk instead of using the device for an
+// answer nobody waits for. A request with a chunk that failed on the device
+// is not continued and finishes as failed. The rows of a dropped or failed
+// request may be partially written.
+
+enum RequestOutcome
+{
+    REQUEST_DONE,
+    REQUEST_REJECTED,
+    REQUEST_DROPPED,
+    REQUEST_FAILED
+};
+
+class DeadlineScheduler
+{
+public:
+    typedef std::chrono::steady_clock clock;
+
+    static clock::time_point no_deadline()
+    {
+        return clock::time_point::max();
+    }
+
+private:
+    struct Request
+    {
+        const float *input;
+        float *output;
+        uint rows, next_row, chunks_in_flight;
+        int priority;
+        clock::time_point deadline;
+        uint64_t sequence;
+        bool dropped, failed;
+        std::promise<RequestOutcome> outcome;
+    };
+    typedef std::shared_ptr<Request> RequestPtr;
+
+    struct EarliestDeadline
+    {
+        bool operator()(const RequestPtr &a, const RequestPtr &b) const
+        {
+            if (a->deadline != b->deadline)
+            {
+                return a->deadline < b->deadline;
+            }
+            if (a->priority != b->priority)
+            {
+                return a->priority > b->priority;
+            }
+            return a->sequence < b->sequence;
+        }
+    };
+
+    // Staging matrices of one chunk on the device, page-aligned unlike the
+    // chunks of the caller's arrays
+    struct Slot
+    {
+        Matrix input, output;
+        bool busy;
+    };
+
+    FCNN &model;
+    const LinearCost chunk_cost;
+    const uint chunk_rows;
+    std::vector<Slot> slots;
+    std::set<RequestPtr, EarliestDeadline> queue;
+    uint64_t next_sequence;
+    uint busy_slots;
+    bool stopping;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::thread dispatcher;
+    Counter &done_total, &rejected_total, &dropped_total, &failed_total;
+
+    // Predicted time until all rows not yet dispatched are done
+    double remaining_us(const Request &request) const
+    {
+        const uint rows = request.rows - request.next_row;
+        const uint full = rows / chunk_rows, rest = rows % chunk_rows;
+        return full * chunk_cost(chunk_rows) + (rest > 0 ? chunk_cost(rest) : 0.);
+    }
+
+    static clock::time_point after_us(const clock::time_point start, const double us)
+    {
+        return start + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double, std::micro>(us));
+    }
+
+    void finish(Request &request, const RequestOutcome outcome)
+    {
+        (outcome == REQUEST_DONE ? done_total : outcome == REQUEST_DROPPED ? dropped_total
+                                              : outcome == REQUEST_FAILED ? failed_total : rejected_total).add();
+        request.outcome.set_value(outcome);
+    }
+
+    // Takes the next chunk of `request` under the lock and releases it while
+    // enqueueing, the completion takes the lock as well and may run inline
+    void dispatch(const RequestPtr &request, const uint slot_index, std::unique_lock<std::mutex> &lock)
+    {
+        Slot &slot = slots[slot_index];
+        const uint first = request->next_row, rows = std::min(chunk_rows, request->rows - first);
+        const uint input_cols = slot.input.cols, output_cols = slot.output.cols;
+        request->next_row += rows;
+        request->chunks_in_flight++;
+        slot.busy = true;
+        busy_slots++;
+        if (request->next_row == request->rows)
+        {
+            queue.erase(request);
+        }
+        lock.unlock();
+
+        memcpy(slot.input.raw_data(), request->input + first * input_cols, sizeof(float) * rows * input_cols);
+        memset(slot.output.raw_data(), 0, sizeof(float) * rows * output_cols);
+        std::vector<cl::Event> migrations(2);
+        // The input view has to outlive the kernels, the continuation keeps it
+        auto input = std::make_shared<Matrix>(Matrix::wrap(slot.input.raw_data(), rows, input_cols));
+        input->to_device(HANDLE, bank_for(ROLE_INPUT), &migrations[0]);
+        Matrix output = Matrix::wrap(slot.output.raw_data(), rows, output_cols);
+        output.to_device(HANDLE, bank_for(ROLE_OUTPUT), &migrations[1]);
+        InferenceHandle handle = model.submit_into(*input, std::move(output), &migrations);
+        HANDLE.q.flush();
+        handle.then([this, request, slot_index, first, rows, output_cols, input](Matrix &result) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!request->dropped && !request->failed)
+            {
+                memcpy(request->output + first * output_cols, result.raw_data(), sizeof(float) * rows * output_cols);
+            }
+            release(*request, slot_index);
+        }, [this, request, slot_index](cl_int) {
+            std::lock_guard<std::mutex> lock(mutex);
+            // The rest of the request isn't worth running
+            if (!request->failed && request->next_row < request->rows)
+            {
+                queue.erase(request);
+                request->next_row = request->rows;
+            }
+            request->failed = true;
+            release(*request, slot_index);
+        });
+        lock.lock();
+    }
+
+    // Frees the slot of a finished chunk of `request`, under the lock
+    void release(Request &request, const uint slot_index)
+    {
+        slots[slot_index].busy = false;
+        busy_slots--;
+        request.chunks_in_flight--;
+        if (request.chunks_in_flight == 0 && request.next_row == request.rows)
+        {
+            finish(request, request.failed ? REQUEST_FAILED : request.dropped ? REQUEST_DROPPED : REQUEST_DONE);
+        }
+        changed.notify_all();
+    }
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            changed.wait(lock, [this]() { return (stopping && queue.empty()) || (!queue.empty() && busy_slots < slots.size()); });
+            if (queue.empty())
+            {
+                return;
+            }
+            const RequestPtr request = *queue.begin();
+            // Too late to make it, give up on the rest of the request
+            if (request->deadline != no_deadline() && after_us(clock::now(), remaining_us(*request)) > request->deadline)
+            {
+                queue.erase(queue.begin());
+                request->dropped = true;
+                request->next_row = request->rows;
+                if (request->chunks_in_flight == 0)
+                {
+                    finish(*request, REQUEST_DROPPED);
+                }
+                continue;
+            }
+            uint slot = 0;
+            while (slots[slot].busy)
+            {
+                slot++;
+            }
+            dispatch(request, slot, lock);
+        }
+    }
+
+public:
+    // `chunk_cost` predicts the host-to-host latency of a chunk by its rows,
+    // see calibrate_chunk_cost. `max_in_flight` chunks can be on the device
+    // at once; more overlap transfers with compute, fewer let a new urgent
+    // request start sooner.
+    DeadlineScheduler(FCNN &model, const LinearCost &chunk_cost, const uint chunk_rows = 64, const uint max_in_flight = 2)
+        : model(model), chunk_cost(chunk_cost), chunk_rows(chunk_rows), next_sequence(0), busy_slots(0), stopping(false),
+          done_total(METRICS.counter("fcnn_deadline_requests_total", "Requests by outcome of deadline scheduling", "outcome=\"done\"")),
+          rejected_total(METRICS.counter("fcnn_deadline_requests_total", "Requests by outcome of deadline scheduling", "outcome=\"rejected\"")),
+          dropped_total(METRICS.counter("fcnn_deadline_requests_total", "Requests by outcome of deadline scheduling", "outcome=\"dropped\"")),
+          failed_total(METRICS.counter("fcnn_deadline_requests_total", "Requests by outcome of deadline scheduling", "outcome=\"failed\""))
+    {
+        if (chunk_rows == 0 || max_in_flight == 0)
+        {
+            throw std::runtime_error("DeadlineScheduler needs at least one row per chunk and one chunk in flight");
+        }
+        const auto shape = model.shape();
+        for (uint i = 0; i < max_in_flight; i++)
+        {
+            slots.push_back({Matrix(chunk_rows, shape[0]), Matrix(chunk_rows, shape[2]), false});
+        }
+        dispatcher = std::thread(&DeadlineScheduler::run, this);
+    }
+
+    DeadlineScheduler(const DeadlineScheduler &) = delete;
+    DeadlineScheduler &operator=(const DeadlineScheduler &) = delete;
+
+    // Finishes all queued requests
+    ~DeadlineScheduler()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        dispatcher.join();
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this]() { return busy_slots == 0; });
+    }
+
+    // Queues `rows` samples of `input` whose class probabilities go to
+    // `output`. Both have to stay alive until the outcome is set. Higher
+    // `priority` goes first among requests with the same deadline.
+    std::future<RequestOutcome> submit(const float *input, const uint rows, float *output, const int priority = 0,
+                                       const clock::time_point deadline = no_deadline())
+    {
+        RequestPtr request = std::make_shared<Request>();
+        request->input = input;
+        request->output = output;
+        request->rows = rows;
+        request->next_row = 0;
+        request->chunks_in_flight = 0;
+        request->priority = priority;
+        request->deadline = deadline;
+        request->dropped = false;
+        request->failed = false;
+        std::future<RequestOutcome> outcome = request->outcome.get_future();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        request->sequence = next_sequence++;
+        if (rows == 0 || stopping)
+        {
+            finish(*request, REQUEST_REJECTED);
+            return outcome;
+        }
+        if (deadline != no_deadline())
+        {
+            // Everything scheduled ahead of it, plus what is on the device
+            double ahead_us = remaining_us(*request) + busy_slots * chunk_cost(chunk_rows);
+            for (const RequestPtr &queued : queue)
+            {
+                if (!EarliestDeadline()(queued, request))
+                {
+                    break;
+                }
+                ahead_us += remaining_us(*queued);
+            }
+            if (after_us(clock::now(), ahead_us) > deadline)
+            {
+                finish(*request, REQUEST_REJECTED);
+                return outcome;
+            }
+        }
+        queue.insert(request);
+        changed.notify_all();
+        return outcome;
+    }
+
+    uint max_chunk_rows() const
+    {
+        return chunk_rows;
+    }
+};
+
+// Host-to-host latency of a chunk of 1 and of `chunk_rows` rows, including
+// the migrations, interpolated in between
+LinearCost calibrate_chunk_cost(FCNN &model, const uint chunk_rows, const uint repeats = 20)
+{
+    double us[2];
+    const uint rows[2] = {1, chunk_rows};
+    for (uint i = 0; i < 2; i++)
+    {
+        Matrix input = Matrix::random(rows[i], model.shape()[0]);
+        us[i] = median_us(repeats, [&]() {
+            input.to_device(HANDLE, bank_for(ROLE_INPUT));
+            model.submit(input).wait();
+        });
+    }
+    return LinearCost::fit(rows[0], us[0], rows[1], us[1]);
+}
+
+#endif /* end of include guard: NNONFPGA_DEADLINE */
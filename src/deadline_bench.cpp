@@ -0,0 +1,174 @@
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "cli.hpp"
+#include "deadline.hpp"
+#include "matrix.hpp"
+#include "net.hpp"
+#include "stats.hpp"
+#include "utils.hpp"
+
+// Latency of interactive single-sample requests while bulk jobs of
+// `--bulk-rows` rows keep the device busy, once submitted straight to the
+// command queue (fifo) and once through DeadlineScheduler (edf).
+// Interactive requests arrive every 1/`--rate` seconds, each with a deadline
+// of `--deadline-ms` after its arrival. Latencies run from the scheduled
+// arrival to the result, and only count completed requests. Rejected,
+// dropped and failed requests are counted separately.
+//
+// Usage: deadline_bench [--weights DIR] [--rate 200] [--deadline-ms 5]
+//                       [--bulk-rows 8192] [--bulk-jobs 2] [--chunk-rows 256]
+//                       [--in-flight 2] [--duration 10]
+
+typedef std::chrono::steady_clock bench_clock;
+
+struct BenchResult
+{
+  std::vector<double> latencies_us;
+  uint rejected, dropped, failed;
+  uint64_t bulk_rows;
+};
+
+// Sends interactive requests through `infer` while `bulk` loops on
+// `bulk_jobs` threads, each passing its job index and counting the rows done
+BenchResult run_mix(const double rate, const double duration, const uint bulk_jobs,
+                    const std::function<RequestOutcome(bench_clock::time_point)> &infer,
+                    const std::function<uint(uint)> &bulk)
+{
+  BenchResult result = {{}, 0, 0, 0, 0};
+  std::atomic<bool> done(false);
+  std::atomic<uint64_t> bulk_rows(0);
+  std::vector<std::thread> bulk_threads;
+  for (uint job = 0; job < bulk_jobs; job++)
+  {
+    bulk_threads.push_back(std::thread([&, job]() {
+      while (!done)
+      {
+        bulk_rows += bulk(job);
+      }
+    }));
+  }
+
+  const auto interval = std::chrono::duration_cast<bench_clock::duration>(std::chrono::duration<double>(1. / rate));
+  const auto start = bench_clock::now();
+  const auto end = start + std::chrono::duration_cast<bench_clock::duration>(std::chrono::duration<double>(duration));
+  for (auto arrival = start + interval; arrival < end; arrival += interval)
+  {
+    std::this_thread::sleep_until(arrival);
+    const RequestOutcome outcome = infer(arrival);
+    if (outcome == REQUEST_DONE)
+    {
+      result.latencies_us.push_back(std::chrono::duration<double, std::micro>(bench_clock::now() - arrival).count());
+    }
+    result.rejected += outcome == REQUEST_REJECTED;
+    result.dropped += outcome == REQUEST_DROPPED;
+    result.failed += outcome == REQUEST_FAILED;
+  }
+  done = true;
+  for (auto &thread : bulk_threads)
+  {
+    thread.join();
+  }
+  result.bulk_rows = bulk_rows;
+  return result;
+}
+
+void print_result(const std::string &mode, const BenchResult &result, const double duration)
+{
+  std::cout << std::setw(6) << mode << std::setw(10) << result.latencies_us.size() << std::setw(10) << result.rejected
+            << std::setw(10) << result.dropped << std::setw(10) << result.failed << std::setw(12)
+            << percentile(result.latencies_us, 50.) << std::setw(12) << percentile(result.latencies_us, 99.)
+            << std::setw(14) << result.bulk_rows / duration
+            << std::endl;
+}
+
+int main(int argc, const char *argv[])
+{
+  const CliArgs args(argc, argv);
+  const double rate = args.get_double("rate", 200.);
+  const double deadline_ms = args.get_double("deadline-ms", 5.);
+  const uint bulk_rows = args.get_uint("bulk-rows", 8192);
+  const uint bulk_jobs = args.get_uint("bulk-jobs", 2);
+  const uint chunk_rows = args.get_uint("chunk-rows", 256);
+  const uint in_flight = args.get_uint("in-flight", 2);
+  const double duration = args.get_double("duration", 10.);
+
+  init_kernels();
+  FCNN model(args.get("weights", "../weights"));
+  finish_cl_queue();
+  const uint input_cols = model.shape()[0], output_cols = model.shape()[2];
+  const auto deadline = std::chrono::duration_cast<bench_clock::duration>(std::chrono::duration<double, std::milli>(deadline_ms));
+
+  const LinearCost cost = calibrate_chunk_cost(model, chunk_rows);
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << "Chunk cost: " << cost.fixed_us << "us + " << cost.per_unit_us << "us/row" << std::endl;
+  std::cout << std::setw(6) << "mode" << std::setw(10) << "done" << std::setw(10) << "rejected"
+            << std::setw(10) << "dropped" << std::setw(10) << "failed" << std::setw(12) << "p50 us"
+            << std::setw(12) << "p99 us" << std::setw(14) << "bulk rows/s" << std::endl;
+
+  // Every request and job has inputs of its own, HANDLE.q is shared
+  Matrix sample = Matrix::random(1, input_cols, 1);
+  std::vector<Matrix> bulk_inputs;
+  for (uint job = 0; job < bulk_jobs; job++)
+  {
+    bulk_inputs.push_back(Matrix::random(bulk_rows, input_cols, 2 + job));
+  }
+
+  {
+    // submit() sets the arguments of the shared kernels, so only one thread
+    // may enqueue at a time; waiting happens outside the lock
+    std::mutex submit_mutex;
+    const auto submit = [&](Matrix &input) {
+      std::lock_guard<std::mutex> lock(submit_mutex);
+      input.to_device(HANDLE, bank_for(ROLE_INPUT));
+      return model.submit(input);
+    };
+    const BenchResult fifo = run_mix(
+        rate, duration, bulk_jobs,
+        [&](bench_clock::time_point) {
+          try
+          {
+            submit(sample).wait();
+          }
+          catch (const std::runtime_error &)
+          {
+            return REQUEST_FAILED;
+          }
+          return REQUEST_DONE;
+        },
+        [&](const uint job) {
+          try
+          {
+            submit(bulk_inputs[job]).wait();
+          }
+          catch (const std::runtime_error &)
+          {
+            return 0u;
+          }
+          return bulk_rows;
+        });
+    print_result("fifo", fifo, duration);
+  }
+
+  {
+    DeadlineScheduler scheduler(model, cost, chunk_rows, in_flight);
+    std::vector<float> sample_output(output_cols);
+    std::vector<std::vector<float>> bulk_outputs(bulk_jobs, std::vector<float>(bulk_rows * output_cols));
+    const BenchResult edf = run_mix(
+        rate, duration, bulk_jobs,
+        [&](bench_clock::time_point arrival) {
+          return scheduler.submit(sample.raw_data(), 1, sample_output.data(), 1, arrival + deadline).get();
+        },
+        [&](const uint job) {
+          scheduler.submit(bulk_inputs[job].raw_data(), bulk_rows, bulk_outputs[job].data()).get();
+          return bulk_rows;
+        });
+    print_result("edf", edf, duration);
+  }
+}
@@ -0,0 +1,84 @@
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "cli.hpp"
+#include "libnpy.hpp"
+#include "net.hpp"
+#include "trainer.hpp"
+#include "utils.hpp"
+
+// Fine-tunes the FCNN on the device (trainer.hpp) and compares the loss
+// curve with train.py's. The run is a recording of train.py:
+//
+//     python train.py --record run
+//
+// writes the initial weights to run/init/, the batches it trained on to
+// run/x.npy (one row per sample) and run/y.npy (labels as float32) and its
+// loss per step to run/loss.npy. This tool trains from the same weights on the same batches
+// and prints both losses every `--every` steps. With `--out DIR` the
+// fine-tuned weights are saved in the format `--weights` takes everywhere.
+//
+// Usage: device_train [--record run] [--batch 32] [--optimizer adam]
+//                     [--lr 0.01] [--every 10] [--out DIR]
+
+int main(int argc, const char *argv[])
+{
+  const CliArgs args(argc, argv);
+  const std::string record = args.get("record", "run");
+  const uint batch_size = args.get_uint("batch", 32);
+  const std::string algorithm = args.get("optimizer", "adam");
+  const float learning_rate = args.get_double("lr", 0.01);
+  const uint every = std::max(args.get_uint("every", 10), 1u);
+
+  int rows, cols, label_rows, steps;
+  std::vector<float> x, y, expected_loss;
+  aoba::LoadArrayFromNumpy(record + "/x.npy", rows, cols, x);
+  aoba::LoadArrayFromNumpy(record + "/y.npy", label_rows, y);
+  aoba::LoadArrayFromNumpy(record + "/loss.npy", steps, expected_loss);
+  if (label_rows != rows || static_cast<uint>(rows) < batch_size * steps)
+  {
+    std::cerr << "Recording has " << rows << " rows and " << label_rows << " labels, " << steps << " steps of "
+              << batch_size << " need " << batch_size * steps << std::endl;
+    return 1;
+  }
+  std::vector<uint> labels(y.begin(), y.end());
+
+  OptimizerConfig optimizer = OptimizerConfig::adam(learning_rate);
+  if (algorithm == "sgd")
+  {
+    optimizer = OptimizerConfig::sgd(learning_rate);
+  }
+  else if (algorithm != "adam")
+  {
+    std::cerr << "Unknown optimizer " << algorithm << ", use adam or sgd" << std::endl;
+    return 1;
+  }
+
+  init_kernels();
+  FCNN model(record + "/init");
+  Trainer trainer(model, batch_size, optimizer);
+
+  std::cout << std::setw(8) << "step" << std::setw(12) << "device" << std::setw(12) << "train.py" << std::endl;
+  std::cout << std::fixed << std::setprecision(5);
+  double max_difference = 0.;
+  for (int step = 0; step < steps; step++)
+  {
+    const std::size_t first = static_cast<std::size_t>(step) * batch_size;
+    const float loss = trainer.step(&x[first * cols], &labels[first]);
+    max_difference = std::max(max_difference, static_cast<double>(std::fabs(loss - expected_loss[step])));
+    if (step % every == 0 || step == steps - 1)
+    {
+      std::cout << std::setw(8) << step << std::setw(12) << loss << std::setw(12) << expected_loss[step] << std::endl;
+    }
+  }
+  std::cout << "Largest loss difference: " << max_difference << std::endl;
+
+  if (args.has("out"))
+  {
+    trainer.save(args.get("out", ""));
+  }
+}
@@ -0,0 +1,501 @@
+#ifndef NNONFPGA_EXPR
+#define NNONFPGA_EXPR
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "matrix.hpp"
+
+// Lazy host-side math on matrices. Operators build an expression tree instead
+// of computing anything; evaluate_into computes it in one pass over the rows
+// of a preallocated output, without materializing any intermediate matrix:
+//
+//     evaluate_into(relu6(matmul(input, weight) + as_row(bias)), hidden);
+//     const std::vector<uint> classes = argmax_rows(probabilities);
+//
+// Every node is evaluated a row at a time: load_row(r) prepares row r
+// (recursively), at(c) then returns its element in column c. Elementwise
+// nodes just combine their children's elements, so the innermost loop over
+// the columns is a straight-line expression of row pointers the compiler can
+// vectorize. Row-wise nodes (matmul, softmax, reductions) compute their row in
+// load_row into a single row of scratch.
+//
+// A matrix with one row (a bias) is broadcast over the rows of the other
+// operand, and reductions and scalars over the columns. Expressions keep
+// pointers to the matrices they were built from, which have to outlive them,
+// and hold mutable row state, so an expression can't be evaluated by two
+// threads at once.
+
+template <typename E>
+struct Expr
+{
+    const E &self() const
+    {
+        return static_cast<const E &>(*this);
+    }
+};
+
+struct MatrixExpr : public Expr<MatrixExpr>
+{
+    // A single row doesn't depend on the column
+    static const bool uniform_row = false;
+
+    const float *data;
+    uint rows, cols;
+    mutable const float *row;
+
+    MatrixExpr(const Matrix &matrix) : data(matrix.raw_data()), rows(matrix.rows), cols(matrix.cols), row(matrix.raw_data()) {}
+
+    void load_row(const uint r) const
+    {
+        row = rows == 1 ? data : data + static_cast<std::size_t>(r) * cols;
+    }
+
+    float at(const uint c) const
+    {
+        return row[c];
+    }
+};
+
+struct ScalarExpr : public Expr<ScalarExpr>
+{
+    static const bool uniform_row = true;
+
+    float value;
+    uint rows, cols;
+
+    explicit ScalarExpr(const float value) : value(value), rows(1), cols(1) {}
+
+    void load_row(const uint) const {}
+
+    float at(const uint) const
+    {
+        return value;
+    }
+};
+
+// Operands are matrices or expressions
+template <typename T>
+struct ExprOf
+{
+    typedef T type;
+    static const bool value = std::is_base_of<Expr<T>, T>::value;
+
+    static const T &get(const T &e)
+    {
+        return e;
+    }
+};
+
+template <>
+struct ExprOf<Matrix>
+{
+    typedef MatrixExpr type;
+    static const bool value = true;
+
+    static MatrixExpr get(const Matrix &m)
+    {
+        return MatrixExpr(m);
+    }
+};
+
+namespace detail
+{
+    inline uint broadcast(const uint a, const uint b, const char *what)
+    {
+        if (a != b && a != 1 && b != 1)
+        {
+            throw std::runtime_error(std::string("Expression operands have mismatching ") + what + ": " + std::to_string(a) +
+                                     " and " + std::to_string(b));
+        }
+        return std::max(a, b);
+    }
+} // namespace detail
+
+template <typename F, typename E>
+struct UnaryExpr : public Expr<UnaryExpr<F, E>>
+{
+    static const bool uniform_row = E::uniform_row;
+
+    E e;
+    F f;
+    uint rows, cols;
+
+    UnaryExpr(const E &e, const F &f) : e(e), f(f), rows(e.rows), cols(e.cols) {}
+
+    void load_row(const uint r) const
+    {
+        e.load_row(r);
+    }
+
+    float at(const uint c) const
+    {
+        return f(e.at(c));
+    }
+};
+
+template <typename F, typename L, typename R>
+struct BinaryExpr : public Expr<BinaryExpr<F, L, R>>
+{
+    static const bool uniform_row = L::uniform_row && R::uniform_row;
+
+    L l;
+    R r;
+    uint rows, cols;
+
+    BinaryExpr(const L &l, const R &r)
+        : l(l), r(r), rows(detail::broadcast(l.rows, r.rows, "rows")), cols(detail::broadcast(l.cols, r.cols, "columns"))
+    {
+        if ((l.cols < cols && !L::uniform_row) || (r.cols < cols && !R::uniform_row))
+        {
+            throw std::runtime_error("Only scalars and row reductions broadcast over columns");
+        }
+    }
+
+    void load_row(const uint row) const
+    {
+        l.load_row(row);
+        r.load_row(row);
+    }
+
+    float at(const uint c) const
+    {
+        return F::apply(l.at(c), r.at(c));
+    }
+};
+
+// Product of an expression with a matrix. Row r is accumulated over the rows
+// of `b` (the order cpu_dense uses), so `b` streams sequentially.
+template <typename A>
+struct MatmulExpr : public Expr<MatmulExpr<A>>
+{
+    static const bool uniform_row = false;
+
+    A a;
+    MatrixExpr b;
+    uint rows, cols;
+    mutable std::vector<float> row;
+
+    MatmulExpr(const A &a, const MatrixExpr &b) : a(a), b(b), rows(a.rows), cols(b.cols)
+    {
+        if (a.cols != b.rows)
+        {
+            throw std::runtime_error("Can't multiply " + std::to_string(a.rows) + "x" + std::to_string(a.cols) + " by " +
+                                     std::to_string(b.rows) + "x" + std::to_string(b.cols));
+        }
+    }
+
+    void load_row(const uint r) const
+    {
+        a.load_row(r);
+        row.assign(cols, 0.f);
+        float *out = row.data();
+        for (uint k = 0; k < b.rows; k++)
+        {
+            const float x = a.at(k);
+            const float *w = b.data + static_cast<std::size_t>(k) * cols;
+            for (uint j = 0; j < cols; j++)
+            {
+                out[j] += x * w[j];
+            }
+        }
+    }
+
+    float at(const uint c) const
+    {
+        return row[c];
+    }
+};
+
+// Softmax over each row, shifted by the row's maximum
+template <typename E>
+struct SoftmaxExpr : public Expr<SoftmaxExpr<E>>
+{
+    static const bool uniform_row = false;
+
+    E e;
+    uint rows, cols;
+    mutable std::vector<float> row;
+
+    explicit SoftmaxExpr(const E &e) : e(e), rows(e.rows), cols(e.cols) {}
+
+    void load_row(const uint r) const
+    {
+        e.load_row(r);
+        row.resize(cols);
+        float max_value = -std::numeric_limits<float>::infinity();
+        for (uint c = 0; c < cols; c++)
+        {
+            row[c] = e.at(c);
+            max_value = std::max(max_value, row[c]);
+        }
+        float total = 0.f;
+        for (uint c = 0; c < cols; c++)
+        {
+            row[c] = std::exp(row[c] - max_value);
+            total += row[c];
+        }
+        const float scale = 1.f / total;
+        for (uint c = 0; c < cols; c++)
+        {
+            row[c] *= scale;
+        }
+    }
+
+    float at(const uint c) const
+    {
+        return row[c];
+    }
+};
+
+// One value per row, broadcast over the columns of whatever it's combined
+// with, e.g. x - row_max(x)
+template <typename F, typename E>
+struct RowReduceExpr : public Expr<RowReduceExpr<F, E>>
+{
+    static const bool uniform_row = true;
+
+    E e;
+    uint rows, cols;
+    mutable float value;
+
+    explicit RowReduceExpr(const E &e) : e(e), rows(e.rows), cols(1), value(0.f) {}
+
+    void load_row(const uint r) const
+    {
+        e.load_row(r);
+        float result = F::init();
+        for (uint c = 0; c < e.cols; c++)
+        {
+            result = F::apply(result, e.at(c));
+        }
+        value = result;
+    }
+
+    float at(const uint) const
+    {
+        return value;
+    }
+};
+
+struct AddOp
+{
+    static float init() { return 0.f; }
+    static float apply(const float a, const float b) { return a + b; }
+};
+
+struct SubOp
+{
+    static float apply(const float a, const float b) { return a - b; }
+};
+
+struct MulOp
+{
+    static float apply(const float a, const float b) { return a * b; }
+};
+
+struct MaxOp
+{
+    static float init() { return -std::numeric_limits<float>::infinity(); }
+    static float apply(const float a, const float b) { return std::max(a, b); }
+};
+
+struct Relu
+{
+    float operator()(const float x) const { return std::max(x, 0.f); }
+};
+
+struct Relu6
+{
+    float operator()(const float x) const { return std::min(std::max(x, 0.f), 6.f); }
+};
+
+struct Sigmoid
+{
+    float operator()(const float x) const { return 1.f / (1.f + std::exp(-x)); }
+};
+
+struct Exp
+{
+    float operator()(const float x) const { return std::exp(x); }
+};
+
+// Enables an operator for operands that are matrices or expressions
+template <typename A, typename T>
+struct IfExpr : std::enable_if<ExprOf<A>::value, T>
+{
+};
+
+template <typename A, typename B, typename T>
+struct IfExprs : std::enable_if<ExprOf<A>::value && ExprOf<B>::value, T>
+{
+};
+
+template <typename L, typename R>
+typename IfExprs<L, R, BinaryExpr<AddOp, typename ExprOf<L>::type, typename ExprOf<R>::type>>::type
+operator+(const L &l, const R &r)
+{
+    return BinaryExpr<AddOp, typename ExprOf<L>::type, typename ExprOf<R>::type>(ExprOf<L>::get(l), ExprOf<R>::get(r));
+}
+
+template <typename L, typename R>
+typename IfExprs<L, R, BinaryExpr<SubOp, typename ExprOf<L>::type, typename ExprOf<R>::type>>::type
+operator-(const L &l, const R &r)
+{
+    return BinaryExpr<SubOp, typename ExprOf<L>::type, typename ExprOf<R>::type>(ExprOf<L>::get(l), ExprOf<R>::get(r));
+}
+
+// Elementwise product; `*` between two operands is ambiguous with matmul
+template <typename L, typename R>
+typename IfExprs<L, R, BinaryExpr<MulOp, typename ExprOf<L>::type, typename ExprOf<R>::type>>::type
+multiply(const L &l, const R &r)
+{
+    return BinaryExpr<MulOp, typename ExprOf<L>::type, typename ExprOf<R>::type>(ExprOf<L>::get(l), ExprOf<R>::get(r));
+}
+
+template <typename E>
+typename IfExpr<E, BinaryExpr<MulOp, typename ExprOf<E>::type, ScalarExpr>>::type operator*(const E &e, const float scale)
+{
+    return BinaryExpr<MulOp, typename ExprOf<E>::type, ScalarExpr>(ExprOf<E>::get(e), ScalarExpr(scale));
+}
+
+template <typename E>
+typename IfExpr<E, BinaryExpr<MulOp, typename ExprOf<E>::type, ScalarExpr>>::type operator*(const float scale, const E &e)
+{
+    return e * scale;
+}
+
+template <typename E>
+typename IfExpr<E, BinaryExpr<MulOp, typename ExprOf<E>::type, ScalarExpr>>::type operator/(const E &e, const float divisor)
+{
+    return e * (1.f / divisor);
+}
+
+// A vector stored as a column or a row, as a single row, e.g. a bias
+inline MatrixExpr as_row(const Matrix &vector)
+{
+    MatrixExpr e(vector);
+    e.cols = vector.rows * vector.cols;
+    e.rows = 1;
+    return e;
+}
+
+template <typename E>
+typename IfExpr<E, MatmulExpr<typename ExprOf<E>::type>>::type matmul(const E &a, const Matrix &b)
+{
+    return MatmulExpr<typename ExprOf<E>::type>(ExprOf<E>::get(a), MatrixExpr(b));
+}
+
+// Any elementwise function of one float
+template <typename E, typename F>
+typename IfExpr<E, UnaryExpr<F, typename ExprOf<E>::type>>::type map_elements(const E &e, const F &f)
+{
+    return UnaryExpr<F, typename ExprOf<E>::type>(ExprOf<E>::get(e), f);
+}
+
+template <typename E>
+typename IfExpr<E, UnaryExpr<Relu, typename ExprOf<E>::type>>::type relu(const E &e)
+{
+    return map_elements(e, Relu());
+}
+
+template <typename E>
+typename IfExpr<E, UnaryExpr<Relu6, typename ExprOf<E>::type>>::type relu6(const E &e)
+{
+    return map_elements(e, Relu6());
+}
+
+template <typename E>
+typename IfExpr<E, UnaryExpr<Sigmoid, typename ExprOf<E>::type>>::type sigmoid(const E &e)
+{
+    return map_elements(e, Sigmoid());
+}
+
+template <typename E>
+typename IfExpr<E, UnaryExpr<Exp, typename ExprOf<E>::type>>::type exp_of(const E &e)
+{
+    return map_elements(e, Exp());
+}
+
+template <typename E>
+typename IfExpr<E, SoftmaxExpr<typename ExprOf<E>::type>>::type softmax_rows(const E &e)
+{
+    return SoftmaxExpr<typename ExprOf<E>::type>(ExprOf<E>::get(e));
+}
+
+template <typename E>
+typename IfExpr<E, RowReduceExpr<AddOp, typename ExprOf<E>::type>>::type row_sum(const E &e)
+{
+    return RowReduceExpr<AddOp, typename ExprOf<E>::type>(ExprOf<E>::get(e));
+}
+
+template <typename E>
+typename IfExpr<E, RowReduceExpr<MaxOp, typename ExprOf<E>::type>>::type row_max(const E &e)
+{
+    return RowReduceExpr<MaxOp, typename ExprOf<E>::type>(ExprOf<E>::get(e));
+}
+
+// Computes `e` into `out`, which has to have its shape. `out` may be one of
+// the operands of elementwise nodes, but not the right-hand side of a matmul.
+template <typename E>
+Matrix &evaluate_into(const Expr<E> &e, Matrix &out)
+{
+    // A local copy, so that stores to `out` can't alias the expression's own
+    // members (scalars, row pointers) and the column loop stays vectorizable
+    const E local = e.self();
+    if (out.rows != local.rows || out.cols != local.cols)
+    {
+        throw std::runtime_error("Expression is " + std::to_string(local.rows) + "x" + std::to_string(local.cols) +
+                                 ", output is " + std::to_string(out.rows) + "x" + std::to_string(out.cols));
+    }
+    const uint cols = local.cols;
+    for (uint r = 0; r < local.rows; r++)
+    {
+        local.load_row(r);
+        float *row = out.raw_data() + static_cast<std::size_t>(r) * cols;
+        for (uint c = 0; c < cols; c++)
+        {
+            row[c] = local.at(c);
+        }
+    }
+    return out;
+}
+
+template <typename E>
+Matrix evaluate(const Expr<E> &e)
+{
+    Matrix out(e.self().rows, e.self().cols);
+    evaluate_into(e, out);
+    return out;
+}
+
+// Column of the largest element of each row, e.g. the predicted classes
+template <typename E>
+typename IfExpr<E, std::vector<uint>>::type argmax_rows(const E &operand)
+{
+    const typename ExprOf<E>::type e = ExprOf<E>::get(operand);
+    std::vector<uint> result(e.rows);
+    for (uint r = 0; r < e.rows; r++)
+    {
+        e.load_row(r);
+        uint best = 0;
+        float best_value = e.at(0);
+        for (uint c = 1; c < e.cols; c++)
+        {
+            const float value = e.at(c);
+            if (value > best_value)
+            {
+                best = c;
+                best_value = value;
+            }
+        }
+        result[r] = best;
+    }
+    return result;
+}
+
+#endif /* end of include guard: NNONFPGA_EXPR */
@@ -0,0 +1,121 @@
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "cli.hpp"
+#include "expr.hpp"
+#include "matrix.hpp"
+#include "net.hpp"
+#include "scheduler.hpp"
+
+// Host math written as scalar loops through Matrix::operator(), the way the
+// reference checks and post-processing are, against the same computation as
+// a fused expression (expr.hpp) evaluated into a preallocated output. Runs on
+// the host only and uses the model's weights for the dense layers.
+//
+// Usage: expr_bench [--weights DIR] [--batch-sizes 1,16,256,1024] [--repeats 20]
+
+void loop_dense(Matrix &input, Matrix &weight, Matrix &bias, Matrix &out, const bool softmax)
+{
+  for (uint i = 0; i < input.rows; i++)
+  {
+    for (uint j = 0; j < weight.cols; j++)
+    {
+      float acc = bias.raw_data()[j];
+      for (uint k = 0; k < weight.rows; k++)
+      {
+        acc += input(i, k) * weight(k, j);
+      }
+      out(i, j) = softmax ? std::exp(acc) : std::min(std::max(acc, 0.f), 6.f);
+    }
+    if (softmax)
+    {
+      float total = 0.f;
+      for (uint j = 0; j < weight.cols; j++)
+      {
+        total += out(i, j);
+      }
+      for (uint j = 0; j < weight.cols; j++)
+      {
+        out(i, j) /= total;
+      }
+    }
+  }
+}
+
+void loop_axpy(Matrix &a, Matrix &b, Matrix &out)
+{
+  for (uint i = 0; i < a.rows; i++)
+  {
+    for (uint j = 0; j < a.cols; j++)
+    {
+      out(i, j) = 0.5f * a(i, j) + b(i, j);
+    }
+  }
+}
+
+std::vector<uint> loop_argmax(Matrix &m)
+{
+  std::vector<uint> result(m.rows);
+  for (uint i = 0; i < m.rows; i++)
+  {
+    for (uint j = 1; j < m.cols; j++)
+    {
+      result[i] = m(i, j) > m(i, result[i]) ? j : result[i];
+    }
+  }
+  return result;
+}
+
+void print_row(const std::string &name, const uint batch_size, const double loop_us, const double expr_us)
+{
+  std::cout << std::setw(16) << name << std::setw(8) << batch_size << std::setw(12) << loop_us << std::setw(12) << expr_us
+            << std::setw(10) << loop_us / expr_us << "x" << std::endl;
+}
+
+int main(int argc, const char *argv[])
+{
+  const CliArgs args(argc, argv);
+  const auto batch_sizes = args.get_uint_list("batch-sizes", {1, 16, 256, 1024});
+  const uint repeats = args.get_uint("repeats", 20);
+
+  init_kernels();
+  FCNN model(args.get("weights", "../weights"));
+  Matrix &w1 = model.weight(0), &b1 = model.bias(0), &w2 = model.weight(1), &b2 = model.bias(1);
+
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << std::setw(16) << "operation" << std::setw(8) << "batch" << std::setw(12) << "loop us" << std::setw(12)
+            << "expr us" << std::setw(11) << "speedup" << std::endl;
+  for (const uint batch_size : batch_sizes)
+  {
+    Matrix input = Matrix::random(batch_size, w1.rows, 1);
+    Matrix hidden(batch_size, w1.cols), output(batch_size, w2.cols);
+
+    print_row("dense relu6", batch_size,
+              median_us(repeats, [&]() { loop_dense(input, w1, b1, hidden, false); }),
+              median_us(repeats, [&]() { evaluate_into(relu6(matmul(input, w1) + as_row(b1)), hidden); }));
+    print_row("dense softmax", batch_size,
+              median_us(repeats, [&]() { loop_dense(hidden, w2, b2, output, true); }),
+              median_us(repeats, [&]() { evaluate_into(softmax_rows(matmul(hidden, w2) + as_row(b2)), output); }));
+    // Both layers at once, without materializing the hidden activations
+    print_row("forward", batch_size,
+              median_us(repeats, [&]() {
+                loop_dense(input, w1, b1, hidden, false);
+                loop_dense(hidden, w2, b2, output, true);
+              }),
+              median_us(repeats, [&]() {
+                evaluate_into(softmax_rows(matmul(relu6(matmul(input, w1) + as_row(b1)), w2) + as_row(b2)), output);
+              }));
+
+    Matrix a = Matrix::random(batch_size, w1.rows, 2), b = Matrix::random(batch_size, w1.rows, 3), sum(batch_size, w1.rows);
+    print_row("0.5a + b", batch_size,
+              median_us(repeats, [&]() { loop_axpy(a, b, sum); }),
+              median_us(repeats, [&]() { evaluate_into(0.5f * a + b, sum); }));
+    print_row("argmax", batch_size,
+              median_us(repeats, [&]() { loop_argmax(output); }),
+              median_us(repeats, [&]() { argmax_rows(output); }));
+  }
+}
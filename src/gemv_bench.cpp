@@ -0,0 +1,80 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "cli.hpp"
+#include "matrix.hpp"
+#include "net.hpp"
+#include "stats.hpp"
+#include "utils.hpp"
+
+// Single-sample latency of FCNN through the generic matmul and bias kernels
+// against the batch-1 path (gemv_kernel). Host latency runs from migrating
+// the input to the result being back on the host, as FCNN::submit does it;
+// device time spans the kernels only.
+//
+// Usage: gemv_bench [--weights DIR] [--repeats 1000]
+
+struct Latencies
+{
+  std::vector<double> host_us, device_us;
+};
+
+Latencies measure(FCNN &model, Matrix &input, const uint repeats)
+{
+  Latencies result;
+  for (uint r = 0; r <= repeats; r++)
+  {
+    std::vector<cl::Event> kernel_events;
+    const auto start = std::chrono::steady_clock::now();
+    input.to_device(HANDLE, bank_for(ROLE_INPUT));
+    Matrix output = Matrix::constant(1, model.shape()[2], 0.0);
+    output.to_device(HANDLE, bank_for(ROLE_OUTPUT));
+    const std::vector<cl::Event> done = {model.forward(input, output, &kernel_events)};
+    output.to_cpu(HANDLE, &done);
+    finish_cl_queue();
+    // First round is a warmup
+    if (r > 0)
+    {
+      result.host_us.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+      result.device_us.push_back(events_span_ns(kernel_events) * 1e-3);
+    }
+  }
+  return result;
+}
+
+void print_row(const std::string &path, const Latencies &latencies)
+{
+  std::cout << std::setw(8) << path << std::setw(12) << percentile(latencies.host_us, 50.)
+            << std::setw(12) << percentile(latencies.host_us, 99.) << std::setw(14) << median(latencies.device_us)
+            << std::endl;
+}
+
+int main(int argc, const char *argv[])
+{
+  const CliArgs args(argc, argv);
+  const uint repeats = args.get_uint("repeats", 1000);
+
+  init_kernels();
+  FCNN model(args.get("weights", "../weights"));
+  finish_cl_queue();
+  Matrix input = Matrix::random(1, model.shape()[0], 1);
+
+  model.enable_gemv(false);
+  const Latencies generic = measure(model, input, repeats);
+  model.enable_gemv(true);
+  if (!model.uses_gemv(1))
+  {
+    std::cerr << "WARNING: Model is too large for gemv_kernel, both runs use the generic path" << std::endl;
+  }
+  const Latencies gemv = measure(model, input, repeats);
+
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << std::setw(8) << "path" << std::setw(12) << "p50 us" << std::setw(12) << "p99 us" << std::setw(14)
+            << "kernels us" << std::endl;
+  print_row("generic", generic);
+  print_row("gemv", gemv);
+  std::cout << "Speedup at p50: " << percentile(generic.host_us, 50.) / percentile(gemv.host_us, 50.) << "x" << std::endl;
+}
@@ -0,0 +1,91 @@
+#include "gemv_kernel.hpp"
+#include "hls_math.h"
+
+// The weights are row-major (inputs x outputs), so they are read in a single
+// sequential pass: row k scales every weight by x[k] and adds it to that
+// output's accumulator, GEMV_LANES outputs per cycle. Unlike matmul_kernel,
+// which walks a weight column per output, every weight is fetched exactly
+// once and in address order.
+extern "C" void gemv_kernel(
+    const float *const x, const float *const weights, const float *const bias, const uint inputs, const uint outputs,
+    const uint activation, float *const out)
+{
+   float local_x[GEMV_MAX_INPUTS];
+   float acc[GEMV_INTERLEAVE][GEMV_MAX_OUTPUTS];
+#pragma HLS ARRAY_PARTITION variable = acc complete dim = 1
+#pragma HLS ARRAY_PARTITION variable = acc cyclic factor = GEMV_LANES dim = 2
+
+   for (uint k = 0; k < inputs; ++k)
+   {
+#pragma HLS PIPELINE II = 1
+      local_x[k] = x[k];
+   }
+
+   for (uint j = 0; j < outputs; ++j)
+   {
+#pragma HLS PIPELINE II = 1
+      for (uint s = 0; s < GEMV_INTERLEAVE; ++s)
+      {
+#pragma HLS UNROLL
+         acc[s][j] = s == 0 ? bias[j] : 0.f;
+      }
+   }
+
+   for (uint k = 0; k < inputs; ++k)
+   {
+      for (uint j = 0; j < outputs; j += GEMV_LANES)
+      {
+#pragma HLS PIPELINE II = 1
+#pragma HLS DEPENDENCE variable = acc inter false
+         for (uint l = 0; l < GEMV_LANES; ++l)
+         {
+#pragma HLS UNROLL
+            if (j + l < outputs)
+            {
+               acc[k % GEMV_INTERLEAVE][j + l] += local_x[k] * weights[outputs * k + j + l];
+            }
+         }
+      }
+   }
+
+   float sum[GEMV_MAX_OUTPUTS];
+   float max_value = -3.402823466e+38f;
+   for (uint j = 0; j < outputs; ++j)
+   {
+#pragma HLS PIPELINE II = 1
+      float value = 0.f;
+      for (uint s = 0; s < GEMV_INTERLEAVE; ++s)
+      {
+#pragma HLS UNROLL
+         value += acc[s][j];
+      }
+      if (activation == GEMV_ACTIVATION_RELU6)
+      {
+         value = value < 0.f ? 0.f : value > 6.f ? 6.f : value;
+      }
+      sum[j] = value;
+      max_value = value > max_value ? value : max_value;
+   }
+
+   if (activation != GEMV_ACTIVATION_SOFTMAX)
+   {
+      for (uint j = 0; j < outputs; ++j)
+      {
+#pragma HLS PIPELINE II = 1
+         out[j] = sum[j];
+      }
+      return;
+   }
+
+   float total = 0.f;
+   for (uint j = 0; j < outputs; ++j)
+   {
+      sum[j] = exp(sum[j] - max_value);
+      total += sum[j];
+   }
+   for (uint j = 0; j < outputs; ++j)
+   {
+#pragma HLS PIPELINE II = 1
+      out[j] = sum[j] / total;
+   }
+}
@@ -0,0 +1,30 @@
+typedef unsigned int uint;
+
+// Single-row dense layer, out = activation(x * weights + bias), for batch
+// size 1 (see FCNN::forward). Fusing bias and activation halves the number of
+// launches compared to matmul_kernel followed by a bias kernel, which is most
+// of the latency of a single sample.
+
+#define GEMV_ACTIVATION_NONE 0
+#define GEMV_ACTIVATION_RELU6 1
+#define GEMV_ACTIVATION_SOFTMAX 2
+
+// Outputs updated per cycle, i.e. weights read per cycle
+#ifndef GEMV_LANES
+#define GEMV_LANES 16
+#endif
+
+// Independent accumulator sets, used round-robin over the input rows so that
+// consecutive updates of an output never wait for the adder. Has to cover the
+// floating point adder latency for layers with at most GEMV_LANES outputs.
+#ifndef GEMV_INTERLEAVE
+#define GEMV_INTERLEAVE 8
+#endif
+
+// Largest supported layer, bounds the on-chip input and accumulators
+#define GEMV_MAX_INPUTS 1024
+#define GEMV_MAX_OUTPUTS 1024
+
+extern "C" void gemv_kernel(
+    const float *const x, const float *const weights, const float *const bias, const uint inputs, const uint outputs,
+    const uint activation, float *const out);
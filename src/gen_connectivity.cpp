@@ -0,0 +1,25 @@
+#include <fstream>
+#include <iostream>
+
+#include "placement.hpp"
+
+// Writes the v++ linker config for the compiled-in placement, so that the
+// kernel ports are connected to the banks bank_for() allocates buffers in.
+//
+// Usage: gen_connectivity OUTPUT
+int main(int argc, const char *argv[])
+{
+  if (argc != 2)
+  {
+    std::cerr << "Usage: " << argv[0] << " OUTPUT" << std::endl;
+    return 1;
+  }
+  std::ofstream out(argv[1]);
+  out << PLACEMENT.connectivity();
+  if (!out)
+  {
+    std::cerr << "Could not write " << argv[1] << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,3 @@
+# Generated by gen_kernels.py from the model weights, do not edit
+compile_kernel(matmul_kernel_784x64 ${CMAKE_CURRENT_LIST_DIR}/matmul_kernel_784x64.cpp)
+compile_kernel(matmul_kernel_64x10 ${CMAKE_CURRENT_LIST_DIR}/matmul_kernel_64x10.cpp)
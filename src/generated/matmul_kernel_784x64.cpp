@@ -0,0 +1,7 @@
+// Generated by gen_kernels.py from the model weights, do not edit
+#include "../matmul_fixed.hpp"
+
+extern "C" void matmul_kernel_784x64(const float *const matrixA, const float *const matrixB, const uint rowsA, const uint colsA, const uint colsB, float *const out)
+{
+   matmul_fixed<784, 64>(matrixA, matrixB, rowsA, colsA, colsB, out);
+}
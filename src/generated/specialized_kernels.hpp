@@ -0,0 +1,3 @@
+// Generated by gen_kernels.py from the model weights, do not edit
+// {colsA, colsB, layer} of every matmul_kernel_<colsA>x<colsB> in the xclbin
+#define SPECIALIZED_MATMUL_SHAPES {{784, 64, 0}, {64, 10, 1}}
@@ -0,0 +1,62 @@
+#ifndef NNONFPGA_HASH
+#define NNONFPGA_HASH
+
+#include <cstdint>
+#include <cstring>
+
+typedef unsigned int uint;
+
+// Fast non-cryptographic 64-bit hash of float data, bit for bit (so 0.f and
+// -0.f differ). Four independent lanes in the style of xxHash64 consume 32
+// bytes per round, so the multiplies of consecutive words overlap.
+
+namespace detail
+{
+    static const uint64_t HASH_PRIME1 = 0x9E3779B185EBCA87ULL;
+    static const uint64_t HASH_PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+    static const uint64_t HASH_PRIME3 = 0x165667B19E3779F9ULL;
+
+    inline uint64_t rotl64(const uint64_t x, const int r)
+    {
+        return (x << r) | (x >> (64 - r));
+    }
+
+    inline uint64_t hash_round(const uint64_t acc, const uint64_t word)
+    {
+        return rotl64(acc + word * HASH_PRIME2, 31) * HASH_PRIME1;
+    }
+} // namespace detail
+
+inline uint64_t hash_floats(const float *data, const std::size_t count, const uint64_t seed = 0)
+{
+    using namespace detail;
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(data);
+    const std::size_t size = count * sizeof(float);
+    uint64_t lanes[4] = {seed + HASH_PRIME1 + HASH_PRIME2, seed + HASH_PRIME2, seed, seed - HASH_PRIME1};
+    std::size_t pos = 0;
+    for (; pos + 32 <= size; pos += 32)
+    {
+        for (uint l = 0; l < 4; l++)
+        {
+            uint64_t word;
+            memcpy(&word, bytes + pos + 8 * l, sizeof(word));
+            lanes[l] = hash_round(lanes[l], word);
+        }
+    }
+    uint64_t h = rotl64(lanes[0], 1) + rotl64(lanes[1], 7) + rotl64(lanes[2], 12) + rotl64(lanes[3], 18) + size;
+    for (; pos < size; pos += sizeof(float))
+    {
+        uint32_t word;
+        memcpy(&word, bytes + pos, sizeof(word));
+        h = rotl64(h ^ (word * HASH_PRIME1), 23) * HASH_PRIME2 + HASH_PRIME3;
+    }
+    // Final avalanche, so that every input bit affects the low bits too
+    h ^= h >> 33;
+    h *= HASH_PRIME2;
+    h ^= h >> 29;
+    h *= HASH_PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+#endif /* end of include guard: NNONFPGA_HASH */
@@ -0,0 +1,232 @@
+#ifndef NNONFPGA_HOST_MEMORY
+#define NNONFPGA_HOST_MEMORY
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <glob.h>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Host memory for matrices that are handed to the device with
+// CL_MEM_USE_HOST_PTR. A single region is mapped at startup, backed by 2MB
+// huge pages where possible, bound to the NUMA node the card is attached to,
+// pre-faulted and locked, so neither transfers nor allocations touch the page
+// tables later. Freed blocks are kept per size and reused, since the same
+// tensor shapes are allocated over and over.
+
+static const std::size_t HUGE_PAGE_SIZE = 2 << 20;
+static const std::size_t HOST_PAGE_SIZE = 4096;
+// The pool is opt-in: 0 disables it unless FCNN_HOST_POOL_MB or the caller
+// asks for a size
+static const std::size_t DEFAULT_HOST_POOL_MB = 0;
+
+// NUMA node of the first card bound to the XRT driver, -1 if unknown.
+// FCNN_NUMA_NODE overrides the detection.
+inline int device_numa_node()
+{
+    const char *env = getenv("FCNN_NUMA_NODE");
+    if (env != NULL)
+    {
+        return atoi(env);
+    }
+    int node = -1;
+    glob_t matches;
+    if (glob("/sys/bus/pci/drivers/xocl/*/numa_node", 0, NULL, &matches) == 0 && matches.gl_pathc > 0)
+    {
+        std::ifstream(matches.gl_pathv[0]) >> node;
+    }
+    globfree(&matches);
+    return node;
+}
+
+class HostMemoryPool
+{
+private:
+    char *base;
+    std::size_t capacity, used;
+    bool huge_pages, locked;
+    int numa_node;
+    std::mutex mutex;
+    std::map<char *, std::size_t> sizes;
+    std::map<std::size_t, std::vector<char *>> free_blocks;
+
+    static std::size_t round_up(const std::size_t value, const std::size_t multiple)
+    {
+        return (value + multiple - 1) / multiple * multiple;
+    }
+
+    // Binds [base, base + capacity) to `node` without linking libnuma. The
+    // mask is a single word, nodes outside of it (or unknown, -1) fail.
+    bool bind(const int node)
+    {
+        const int MPOL_BIND = 2;
+        if (node < 0 || node >= static_cast<int>(sizeof(unsigned long) * 8))
+        {
+            return false;
+        }
+        unsigned long nodemask = 1UL << node;
+        return syscall(SYS_mbind, base, capacity, MPOL_BIND, &nodemask, sizeof(nodemask) * 8, 0) == 0;
+    }
+
+public:
+    HostMemoryPool(const std::size_t bytes, const int node)
+        : base(NULL), capacity(round_up(bytes, HUGE_PAGE_SIZE)), used(0), huge_pages(true), locked(false), numa_node(node)
+    {
+        void *ptr = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (ptr == MAP_FAILED)
+        {
+            // No reserved huge pages (vm.nr_hugepages), ask for transparent
+            // ones instead, which may or may not be granted
+            huge_pages = false;
+            ptr = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (ptr == MAP_FAILED)
+            {
+                throw std::bad_alloc();
+            }
+            madvise(ptr, capacity, MADV_HUGEPAGE);
+        }
+        base = static_cast<char *>(ptr);
+
+        if (numa_node >= 0 && !bind(numa_node))
+        {
+            std::cerr << "WARNING: Could not bind host memory to NUMA node " << numa_node << std::endl;
+            numa_node = -1;
+        }
+        // Pre-fault after binding, so the pages are placed on the right node
+        for (std::size_t offset = 0; offset < capacity; offset += HOST_PAGE_SIZE)
+        {
+            base[offset] = 0;
+        }
+        // Transparent huge pages can still be swapped or split, only locked
+        // pages stay where the device expects them. Usually limited by
+        // RLIMIT_MEMLOCK (ulimit -l).
+        locked = mlock(base, capacity) == 0;
+        if (!locked)
+        {
+            std::cerr << "WARNING: Could not lock host memory (" << strerror(errno)
+                      << "), the pool stays pageable" << std::endl;
+        }
+    }
+
+    // Never unmapped, buffers may outlive any static destructor
+    HostMemoryPool(const HostMemoryPool &) = delete;
+    HostMemoryPool &operator=(const HostMemoryPool &) = delete;
+
+    // Page-aligned block of at least `bytes`, NULL if the pool is exhausted
+    void *allocate(const std::size_t bytes)
+    {
+        const std::size_t size = round_up(bytes == 0 ? 1 : bytes, HOST_PAGE_SIZE);
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = free_blocks.find(size);
+        if (it != free_blocks.end() && !it->second.empty())
+        {
+            char *block = it->second.back();
+            it->second.pop_back();
+            return block;
+        }
+        if (used + size > capacity)
+        {
+            return NULL;
+        }
+        char *block = base + used;
+        used += size;
+        sizes[block] = size;
+        return block;
+    }
+
+    bool owns(const void *ptr) const
+    {
+        return ptr >= base && ptr < base + capacity;
+    }
+
+    void deallocate(void *ptr)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        char *block = static_cast<char *>(ptr);
+        free_blocks[sizes.at(block)].push_back(block);
+    }
+
+    bool uses_huge_pages() const
+    {
+        return huge_pages;
+    }
+
+    bool is_locked() const
+    {
+        return locked;
+    }
+
+    int node() const
+    {
+        return numa_node;
+    }
+
+    std::size_t size() const
+    {
+        return capacity;
+    }
+};
+
+static HostMemoryPool *HOST_POOL = NULL;
+
+// Sets up the pool, sized by FCNN_HOST_POOL_MB unless `megabytes` is given.
+// Allocations fall back to posix_memalign without it, or once it is full.
+inline void init_host_memory(std::size_t megabytes = DEFAULT_HOST_POOL_MB)
+{
+    const char *env = getenv("FCNN_HOST_POOL_MB");
+    if (env != NULL)
+    {
+        megabytes = strtoul(env, NULL, 10);
+    }
+    if (HOST_POOL != NULL || megabytes == 0)
+    {
+        return;
+    }
+    HOST_POOL = new HostMemoryPool(megabytes << 20, device_numa_node());
+    std::cout << "INFO: Host memory pool of " << (HOST_POOL->size() >> 20) << "MB"
+              << (HOST_POOL->uses_huge_pages() ? " on huge pages" : "")
+              << (HOST_POOL->is_locked() ? ", locked" : "")
+              << (HOST_POOL->node() >= 0 ? " on NUMA node " + std::to_string(HOST_POOL->node()) : "")
+              << std::endl;
+}
+
+inline void *host_alloc(const std::size_t bytes, const std::size_t alignment = HOST_PAGE_SIZE)
+{
+    if (HOST_POOL != NULL && HOST_PAGE_SIZE % alignment == 0)
+    {
+        void *ptr = HOST_POOL->allocate(bytes);
+        if (ptr != NULL)
+        {
+            return ptr;
+        }
+    }
+    void *ptr = NULL;
+    if (posix_memalign(&ptr, alignment, bytes))
+    {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+inline void host_free(void *ptr)
+{
+    if (HOST_POOL != NULL && HOST_POOL->owns(ptr))
+    {
+        HOST_POOL->deallocate(ptr);
+    }
+    else
+    {
+        free(ptr);
+    }
+}
+
+#endif /* end of include guard: NNONFPGA_HOST_MEMORY */
@@ -0,0 +1,219 @@
+#ifndef NNONFPGA_IPC
+#define NNONFPGA_IPC
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Wire protocol and shared-memory layout between fcnn_server and its clients.
+//
+// A client connects to the server's Unix socket and sends HELLO with the
+// number of ring slots and the maximum batch size per slot. The server creates
+// a shared-memory ring, maps it and answers with its name and the model's
+// dimensions. Afterwards the client writes inputs into a slot and sends INFER;
+// the server runs the model directly on the slot's memory and answers DONE
+// once the probabilities are in the slot's output region.
+
+static const std::string DEFAULT_SOCKET_PATH = "/tmp/fcnn.sock";
+static const std::size_t RING_PAGE_SIZE = 4096;
+static const uint32_t RING_MAGIC = 0x464e4e31;
+
+enum MessageType : uint32_t
+{
+    MSG_HELLO = 1,
+    MSG_HELLO_OK = 2,
+    MSG_INFER = 3,
+    MSG_DONE = 4,
+    MSG_ERROR = 5
+};
+
+// All messages have the same fixed size, unused fields are zero
+struct Message
+{
+    uint32_t type;
+    uint32_t slot;
+    uint32_t rows;
+    uint32_t input_cols;
+    uint32_t output_cols;
+    uint32_t num_slots;
+    uint64_t sequence;
+    char shm_name[64];
+};
+
+inline std::size_t round_up_to_page(const std::size_t bytes)
+{
+    return (bytes + RING_PAGE_SIZE - 1) / RING_PAGE_SIZE * RING_PAGE_SIZE;
+}
+
+// Layout of the shared-memory ring. Every slot's input and output region
+// starts on a page boundary, so Matrix::wrap on them is zero-copy.
+struct RingLayout
+{
+    uint32_t num_slots, max_rows, input_cols, output_cols;
+
+    std::size_t input_bytes() const { return round_up_to_page(sizeof(float) * max_rows * input_cols); }
+    std::size_t output_bytes() const { return round_up_to_page(sizeof(float) * max_rows * output_cols); }
+    std::size_t slot_stride() const { return input_bytes() + output_bytes(); }
+    std::size_t total_bytes() const { return RING_PAGE_SIZE + num_slots * slot_stride(); }
+
+    std::size_t input_offset(const uint32_t slot) const { return RING_PAGE_SIZE + slot * slot_stride(); }
+    std::size_t output_offset(const uint32_t slot) const { return input_offset(slot) + input_bytes(); }
+};
+
+// Header stored in the first page of the ring for sanity checks
+struct RingHeader
+{
+    uint32_t magic;
+    RingLayout layout;
+};
+
+class SharedRing
+{
+private:
+    std::string name;
+    char *base;
+    RingLayout layout;
+    bool owner;
+
+public:
+    SharedRing() : base(NULL), owner(false) {}
+    SharedRing(const SharedRing &) = delete;
+    SharedRing &operator=(const SharedRing &) = delete;
+
+    ~SharedRing()
+    {
+        if (base != NULL)
+        {
+            munmap(base, layout.total_bytes());
+        }
+        if (owner)
+        {
+            shm_unlink(name.c_str());
+        }
+    }
+
+    // Creates and maps a new ring; the creator unlinks it on destruction
+    void create(const std::string &shm_name, const RingLayout &ring_layout)
+    {
+        name = shm_name;
+        layout = ring_layout;
+        const int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0)
+        {
+            throw std::runtime_error("shm_open(" + name + "): " + strerror(errno));
+        }
+        owner = true;
+        if (ftruncate(fd, layout.total_bytes()) != 0)
+        {
+            close(fd);
+            throw std::runtime_error("ftruncate(" + name + "): " + strerror(errno));
+        }
+        map(fd);
+        RingHeader *header = reinterpret_cast<RingHeader *>(base);
+        header->magic = RING_MAGIC;
+        header->layout = layout;
+    }
+
+    // Maps an existing ring created by the other side
+    void attach(const std::string &shm_name)
+    {
+        name = shm_name;
+        const int fd = shm_open(name.c_str(), O_RDWR, 0600);
+        if (fd < 0)
+        {
+            throw std::runtime_error("shm_open(" + name + "): " + strerror(errno));
+        }
+        RingHeader header;
+        if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || header.magic != RING_MAGIC)
+        {
+            close(fd);
+            throw std::runtime_error(name + " is not an inference ring");
+        }
+        layout = header.layout;
+        map(fd);
+    }
+
+    const RingLayout &get_layout() const { return layout; }
+    const std::string &get_name() const { return name; }
+
+    float *input(const uint32_t slot)
+    {
+        return reinterpret_cast<float *>(base + layout.input_offset(slot));
+    }
+
+    float *output(const uint32_t slot)
+    {
+        return reinterpret_cast<float *>(base + layout.output_offset(slot));
+    }
+
+private:
+    void map(const int fd)
+    {
+        void *ptr = mmap(NULL, layout.total_bytes(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (ptr == MAP_FAILED)
+        {
+            throw std::runtime_error("mmap(" + name + "): " + strerror(errno));
+        }
+        base = static_cast<char *>(ptr);
+    }
+};
+
+// Blocking send/receive of exactly one message. Return false if the peer
+// closed the connection.
+inline bool send_message(const int fd, const Message &msg)
+{
+    const char *ptr = reinterpret_cast<const char *>(&msg);
+    std::size_t left = sizeof(msg);
+    while (left > 0)
+    {
+        const ssize_t n = send(fd, ptr, left, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        ptr += n;
+        left -= n;
+    }
+    return true;
+}
+
+inline bool receive_message(const int fd, Message &msg)
+{
+    char *ptr = reinterpret_cast<char *>(&msg);
+    std::size_t left = sizeof(msg);
+    while (left > 0)
+    {
+        const ssize_t n = recv(fd, ptr, left, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        ptr += n;
+        left -= n;
+    }
+    return true;
+}
+
+inline sockaddr_un socket_address(const std::string &path)
+{
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+    {
+        throw std::runtime_error("Socket path too long: " + path);
+    }
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    return addr;
+}
+
+#endif /* end of include guard: NNONFPGA_IPC */
@@ -0,0 +1,425 @@
+#ifndef NNONFPGA_JSON
+#define NNONFPGA_JSON
+
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Just enough JSON to read and write the small config and result files used
+// by the tools (tuning results, perf baselines, platform descriptions).
+class JsonValue
+{
+public:
+    enum Type
+    {
+        NUL,
+        BOOL,
+        NUMBER,
+        STRING,
+        ARRAY,
+        OBJECT
+    };
+
+    JsonValue() : type(NUL), boolean(false), number(0.) {}
+    JsonValue(const bool val) : type(BOOL), boolean(val), number(0.) {}
+    JsonValue(const double val) : type(NUMBER), boolean(false), number(val) {}
+    JsonValue(const int val) : type(NUMBER), boolean(false), number(val) {}
+    JsonValue(const unsigned int val) : type(NUMBER), boolean(false), number(val) {}
+    JsonValue(const long val) : type(NUMBER), boolean(false), number(val) {}
+    JsonValue(const unsigned long val) : type(NUMBER), boolean(false), number(val) {}
+    JsonValue(const std::string &val) : type(STRING), boolean(false), number(0.), string(val) {}
+    JsonValue(const char *val) : type(STRING), boolean(false), number(0.), string(val) {}
+
+    static JsonValue array()
+    {
+        JsonValue result;
+        result.type = ARRAY;
+        return result;
+    }
+
+    static JsonValue object()
+    {
+        JsonValue result;
+        result.type = OBJECT;
+        return result;
+    }
+
+    Type get_type() const { return type; }
+    bool is_null() const { return type == NUL; }
+    bool is_object() const { return type == OBJECT; }
+    bool is_array() const { return type == ARRAY; }
+
+    double as_number() const
+    {
+        expect(NUMBER);
+        return number;
+    }
+
+    bool as_bool() const
+    {
+        expect(BOOL);
+        return boolean;
+    }
+
+    const std::string &as_string() const
+    {
+        expect(STRING);
+        return string;
+    }
+
+    // Object access, inserting null members on first use like std::map
+    JsonValue &operator[](const std::string &key)
+    {
+        if (type == NUL)
+        {
+            type = OBJECT;
+        }
+        expect(OBJECT);
+        return members[key];
+    }
+
+    const JsonValue &at(const std::string &key) const
+    {
+        expect(OBJECT);
+        const auto it = members.find(key);
+        if (it == members.end())
+        {
+            throw std::runtime_error("JSON object has no member '" + key + "'");
+        }
+        return it->second;
+    }
+
+    bool contains(const std::string &key) const
+    {
+        return type == OBJECT && members.find(key) != members.end();
+    }
+
+    double get(const std::string &key, const double fallback) const
+    {
+        return contains(key) ? at(key).as_number() : fallback;
+    }
+
+    const std::map<std::string, JsonValue> &items() const
+    {
+        expect(OBJECT);
+        return members;
+    }
+
+    // Array access
+    JsonValue &push_back(const JsonValue &val)
+    {
+        if (type == NUL)
+        {
+            type = ARRAY;
+        }
+        expect(ARRAY);
+        elements.push_back(val);
+        return elements.back();
+    }
+
+    const JsonValue &operator[](const std::size_t idx) const
+    {
+        expect(ARRAY);
+        return elements.at(idx);
+    }
+
+    std::size_t size() const
+    {
+        if (type == ARRAY)
+            return elements.size();
+        if (type == OBJECT)
+            return members.size();
+        return 0;
+    }
+
+    std::string dump(const int indent = 2) const
+    {
+        std::ostringstream out;
+        dump_to(out, indent, 0);
+        return out.str();
+    }
+
+    static JsonValue parse(const std::string &text)
+    {
+        std::size_t pos = 0;
+        JsonValue result = parse_value(text, pos);
+        skip_whitespace(text, pos);
+        if (pos != text.size())
+        {
+            throw std::runtime_error("Trailing characters in JSON document");
+        }
+        return result;
+    }
+
+private:
+    Type type;
+    bool boolean;
+    double number;
+    std::string string;
+    std::vector<JsonValue> elements;
+    std::map<std::string, JsonValue> members;
+
+    void expect(const Type expected) const
+    {
+        if (type != expected)
+        {
+            throw std::runtime_error("Unexpected JSON value type");
+        }
+    }
+
+    static void dump_string(std::ostream &out, const std::string &str)
+    {
+        out << '"';
+        for (const char c : str)
+        {
+            switch (c)
+            {
+            case '"':
+                out << "\\\"";
+                break;
+            case '\\':
+                out << "\\\\";
+                break;
+            case '\n':
+                out << "\\n";
+                break;
+            case '\t':
+                out << "\\t";
+                break;
+            default:
+                out << c;
+            }
+        }
+        out << '"';
+    }
+
+    void dump_to(std::ostream &out, const int indent, const int depth) const
+    {
+        const std::string pad(indent * (depth + 1), ' ');
+        const std::string closing_pad(indent * depth, ' ');
+        const char *newline = indent > 0 ? "\n" : "";
+
+        switch (type)
+        {
+        case NUL:
+            out << "null";
+            break;
+        case BOOL:
+            out << (boolean ? "true" : "false");
+            break;
+        case NUMBER:
+            if (std::isfinite(number))
+            {
+                std::ostringstream num;
+                num.precision(10);
+                num << number;
+                out << num.str();
+            }
+            else
+            {
+                out << "null";
+            }
+            break;
+        case STRING:
+            dump_string(out, string);
+            break;
+        case ARRAY:
+            out << "[" << newline;
+            for (std::size_t i = 0; i < elements.size(); i++)
+            {
+                out << pad;
+                elements[i].dump_to(out, indent, depth + 1);
+                out << (i + 1 < elements.size() ? "," : "") << newline;
+            }
+            out << closing_pad << "]";
+            break;
+        case OBJECT:
+            out << "{" << newline;
+            std::size_t i = 0;
+            for (const auto &member : members)
+            {
+                out << pad;
+                dump_string(out, member.first);
+                out << (indent > 0 ? ": " : ":");
+                member.second.dump_to(out, indent, depth + 1);
+                out << (++i < members.size() ? "," : "") << newline;
+            }
+            out << closing_pad << "}";
+            break;
+        }
+    }
+
+    static void skip_whitespace(const std::string &text, std::size_t &pos)
+    {
+        while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\n' || text[pos] == '\t' || text[pos] == '\r'))
+        {
+            pos++;
+        }
+    }
+
+    static bool consume(const std::string &text, std::size_t &pos, const std::string &token)
+    {
+        if (text.compare(pos, token.size(), token) == 0)
+        {
+            pos += token.size();
+            return true;
+        }
+        return false;
+    }
+
+    static std::string parse_string(const std::string &text, std::size_t &pos)
+    {
+        if (text[pos] != '"')
+        {
+            throw std::runtime_error("Expected string in JSON document");
+        }
+        pos++;
+        std::string result;
+        while (pos < text.size() && text[pos] != '"')
+        {
+            char c = text[pos++];
+            if (c == '\\' && pos < text.size())
+            {
+                c = text[pos++];
+                switch (c)
+                {
+                case 'n':
+                    c = '\n';
+                    break;
+                case 't':
+                    c = '\t';
+                    break;
+                case 'r':
+                    c = '\r';
+                    break;
+                }
+            }
+            result += c;
+        }
+        if (pos >= text.size())
+        {
+            throw std::runtime_error("Unterminated string in JSON document");
+        }
+        pos++;
+        return result;
+    }
+
+    static JsonValue parse_value(const std::string &text, std::size_t &pos)
+    {
+        skip_whitespace(text, pos);
+        if (pos >= text.size())
+        {
+            throw std::runtime_error("Unexpected end of JSON document");
+        }
+
+        const char c = text[pos];
+        if (c == '{')
+        {
+            pos++;
+            JsonValue result = object();
+            skip_whitespace(text, pos);
+            if (consume(text, pos, "}"))
+            {
+                return result;
+            }
+            while (true)
+            {
+                skip_whitespace(text, pos);
+                const std::string key = parse_string(text, pos);
+                skip_whitespace(text, pos);
+                if (!consume(text, pos, ":"))
+                {
+                    throw std::runtime_error("Expected ':' in JSON object");
+                }
+                result.members[key] = parse_value(text, pos);
+                skip_whitespace(text, pos);
+                if (consume(text, pos, "}"))
+                {
+                    return result;
+                }
+                if (!consume(text, pos, ","))
+                {
+                    throw std::runtime_error("Expected ',' in JSON object");
+                }
+            }
+        }
+        if (c == '[')
+        {
+            pos++;
+            JsonValue result = array();
+            skip_whitespace(text, pos);
+            if (consume(text, pos, "]"))
+            {
+                return result;
+            }
+            while (true)
+            {
+                result.elements.push_back(parse_value(text, pos));
+                skip_whitespace(text, pos);
+                if (consume(text, pos, "]"))
+                {
+                    return result;
+                }
+                if (!consume(text, pos, ","))
+                {
+                    throw std::runtime_error("Expected ',' in JSON array");
+                }
+            }
+        }
+        if (c == '"')
+        {
+            return JsonValue(parse_string(text, pos));
+        }
+        if (consume(text, pos, "true"))
+        {
+            return JsonValue(true);
+        }
+        if (consume(text, pos, "false"))
+        {
+            return JsonValue(false);
+        }
+        if (consume(text, pos, "null"))
+        {
+            return JsonValue();
+        }
+
+        const char *begin = text.c_str() + pos;
+        char *end = nullptr;
+        const double val = std::strtod(begin, &end);
+        if (end == begin)
+        {
+            throw std::runtime_error("Invalid value in JSON document");
+        }
+        pos += end - begin;
+        return JsonValue(val);
+    }
+};
+
+JsonValue load_json(const std::string &path)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        throw std::runtime_error("Could not open " + path);
+    }
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    return JsonValue::parse(buffer.str());
+}
+
+void save_json(const std::string &path, const JsonValue &value)
+{
+    std::ofstream file(path);
+    if (!file)
+    {
+        throw std::runtime_error("Could not write " + path);
+    }
+    file << value.dump() << std::endl;
+}
+
+#endif /* end of include guard: NNONFPGA_JSON */
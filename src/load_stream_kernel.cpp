@@ -0,0 +1,11 @@
+#include "stream_kernels.hpp"
+
+// Head of the dataflow pipeline, streams `size` floats from DDR
+extern "C" void load_stream_kernel(const float *const input, const uint size, float_stream &out)
+{
+   for (uint i = 0; i < size; i++)
+   {
+#pragma HLS PIPELINE II = 1
+      out.write(to_packet(input[i], i == size - 1));
+   }
+}
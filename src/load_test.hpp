@@ -0,0 +1,223 @@
+#ifndef NNONFPGA_LOAD_TEST
+#define NNONFPGA_LOAD_TEST
+
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+#include "stats.hpp"
+
+typedef unsigned int uint;
+
+// Load generation against anything that serves inference requests through a
+// fixed set of slots, e.g. fcnn_server or an in-process model (see loadgen).
+//
+// Closed loop keeps a fixed number of requests in flight, so the offered load
+// adapts to the system. Open loop sends requests at Poisson arrival times
+// regardless of how the system keeps up, which is how independent clients
+// behave. Latencies are measured from the intended send time: a request that
+// has to wait for a free slot is charged for the wait, so a stalled system
+// isn't hidden by the generator backing off (coordinated omission).
+
+// A slot's input has to stay untouched while its request is in flight.
+// submit() and wait_any() are called from one thread each.
+class LoadTarget
+{
+public:
+    virtual ~LoadTarget() {}
+    virtual uint num_slots() = 0;
+    virtual uint input_cols() = 0;
+    virtual float *input(const uint slot) = 0;
+    virtual void submit(const uint slot, const uint rows) = 0;
+    // Blocks until any request finished, returns its slot. `failed` tells
+    // whether it failed, the slot is free again either way.
+    virtual uint wait_any(bool &failed) = 0;
+};
+
+struct LoadResult
+{
+    // Completed requests, failed ones are only counted in `failed`
+    uint64_t requests, failed;
+    double elapsed_seconds;
+    // Per request, plus the samples added by coordinated omission correction
+    std::vector<double> latencies_us;
+
+    double samples_per_second(const uint batch_size) const
+    {
+        return requests * batch_size / elapsed_seconds;
+    }
+};
+
+// Rows drawn from a row-major sample set for every request
+class SampleSource
+{
+private:
+    const std::vector<float> &samples;
+    const uint rows, cols;
+    std::mt19937 generator;
+
+public:
+    SampleSource(const std::vector<float> &samples, const uint rows, const uint cols, const uint seed = 0)
+        : samples(samples), rows(rows), cols(cols), generator(seed) {}
+
+    void fill(float *input, const uint batch_size)
+    {
+        std::uniform_int_distribution<uint> pick(0, rows - 1);
+        for (uint row = 0; row < batch_size; row++)
+        {
+            memcpy(input + row * cols, samples.data() + pick(generator) * cols, sizeof(float) * cols);
+        }
+    }
+};
+
+// Adds the latencies that requests which should have been sent every
+// `expected_interval_us` would have seen while this one blocked the loop,
+// like HdrHistogram's recordValueWithExpectedInterval
+inline void record_corrected(std::vector<double> &latencies_us, const double latency_us, const double expected_interval_us)
+{
+    latencies_us.push_back(latency_us);
+    if (expected_interval_us <= 0.)
+    {
+        return;
+    }
+    for (double missed = latency_us - expected_interval_us; missed >= expected_interval_us; missed -= expected_interval_us)
+    {
+        latencies_us.push_back(missed);
+    }
+}
+
+// Keeps `concurrency` requests of `batch_size` rows in flight for
+// `duration_seconds`. A closed loop only sends when a request finished, so
+// pass the interval at which requests are supposed to arrive to correct for
+// coordinated omission, 0 disables the correction.
+inline LoadResult run_closed_loop(LoadTarget &target, SampleSource &source, const uint concurrency, const uint batch_size,
+                                  const double duration_seconds, const double expected_interval_us = 0.)
+{
+    typedef std::chrono::steady_clock clock;
+    LoadResult result = {0, 0, 0., {}};
+    std::vector<clock::time_point> submitted(concurrency);
+
+    const auto start = clock::now();
+    const auto deadline = start + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(duration_seconds));
+    for (uint slot = 0; slot < concurrency; slot++)
+    {
+        source.fill(target.input(slot), batch_size);
+        submitted[slot] = clock::now();
+        target.submit(slot, batch_size);
+    }
+
+    uint in_flight = concurrency;
+    while (in_flight > 0)
+    {
+        bool failed;
+        const uint slot = target.wait_any(failed);
+        const auto now = clock::now();
+        if (failed)
+        {
+            result.failed++;
+        }
+        else
+        {
+            record_corrected(result.latencies_us, std::chrono::duration<double, std::micro>(now - submitted[slot]).count(),
+                             expected_interval_us);
+            result.requests++;
+        }
+        in_flight--;
+        if (now < deadline)
+        {
+            source.fill(target.input(slot), batch_size);
+            submitted[slot] = clock::now();
+            target.submit(slot, batch_size);
+            in_flight++;
+        }
+    }
+    result.elapsed_seconds = std::chrono::duration<double>(clock::now() - start).count();
+    return result;
+}
+
+// Sends requests of `batch_size` rows at Poisson arrivals of `rate` per second
+// for `duration_seconds`, using up to num_slots() of them at a time. Each
+// latency runs from the request's scheduled arrival to its completion.
+inline LoadResult run_open_loop(LoadTarget &target, SampleSource &source, const double rate, const uint batch_size,
+                                const double duration_seconds, const uint seed = 0)
+{
+    typedef std::chrono::steady_clock clock;
+    LoadResult result = {0, 0, 0., {}};
+    std::vector<clock::time_point> intended(target.num_slots());
+    std::vector<uint> free_slots;
+    for (uint slot = target.num_slots(); slot > 0; slot--)
+    {
+        free_slots.push_back(slot - 1);
+    }
+    uint in_flight = 0;
+    bool done_sending = false;
+    std::mutex mutex;
+    std::condition_variable changed;
+
+    std::thread completions([&]() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            changed.wait(lock, [&]() { return in_flight > 0 || done_sending; });
+            if (in_flight == 0)
+            {
+                return;
+            }
+            lock.unlock();
+            bool failed;
+            const uint slot = target.wait_any(failed);
+            const auto now = clock::now();
+            lock.lock();
+            if (failed)
+            {
+                result.failed++;
+            }
+            else
+            {
+                result.latencies_us.push_back(std::chrono::duration<double, std::micro>(now - intended[slot]).count());
+                result.requests++;
+            }
+            in_flight--;
+            free_slots.push_back(slot);
+            changed.notify_all();
+        }
+    });
+
+    std::mt19937 generator(seed);
+    std::exponential_distribution<double> gap(rate);
+    const auto start = clock::now();
+    const auto deadline = start + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(duration_seconds));
+    for (auto arrival = start; arrival < deadline;
+         arrival += std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(gap(generator))))
+    {
+        std::this_thread::sleep_until(arrival);
+        uint slot;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&]() { return !free_slots.empty(); });
+            slot = free_slots.back();
+            free_slots.pop_back();
+            intended[slot] = arrival;
+        }
+        source.fill(target.input(slot), batch_size);
+        target.submit(slot, batch_size);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            in_flight++;
+        }
+        changed.notify_all();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        done_sending = true;
+    }
+    changed.notify_all();
+    completions.join();
+    result.elapsed_seconds = std::chrono::duration<double>(clock::now() - start).count();
+    return result;
+}
+
+#endif /* end of include guard: NNONFPGA_LOAD_TEST */
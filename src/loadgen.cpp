@@ -0,0 +1,203 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "cli.hpp"
+#include "client.hpp"
+#include "libnpy.hpp"
+#include "load_test.hpp"
+#include "stats.hpp"
+
+#ifdef LOADGEN_IN_PROCESS
+#include "matrix.hpp"
+#include "net.hpp"
+#include "utils.hpp"
+#endif
+
+// Load generator producing throughput vs. latency curves. Every point of the
+// curve runs for `--duration` seconds:
+//
+// - closed loop (default): one point per `--concurrency` value, that many
+//   requests are kept in flight
+// - open loop (`--rates`): one point per rate in requests per second, sent at
+//   Poisson arrival times through up to `--slots` concurrent requests
+//
+// Inputs are rows drawn at random from `--samples`, e.g. samples.npy or the
+// MNIST test images as an N x 784 array. Latencies are corrected for
+// coordinated omission, see load_test.hpp; in closed loop this needs
+// `--expected-interval` (microseconds between requests of a client).
+//
+// Usage: loadgen [--socket /tmp/fcnn.sock] [--concurrency 1,4,16] [--batch 1]
+//                [--rates 1000,5000] [--slots 64] [--duration 10]
+//                [--expected-interval 0] [--samples ../weights/samples.npy]
+//                [--csv FILE]
+//
+// loadgen talks to a running fcnn_server. loadgen_local is the same tool
+// running the model in-process instead and takes `--weights DIR`.
+
+class ServerTarget : public LoadTarget
+{
+private:
+  InferenceClient client;
+
+public:
+  ServerTarget(const std::string &socket_path, const uint slots, const uint batch_size)
+      : client(socket_path, slots, batch_size) {}
+
+  uint num_slots() { return client.num_slots(); }
+  uint input_cols() { return client.input_cols(); }
+  float *input(const uint slot) { return client.input(slot); }
+  void submit(const uint slot, const uint rows) { client.submit(slot, rows); }
+  uint wait_any(bool &failed)
+  {
+    try
+    {
+      const uint slot = client.wait_any();
+      failed = false;
+      return slot;
+    }
+    catch (const RequestFailed &e)
+    {
+      failed = true;
+      return e.slot;
+    }
+  }
+};
+
+#ifdef LOADGEN_IN_PROCESS
+// Requests go through FCNN::submit_into like fcnn_server's, minus the IPC
+class LocalTarget : public LoadTarget
+{
+private:
+  FCNN &model;
+  std::vector<Matrix> inputs, views;
+  std::vector<InferenceHandle> handles;
+  std::mutex mutex;
+  std::condition_variable finished;
+  // Slot and whether its request failed
+  std::deque<std::pair<uint, bool>> done;
+
+public:
+  LocalTarget(FCNN &model, const uint slots, const uint batch_size)
+      : model(model), views(slots), handles(slots)
+  {
+    for (uint slot = 0; slot < slots; slot++)
+    {
+      inputs.push_back(Matrix(batch_size, model.shape()[0]));
+    }
+  }
+
+  uint num_slots() { return inputs.size(); }
+  uint input_cols() { return model.shape()[0]; }
+  float *input(const uint slot) { return inputs[slot].raw_data(); }
+
+  void submit(const uint slot, const uint rows)
+  {
+    std::vector<cl::Event> migrations(2);
+    views[slot] = Matrix::wrap(inputs[slot].raw_data(), rows, input_cols());
+    views[slot].to_device(HANDLE, bank_for(ROLE_INPUT), &migrations[0]);
+    Matrix output = Matrix::constant(rows, model.shape()[2], 0.0);
+    output.to_device(HANDLE, bank_for(ROLE_OUTPUT), &migrations[1]);
+    handles[slot] = model.submit_into(views[slot], std::move(output), &migrations);
+    handles[slot].then([this, slot](Matrix &) { finish(slot, false); }, [this, slot](cl_int) { finish(slot, true); });
+  }
+
+  uint wait_any(bool &failed)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [this]() { return !done.empty(); });
+    const uint slot = done.front().first;
+    failed = done.front().second;
+    done.pop_front();
+    return slot;
+  }
+
+private:
+  void finish(const uint slot, const bool failed)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    done.push_back(std::make_pair(slot, failed));
+    finished.notify_one();
+  }
+};
+#endif
+
+int main(int argc, const char *argv[])
+{
+  const CliArgs args(argc, argv);
+  const uint batch_size = args.get_uint("batch", 1);
+  const double duration = args.get_double("duration", 10.);
+  const bool open_loop = args.has("rates");
+  const auto concurrencies = args.get_uint_list("concurrency", {4});
+  const auto rates = args.get_double_list("rates", {});
+  const double expected_interval = args.get_double("expected-interval", 0.);
+
+  uint slots = args.get_uint("slots", 64);
+  if (!open_loop)
+  {
+    slots = 0;
+    for (const uint concurrency : concurrencies)
+    {
+      slots = std::max(slots, concurrency);
+    }
+  }
+
+  int sample_rows, sample_cols;
+  std::vector<float> samples;
+  aoba::LoadArrayFromNumpy(args.get("samples", "../weights/samples.npy"), sample_rows, sample_cols, samples);
+
+#ifdef LOADGEN_IN_PROCESS
+  init_kernels();
+  FCNN model(args.get("weights", "../weights"));
+  finish_cl_queue();
+  std::unique_ptr<LoadTarget> target(new LocalTarget(model, slots, batch_size));
+#else
+  std::unique_ptr<LoadTarget> target(new ServerTarget(args.get("socket", DEFAULT_SOCKET_PATH), slots, batch_size));
+#endif
+  if (static_cast<uint>(sample_cols) != target->input_cols())
+  {
+    std::cerr << "Samples have " << sample_cols << " columns, the model expects " << target->input_cols() << std::endl;
+    return 1;
+  }
+  SampleSource source(samples, sample_rows, sample_cols);
+
+  std::ofstream csv;
+  if (args.has("csv"))
+  {
+    csv.open(args.get("csv", ""));
+    csv << "mode,load,requests,failed,samples_per_second,p50_us,p99_us,p999_us" << std::endl;
+  }
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << std::setw(8) << "mode" << std::setw(10) << "load" << std::setw(10) << "requests"
+            << std::setw(8) << "failed" << std::setw(14) << "samples/s" << std::setw(12) << "p50 us" << std::setw(12) << "p99 us"
+            << std::setw(12) << "p99.9 us" << std::endl;
+
+  const std::size_t points = open_loop ? rates.size() : concurrencies.size();
+  for (std::size_t i = 0; i < points; i++)
+  {
+    const LoadResult result = open_loop
+                                  ? run_open_loop(*target, source, rates[i], batch_size, duration)
+                                  : run_closed_loop(*target, source, concurrencies[i], batch_size, duration, expected_interval);
+    const std::string mode = open_loop ? "open" : "closed";
+    const double load = open_loop ? rates[i] : concurrencies[i];
+    const double p50 = percentile(result.latencies_us, 50.), p99 = percentile(result.latencies_us, 99.),
+                 p999 = percentile(result.latencies_us, 99.9);
+    std::cout << std::setw(8) << mode << std::setw(10) << load << std::setw(10) << result.requests
+              << std::setw(8) << result.failed << std::setw(14) << result.samples_per_second(batch_size) << std::setw(12) << p50
+              << std::setw(12) << p99 << std::setw(12) << p999 << std::endl;
+    if (csv.is_open())
+    {
+      csv << mode << "," << load << "," << result.requests << "," << result.failed << "," << result.samples_per_second(batch_size) << ","
+          << p50 << "," << p99 << "," << p999 << std::endl;
+    }
+  }
+}
@@ -6,35 +6,31 @@
 #include <tuple>
 
 #include "xcl2.hpp"
+#include "expr.hpp"
 #include "matrix.hpp"
 #include "net.hpp"
+#include "tuning.hpp"
 
 int main(int argc, const char *argv[]) {
   init_kernels();
 
   auto model = FCNN("../weights/");
-  auto input = Matrix::from_npy("../weights/samples.npy");
-  input.to_device();
-  auto result = model(input);
+  auto samples = Matrix::from_npy("../weights/samples.npy");
 
-  finish_cl_queue();
-  result.to_cpu();
-  finish_cl_queue();
+  // Run in batches of the autotuned size if available
+  const auto tuning = load_tuning(DEFAULT_TUNING_FILE, shape_key(model.shape()));
+  const uint batch_size = tuning.has_value() ? tuning.value().batch_size : samples.rows;
 
-  // print argmax result
-  for (int i = 0; i < result.rows; i++) {
-    float minval = -1;
-    int idx = -1;
+  for (uint start = 0; start < samples.rows; start += batch_size) {
+    auto input = samples.slice_rows(start, std::min(batch_size, samples.rows - start));
+    input.to_device(HANDLE, bank_for(ROLE_INPUT));
+    finish_cl_queue();
+    auto request = model.submit(input);
+    auto &result = request.wait();
 
-    for (int j = 0; j < result.cols; j++) {
-      auto val = result(i, j);
-      if (minval < val) {
-        idx = j;
-        minval = val;
-      }
+    for (const uint idx : argmax_rows(result)) {
+      std::cout << idx << " ";
     }
-
-    std::cout << idx << " ";
   }
   std::cout << std::endl;
 }
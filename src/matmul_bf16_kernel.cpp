@@ -0,0 +1,41 @@
+#include "bf16.hpp"
+#include "matmul_kernel.hpp"
+
+// matmul_kernel on bfloat16 operands, which halves the bytes read per
+// multiply-add. Products and sums are computed in FP32, and the FP32 result
+// is accumulated into `out` like matmul_kernel does.
+extern "C" void matmul_bf16_kernel(
+    const bf16 *const matrixA, const bf16 *const matrixB, const uint rowsA, const uint colsA, const uint colsB, float *const out)
+{
+   for (uint i = 0; i < rowsA; ++i)
+   {
+      for (uint j = 0; j < colsB; ++j)
+      {
+         float partial[MATMUL_UNROLL];
+#pragma HLS ARRAY_PARTITION variable = partial complete
+         for (uint u = 0; u < MATMUL_UNROLL; ++u)
+         {
+#pragma HLS UNROLL
+            partial[u] = 0.f;
+         }
+
+         for (uint k = 0; k < colsA; ++k)
+         {
+#pragma HLS PIPELINE II = 1
+            const uint ia = colsA * i + k;
+            const uint ib = colsB * k + j;
+            partial[k % MATMUL_UNROLL] += bf16_to_float(matrixA[ia]) * bf16_to_float(matrixB[ib]);
+         }
+
+         float sum = 0.f;
+         for (uint u = 0; u < MATMUL_UNROLL; ++u)
+         {
+#pragma HLS UNROLL
+            sum += partial[u];
+         }
+
+         const uint io = colsB * i + j;
+         out[io] += sum;
+      }
+   }
+}
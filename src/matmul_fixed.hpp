@@ -0,0 +1,81 @@
+#ifndef NNONFPGA_MATMUL_FIXED
+#define NNONFPGA_MATMUL_FIXED
+
+#include <assert.h>
+#include "matmul_kernel.hpp"
+
+// matmul_kernel with the inner dimensions fixed at compile time. Knowing K
+// and N lets HLS keep the whole right operand on chip, partitioned so that
+// all N outputs of a row are computed in parallel, and size every loop
+// exactly. Only the number of rows (the batch size) stays a runtime value.
+//
+// Instantiated through the `extern "C"` wrappers that gen_kernels.py emits
+// for the model's weight shapes, which keep matmul_kernel's signature so the
+// host can use either one (see matmul_kernel_for). colsA and colsB are only
+// checked against the compiled shape; the host never picks a specialized
+// kernel for any other one.
+template <uint K, uint N>
+void matmul_fixed(const float *const matrixA, const float *const matrixB, const uint rowsA, const uint colsA,
+                  const uint colsB, float *const out)
+{
+   assert(colsA == K && colsB == N);
+   float local_b[K][N];
+#pragma HLS ARRAY_PARTITION variable = local_b complete dim = 2
+   float row[K];
+   // MATMUL_UNROLL independent accumulators per output hide the adder latency
+   float partial[MATMUL_UNROLL][N];
+#pragma HLS ARRAY_PARTITION variable = partial complete dim = 0
+
+   for (uint k = 0; k < K; ++k)
+   {
+      for (uint n = 0; n < N; ++n)
+      {
+#pragma HLS PIPELINE II = 1
+         local_b[k][n] = matrixB[N * k + n];
+      }
+   }
+
+   for (uint i = 0; i < rowsA; ++i)
+   {
+      for (uint k = 0; k < K; ++k)
+      {
+#pragma HLS PIPELINE II = 1
+         row[k] = matrixA[K * i + k];
+      }
+
+      for (uint u = 0; u < MATMUL_UNROLL; ++u)
+      {
+#pragma HLS UNROLL
+         for (uint n = 0; n < N; ++n)
+         {
+#pragma HLS UNROLL
+            partial[u][n] = 0.f;
+         }
+      }
+
+      for (uint k = 0; k < K; ++k)
+      {
+#pragma HLS PIPELINE II = 1
+         for (uint n = 0; n < N; ++n)
+         {
+#pragma HLS UNROLL
+            partial[k % MATMUL_UNROLL][n] += row[k] * local_b[k][n];
+         }
+      }
+
+      for (uint n = 0; n < N; ++n)
+      {
+#pragma HLS PIPELINE II = 1
+         float sum = 0.f;
+         for (uint u = 0; u < MATMUL_UNROLL; ++u)
+         {
+#pragma HLS UNROLL
+            sum += partial[u][n];
+         }
+         // Accumulates like matmul_kernel
+         out[N * i + n] += sum;
+      }
+   }
+}
+
+#endif /* end of include guard: NNONFPGA_MATMUL_FIXED */
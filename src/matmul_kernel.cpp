@@ -7,15 +7,33 @@ extern "C" void matmul_kernel(const float *const matrixA, const float *const mat
    {
       for (uint j = 0; j < colsB; ++j)
       {
-         // Nulling result here causes issues when running in hw-emu mode.
-         // Looks like io isn't updated "in time"
-         const uint io = colsB * i + j;
+         float partial[MATMUL_UNROLL];
+#pragma HLS ARRAY_PARTITION variable = partial complete
+         for (uint u = 0; u < MATMUL_UNROLL; ++u)
+         {
+#pragma HLS UNROLL
+            partial[u] = 0.f;
+         }
+
          for (uint k = 0; k < colsA; ++k)
          {
+#pragma HLS PIPELINE II = 1
             const uint ia = colsA * i + k;
             const uint ib = colsB * k + j;
-            out[io] += matrixA[ia] * matrixB[ib];
+            partial[k % MATMUL_UNROLL] += matrixA[ia] * matrixB[ib];
          }
+
+         float sum = 0.f;
+         for (uint u = 0; u < MATMUL_UNROLL; ++u)
+         {
+#pragma HLS UNROLL
+            sum += partial[u];
+         }
+
+         // Nulling result here causes issues when running in hw-emu mode.
+         // Looks like io isn't updated "in time"
+         const uint io = colsB * i + j;
+         out[io] += sum;
       }
    }
-}
\ No newline at end of file
+}
@@ -2,5 +2,18 @@
 
 typedef unsigned int uint;
 
+// Number of independent partial sums in the inner product loop. Breaks the
+// loop-carried dependency on the floating point accumulator so the loop can be
+// pipelined. Set through the MATMUL_UNROLL CMake option (see autotune.py).
+#ifndef MATMUL_UNROLL
+#define MATMUL_UNROLL 1
+#endif
+
+// Number of matmul_kernel instances linked into the xclbin. Only informative
+// on the host side, set through the MATMUL_COMPUTE_UNITS CMake option.
+#ifndef MATMUL_COMPUTE_UNITS
+#define MATMUL_COMPUTE_UNITS 1
+#endif
+
 extern "C" void matmul_kernel(
     const float *const matrixA, const float *const matrixB, const uint rowsA, const uint colsA, const uint colsB, float *const out);
@@ -0,0 +1,52 @@
+#include "stream_kernels.hpp"
+
+// Same computation as matmul_kernel, but the left operand arrives row by row
+// over `in` and the product leaves over `out` instead of going through DDR.
+// Only the weights are read from memory, once per invocation and in address
+// order so that the reads burst. Every row then uses the on-chip copy, so
+// weight traffic doesn't grow with the batch.
+extern "C" void matmul_stream_kernel(
+    float_stream &in, const float *const weights, const uint rows, const uint cols_in, const uint cols_out, float_stream &out)
+{
+   float row[STREAM_MAX_COLS];
+   float local_weights[STREAM_MAX_WEIGHTS];
+   for (uint w = 0; w < cols_in * cols_out; ++w)
+   {
+#pragma HLS PIPELINE II = 1
+      local_weights[w] = weights[w];
+   }
+
+   for (uint i = 0; i < rows; ++i)
+   {
+      for (uint k = 0; k < cols_in; ++k)
+      {
+#pragma HLS PIPELINE II = 1
+         row[k] = from_packet(in.read());
+      }
+
+      for (uint j = 0; j < cols_out; ++j)
+      {
+         float partial[MATMUL_UNROLL];
+#pragma HLS ARRAY_PARTITION variable = partial complete
+         for (uint u = 0; u < MATMUL_UNROLL; ++u)
+         {
+#pragma HLS UNROLL
+            partial[u] = 0.f;
+         }
+
+         for (uint k = 0; k < cols_in; ++k)
+         {
+#pragma HLS PIPELINE II = 1
+            partial[k % MATMUL_UNROLL] += row[k] * local_weights[cols_out * k + j];
+         }
+
+         float sum = 0.f;
+         for (uint u = 0; u < MATMUL_UNROLL; ++u)
+         {
+#pragma HLS UNROLL
+            sum += partial[u];
+         }
+         out.write(to_packet(sum, i == rows - 1 && j == cols_out - 1));
+      }
+   }
+}
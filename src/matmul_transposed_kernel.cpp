@@ -0,0 +1,41 @@
+#include "training_kernels.hpp"
+#include "matmul_kernel.hpp"
+
+// matmul_kernel with optionally transposed operands, for the weight and input
+// gradients of dense layers
+extern "C" void matmul_transposed_kernel(
+    const float *const matrixA, const float *const matrixB, const uint rows, const uint inner, const uint cols,
+    const uint transpose_a, const uint transpose_b, float *const out)
+{
+   for (uint i = 0; i < rows; ++i)
+   {
+      for (uint j = 0; j < cols; ++j)
+      {
+         float partial[MATMUL_UNROLL];
+#pragma HLS ARRAY_PARTITION variable = partial complete
+         for (uint u = 0; u < MATMUL_UNROLL; ++u)
+         {
+#pragma HLS UNROLL
+            partial[u] = 0.f;
+         }
+
+         for (uint k = 0; k < inner; ++k)
+         {
+#pragma HLS PIPELINE II = 1
+            const uint ia = transpose_a ? rows * k + i : inner * i + k;
+            const uint ib = transpose_b ? inner * j + k : cols * k + j;
+            partial[k % MATMUL_UNROLL] += matrixA[ia] * matrixB[ib];
+         }
+
+         float sum = 0.f;
+         for (uint u = 0; u < MATMUL_UNROLL; ++u)
+         {
+#pragma HLS UNROLL
+            sum += partial[u];
+         }
+
+         const uint io = cols * i + j;
+         out[io] += sum;
+      }
+   }
+}
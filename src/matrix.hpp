@@ -2,13 +2,23 @@
 #define NNONFPGA_UTILS
 
 #include <tuple>
+#include <algorithm>
+#include <random>
 #include <assert.h>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <sstream>
+#include <string>
 #include <vector>
 #include <CL/cl2.hpp>
 #include <nonstd/optional.hpp>
+#include "gemv_kernel.hpp"
+#include "host_memory.hpp"
 #include "libnpy.hpp"
+#include "placement.hpp"
 #include "utils.hpp"
 
 typedef unsigned int uint;
@@ -22,17 +32,68 @@ static const int DEFAULT_MEMORY_BANK = XCL_MEM_DDR_BANK0;
 static const int DEFAULT_MEMORY_BANK = XCL_MEM_DDR_BANK1;
 #endif
 
-// Memory alignment
+// Memory alignment. Served from the host pool if init_host_memory set one up,
+// has to be released with host_free.
 template <typename T>
 T *aligned_alloc(std::size_t num, std::size_t alignment = DEFAULT_ALIGNMENT)
 {
-    void *ptr = nullptr;
-    if (posix_memalign(&ptr, alignment, num * sizeof(T)))
+    return reinterpret_cast<T *>(host_alloc(num * sizeof(T), alignment));
+}
+
+// Commands on a device buffer that may still be running: its last writer
+// and the readers since. A command reading the buffer has to wait for the
+// writer (read after write), one writing it for the writer and all readers
+// (write after write, write after read). Anything else may overlap on the
+// out-of-order queue. Commands are recorded by whoever enqueues them, from
+// any thread.
+class BufferAccesses
+{
+private:
+    std::mutex mutex;
+    cl::Event last_write;
+    std::vector<cl::Event> reads;
+
+    static bool finished(const cl::Event &event)
     {
-        throw std::bad_alloc();
+        return event.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>() == CL_COMPLETE;
     }
-    return reinterpret_cast<T *>(ptr);
-}
+
+public:
+    void read_hazards(std::vector<cl::Event> &wait_on)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (last_write() != NULL)
+        {
+            wait_on.push_back(last_write);
+        }
+    }
+
+    void write_hazards(std::vector<cl::Event> &wait_on)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (last_write() != NULL)
+        {
+            wait_on.push_back(last_write);
+        }
+        wait_on.insert(wait_on.end(), reads.begin(), reads.end());
+    }
+
+    void record_read(const cl::Event &event)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // Weights are read by every request and never written, so drop the
+        // readers that are done as we go
+        reads.erase(std::remove_if(reads.begin(), reads.end(), finished), reads.end());
+        reads.push_back(event);
+    }
+
+    void record_write(const cl::Event &event)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        last_write = event;
+        reads.clear();
+    }
+};
 
 class Matrix
 {
@@ -46,27 +107,33 @@ private:
 
 protected:
     float *data;
+    // False for views on memory owned by someone else, see Matrix::wrap
+    bool owns_data;
     nonstd::optional<cl::Buffer> device_buffer;
+    // Shared by all matrices sharing the device buffer, see BufferAccesses
+    std::shared_ptr<BufferAccesses> accesses;
 
 public:
     uint cols, rows;
     uint alignment;
 
-    Matrix() : cols(0), rows(0), alignment(DEFAULT_ALIGNMENT) { data = NULL; };
-    Matrix(const uint rows, const uint cols, const uint alignment = DEFAULT_ALIGNMENT) : cols(cols), rows(rows), alignment(alignment)
+    Matrix() : owns_data(true), cols(0), rows(0), alignment(DEFAULT_ALIGNMENT) { data = NULL; };
+    Matrix(const uint rows, const uint cols, const uint alignment = DEFAULT_ALIGNMENT) : owns_data(true), cols(cols), rows(rows), alignment(alignment)
     {
         data = aligned_alloc<float>(cols * rows, alignment);
     }
-    Matrix(const Matrix &src) : rows(src.rows), cols(src.cols), alignment(src.alignment)
+    Matrix(const Matrix &src) : owns_data(true), rows(src.rows), cols(src.cols), alignment(src.alignment)
     {
         data = aligned_alloc<float>(cols * rows, alignment);
         device_buffer = src.device_buffer;
+        accesses = src.accesses;
         memcpy(data, src.data, rows * cols * sizeof(float));
     }
-    Matrix(Matrix &&src) : rows(src.rows), cols(src.cols), alignment(src.alignment)
+    Matrix(Matrix &&src) noexcept : owns_data(src.owns_data), rows(src.rows), cols(src.cols), alignment(src.alignment)
     {
         data = src.data;
         device_buffer = src.device_buffer;
+        accesses = src.accesses;
         src.data = NULL;
     }
     Matrix &operator=(const Matrix &src)
@@ -77,13 +144,16 @@ public:
             cols = src.cols;
             alignment = src.alignment;
             device_buffer = src.device_buffer;
-            if (data != NULL)
+            accesses = src.accesses;
+            if (data != NULL && owns_data)
             {
-                free(data);
+                host_free(data);
             }
+            owns_data = true;
             data = aligned_alloc<float>(cols * rows, alignment);
             memcpy(data, src.data, rows * cols * sizeof(float));
         }
+        return *this;
     }
     Matrix &operator=(Matrix &&src)
     {
@@ -93,10 +163,12 @@ public:
             cols = src.cols;
             alignment = src.alignment;
             device_buffer = src.device_buffer;
-            if (data != NULL)
+            accesses = src.accesses;
+            if (data != NULL && owns_data)
             {
-                free(data);
+                host_free(data);
             }
+            owns_data = src.owns_data;
             data = src.data;
             src.data = NULL;
         }
@@ -105,13 +177,24 @@ public:
 
     ~Matrix()
     {
-        if (data != NULL)
+        if (data != NULL && owns_data)
         {
 
-            free(data);
+            host_free(data);
         }
     }
 
+    // Row-major host storage
+    float *raw_data()
+    {
+        return data;
+    }
+
+    const float *raw_data() const
+    {
+        return data;
+    }
+
     float &operator()(const uint row, const uint col)
     {
         const auto idx = flatten_idx(row, col);
@@ -143,6 +226,40 @@ public:
         return mat;
     }
 
+    // Non-owning view on `rows * cols` floats at `data`, e.g. shared memory.
+    // Transfers are zero-copy if `data` is page-aligned.
+    static Matrix wrap(float *data, const uint rows, const uint cols)
+    {
+        Matrix mat;
+        mat.data = data;
+        mat.owns_data = false;
+        mat.rows = rows;
+        mat.cols = cols;
+        mat.alignment = reinterpret_cast<std::uintptr_t>(data) % DEFAULT_ALIGNMENT == 0 ? DEFAULT_ALIGNMENT : sizeof(float);
+        return mat;
+    }
+
+    static Matrix random(const uint rows, const uint cols, const unsigned int seed = 0, const uint alignment = DEFAULT_ALIGNMENT)
+    {
+        Matrix mat(rows, cols, alignment);
+        std::mt19937 generator(seed);
+        std::uniform_real_distribution<float> distribution(0.f, 1.f);
+        for (uint i = 0; i < rows * cols; i++)
+        {
+            mat.data[i] = distribution(generator);
+        }
+        return mat;
+    }
+
+    // Copies `count` rows starting at `start` into a new host-side matrix
+    Matrix slice_rows(const uint start, const uint count) const
+    {
+        assert(start + count <= rows);
+        Matrix mat(count, cols, alignment);
+        memcpy(mat.data, data + start * cols, count * cols * sizeof(float));
+        return mat;
+    }
+
     static Matrix from_npy(const std::string &path)
     {
         int rows, cols;
@@ -175,8 +292,46 @@ public:
         }
     }
 
-    Matrix &to_device(DeviceHandle &handle = HANDLE, const int bank = DEFAULT_MEMORY_BANK)
+    // Commands that a new command accessing the device buffer has to wait
+    // for, appended to `wait_on`. See BufferAccesses.
+    void read_hazards(std::vector<cl::Event> &wait_on) const
     {
+        if (accesses)
+        {
+            accesses->read_hazards(wait_on);
+        }
+    }
+
+    void write_hazards(std::vector<cl::Event> &wait_on) const
+    {
+        if (accesses)
+        {
+            accesses->write_hazards(wait_on);
+        }
+    }
+
+    void record_read(const cl::Event &event)
+    {
+        if (accesses)
+        {
+            accesses->record_read(event);
+        }
+    }
+
+    void record_write(const cl::Event &event)
+    {
+        if (accesses)
+        {
+            accesses->record_write(event);
+        }
+    }
+
+    // Waits for commands still using the previous device buffer, if any,
+    // since they may read or write the same host memory
+    Matrix &to_device(DeviceHandle &handle = HANDLE, const int bank = DEFAULT_MEMORY_BANK, cl::Event *event = NULL)
+    {
+        std::vector<cl::Event> wait_on;
+        write_hazards(wait_on);
         clear_device_buffer();
         cl_mem_ext_ptr_t mext_io;
         mext_io.flags = bank;
@@ -189,11 +344,19 @@ public:
                                                                 sizeof(float) * rows * cols, &mext_io)};
         std::vector<cl::Memory> ob_io;
         ob_io.push_back(device_buffer.value());
-        handle.q.enqueueMigrateMemObjects(ob_io, 0, nullptr, nullptr);
+        cl::Event migration;
+        handle.q.enqueueMigrateMemObjects(ob_io, 0, wait_on.empty() ? nullptr : &wait_on, &migration);
+        accesses = std::make_shared<BufferAccesses>();
+        accesses->record_write(migration);
+        if (event != NULL)
+        {
+            *event = migration;
+        }
         return *this;
     }
 
-    Matrix &to_cpu(DeviceHandle &handle = HANDLE)
+    // Waits for the last command writing the device buffer on top of `wait_on`
+    Matrix &to_cpu(DeviceHandle &handle = HANDLE, const std::vector<cl::Event> *wait_on = NULL, cl::Event *event = NULL)
     {
         std::vector<cl::Memory> ob_io;
         if (!device_buffer.has_value())
@@ -202,15 +365,58 @@ public:
             throw 21;
         }
         ob_io.push_back(device_buffer.value());
-        handle.q.enqueueMigrateMemObjects(ob_io, CL_MIGRATE_MEM_OBJECT_HOST, nullptr, nullptr);
+        std::vector<cl::Event> dependencies = wait_on != NULL ? *wait_on : std::vector<cl::Event>();
+        read_hazards(dependencies);
+        cl::Event migration;
+        handle.q.enqueueMigrateMemObjects(ob_io, CL_MIGRATE_MEM_OBJECT_HOST, dependencies.empty() ? nullptr : &dependencies, &migration);
+        record_read(migration);
+        if (event != NULL)
+        {
+            *event = migration;
+        }
         return *this;
     }
 };
 
-std::pair<Matrix, cl::Event> apply_matmul(Matrix &matrixA, Matrix &matrixB, cl::Kernel &kernel, std::vector<cl::Event> *wait_on = NULL, DeviceHandle &handle = HANDLE)
+// Device-only buffer of `bytes` in `bank`, for data the host never reads,
+// e.g. intermediate activations. Commands using it keep it alive.
+inline cl::Buffer device_scratch(const std::size_t bytes, const int bank, DeviceHandle &handle = HANDLE)
 {
-    Matrix result = Matrix::constant(matrixA.rows, matrixB.cols, 0.0, 4096);
-    result.to_device(handle);
+    cl_mem_ext_ptr_t ext;
+    ext.flags = bank;
+    ext.obj = NULL;
+    ext.param = 0;
+    return cl::Buffer(handle.context, CL_MEM_EXT_PTR_XILINX | CL_MEM_READ_WRITE, bytes, &ext);
+}
+
+// Kernel enqueued by apply_matmul_into or apply_bias with the shape it ran
+// on, `inner` is 0 for bias kernels. See roofline.hpp.
+struct TracedKernel
+{
+    std::string name;
+    uint rows, inner, cols;
+    cl::Event event;
+};
+
+// Collects every kernel enqueued by apply_matmul_into, apply_bias and
+// apply_gemv while set, e.g. by roofline_report. Only meant for measurements,
+// not thread-safe.
+static std::vector<TracedKernel> *KERNEL_TRACE = NULL;
+
+inline void trace_kernel(const cl::Kernel &kernel, const uint rows, const uint inner, const uint cols, const cl::Event &event)
+{
+    if (KERNEL_TRACE != NULL)
+    {
+        KERNEL_TRACE->push_back({kernel.getInfo<CL_KERNEL_FUNCTION_NAME>(), rows, inner, cols, event});
+    }
+}
+
+// Accumulates matrixA * matrixB into `result`, which has to be on the device
+// already and is usually zero-initialized. Waits for `wait_on` and for the
+// commands the operands depend on, see BufferAccesses.
+cl::Event apply_matmul_into(Matrix &matrixA, Matrix &matrixB, Matrix &result, cl::Kernel &kernel, std::vector<cl::Event> *wait_on = NULL, DeviceHandle &handle = HANDLE)
+{
+    assert(result.rows == matrixA.rows && result.cols == matrixB.cols);
     kernel.setArg(0, matrixA.get_buffer());
     kernel.setArg(1, matrixB.get_buffer());
     kernel.setArg(2, matrixA.rows);
@@ -218,8 +424,24 @@ std::pair<Matrix, cl::Event> apply_matmul(Matrix &matrixA, Matrix &matrixB, cl::
     kernel.setArg(4, matrixB.cols);
     kernel.setArg(5, result.get_buffer());
 
+    std::vector<cl::Event> dependencies = wait_on != NULL ? *wait_on : std::vector<cl::Event>();
+    matrixA.read_hazards(dependencies);
+    matrixB.read_hazards(dependencies);
+    result.write_hazards(dependencies);
     cl::Event event;
-    handle.q.enqueueTask(kernel, wait_on, &event);
+    handle.q.enqueueTask(kernel, dependencies.empty() ? NULL : &dependencies, &event);
+    matrixA.record_read(event);
+    matrixB.record_read(event);
+    result.record_write(event);
+    trace_kernel(kernel, matrixA.rows, matrixA.cols, matrixB.cols, event);
+    return event;
+}
+
+std::pair<Matrix, cl::Event> apply_matmul(Matrix &matrixA, Matrix &matrixB, cl::Kernel &kernel, std::vector<cl::Event> *wait_on = NULL, DeviceHandle &handle = HANDLE, const int result_bank = bank_for(ROLE_ACTIVATION))
+{
+    Matrix result = Matrix::constant(matrixA.rows, matrixB.cols, 0.0, 4096);
+    result.to_device(handle, result_bank);
+    const cl::Event event = apply_matmul_into(matrixA, matrixB, result, kernel, wait_on, handle);
     return std::make_pair(std::move(result), event);
 }
 
@@ -230,9 +452,44 @@ cl::Event apply_bias(Matrix &input, Matrix &bias, cl::Kernel &kernel, std::vecto
     kernel.setArg(2, input.rows);
     kernel.setArg(3, input.cols);
 
+    std::vector<cl::Event> dependencies = wait_on != NULL ? *wait_on : std::vector<cl::Event>();
+    input.write_hazards(dependencies);
+    bias.read_hazards(dependencies);
     cl::Event event;
-    handle.q.enqueueTask(kernel, wait_on, &event);
+    handle.q.enqueueTask(kernel, dependencies.empty() ? NULL : &dependencies, &event);
+    input.record_write(event);
+    bias.record_read(event);
+    trace_kernel(kernel, input.rows, 0, input.cols, event);
     return std::move(event);
 }
 
+// result = activation(input * weight + bias) for a single input row, with
+// one of the GEMV_ACTIVATION_* of gemv_kernel.hpp. Overwrites `result`, which
+// has to be on the device but doesn't need to be initialized.
+cl::Event apply_gemv(Matrix &input, Matrix &weight, Matrix &bias, Matrix &result, const uint activation, cl::Kernel &kernel, std::vector<cl::Event> *wait_on = NULL, DeviceHandle &handle = HANDLE)
+{
+    assert(input.rows == 1 && result.rows == 1 && input.cols == weight.rows && result.cols == weight.cols);
+    kernel.setArg(0, input.get_buffer());
+    kernel.setArg(1, weight.get_buffer());
+    kernel.setArg(2, bias.get_buffer());
+    kernel.setArg(3, weight.rows);
+    kernel.setArg(4, weight.cols);
+    kernel.setArg(5, activation);
+    kernel.setArg(6, result.get_buffer());
+
+    std::vector<cl::Event> dependencies = wait_on != NULL ? *wait_on : std::vector<cl::Event>();
+    input.read_hazards(dependencies);
+    weight.read_hazards(dependencies);
+    bias.read_hazards(dependencies);
+    result.write_hazards(dependencies);
+    cl::Event event;
+    handle.q.enqueueTask(kernel, dependencies.empty() ? NULL : &dependencies, &event);
+    input.record_read(event);
+    weight.record_read(event);
+    bias.record_read(event);
+    result.record_write(event);
+    trace_kernel(kernel, 1, weight.rows, weight.cols, event);
+    return event;
+}
+
 #endif /* end of include guard: NNONFPGA_UTILS */
\ No newline at end of file
@@ -0,0 +1,437 @@
+#ifndef NNONFPGA_METRICS
+#define NNONFPGA_METRICS
+
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <CL/cl2.hpp>
+
+// In-process metrics, exported in the Prometheus text exposition format.
+// Recording is lock-free (relaxed atomic increments), so the registry can stay
+// on in production; only registering a metric and exporting take a lock.
+// Values are cumulative, rates and windows are left to Prometheus.
+
+class Counter
+{
+private:
+    std::atomic<uint64_t> value;
+
+public:
+    Counter() : value(0) {}
+
+    void add(const uint64_t amount = 1)
+    {
+        value.fetch_add(amount, std::memory_order_relaxed);
+    }
+
+    uint64_t get() const
+    {
+        return value.load(std::memory_order_relaxed);
+    }
+};
+
+// Latency histogram with HDR-style log-linear buckets: every power of two is
+// split into 2^SUB_BUCKET_BITS equal buckets, so the relative error is below
+// 2^-SUB_BUCKET_BITS (about 3%) from nanoseconds up to MAX_EXPONENT.
+class Histogram
+{
+public:
+    static const uint SUB_BUCKET_BITS = 5;
+    static const uint SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    // Values of 2^MAX_EXPONENT ns (about 18 minutes) and more are clamped
+    static const uint MAX_EXPONENT = 40;
+    static const uint NUM_BUCKETS = SUB_BUCKETS + (MAX_EXPONENT - SUB_BUCKET_BITS) * SUB_BUCKETS;
+
+private:
+    std::atomic<uint64_t> counts[NUM_BUCKETS];
+    std::atomic<uint64_t> total_count, total_ns;
+
+public:
+    Histogram() : total_count(0), total_ns(0)
+    {
+        for (auto &count : counts)
+        {
+            count.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    static uint bucket_index(uint64_t ns)
+    {
+        if (ns < SUB_BUCKETS)
+        {
+            return ns;
+        }
+        uint exponent = 63 - __builtin_clzll(ns);
+        if (exponent >= MAX_EXPONENT)
+        {
+            return NUM_BUCKETS - 1;
+        }
+        const uint64_t mantissa = ns >> (exponent - SUB_BUCKET_BITS);
+        return SUB_BUCKETS + (exponent - SUB_BUCKET_BITS) * SUB_BUCKETS + (mantissa - SUB_BUCKETS);
+    }
+
+    // Smallest value that falls into bucket `index`
+    static uint64_t bucket_lower_bound(const uint index)
+    {
+        if (index < SUB_BUCKETS)
+        {
+            return index;
+        }
+        const uint exponent = (index - SUB_BUCKETS) / SUB_BUCKETS + SUB_BUCKET_BITS;
+        const uint64_t mantissa = (index - SUB_BUCKETS) % SUB_BUCKETS + SUB_BUCKETS;
+        return mantissa << (exponent - SUB_BUCKET_BITS);
+    }
+
+    void record_ns(const uint64_t ns)
+    {
+        counts[bucket_index(ns)].fetch_add(1, std::memory_order_relaxed);
+        total_count.fetch_add(1, std::memory_order_relaxed);
+        total_ns.fetch_add(ns, std::memory_order_relaxed);
+    }
+
+    uint64_t count() const
+    {
+        return total_count.load(std::memory_order_relaxed);
+    }
+
+    double sum_seconds() const
+    {
+        return total_ns.load(std::memory_order_relaxed) * 1e-9;
+    }
+
+    // Number of recorded values up to `ns`, at bucket resolution
+    uint64_t count_below(const uint64_t ns) const
+    {
+        uint64_t result = 0;
+        for (uint i = 0; i < NUM_BUCKETS && bucket_lower_bound(i) <= ns; i++)
+        {
+            result += counts[i].load(std::memory_order_relaxed);
+        }
+        return result;
+    }
+
+    // Lower bound of the bucket holding the p-th percentile, in nanoseconds
+    uint64_t percentile_ns(const double p) const
+    {
+        uint64_t snapshot[NUM_BUCKETS];
+        uint64_t total = 0;
+        for (uint i = 0; i < NUM_BUCKETS; i++)
+        {
+            snapshot[i] = counts[i].load(std::memory_order_relaxed);
+            total += snapshot[i];
+        }
+        const double rank = p / 100. * total;
+        uint64_t seen = 0;
+        for (uint i = 0; i < NUM_BUCKETS; i++)
+        {
+            seen += snapshot[i];
+            if (snapshot[i] > 0 && seen >= rank)
+            {
+                return bucket_lower_bound(i);
+            }
+        }
+        return 0;
+    }
+};
+
+// Upper bounds of the exported `le` buckets in seconds, 10us to 10s
+static const double EXPORTED_BUCKETS[] = {1e-5, 2e-5, 5e-5, 1e-4, 2e-4, 5e-4, 1e-3, 2e-3, 5e-3,
+                                          1e-2, 2e-2, 5e-2, 1e-1, 2e-1, 5e-1, 1., 2., 5., 10.};
+
+class MetricsRegistry
+{
+private:
+    struct Family
+    {
+        std::string help, type;
+        // Keyed by label set, e.g. `layer="0"`
+        std::map<std::string, std::unique_ptr<Counter>> counters;
+        std::map<std::string, std::unique_ptr<Histogram>> histograms;
+    };
+
+    std::mutex mutex;
+    std::map<std::string, Family> families;
+
+    Family &family(const std::string &name, const std::string &help, const std::string &type)
+    {
+        Family &result = families[name];
+        result.help = help;
+        result.type = type;
+        return result;
+    }
+
+    static std::string series(const std::string &name, const std::string &labels, const std::string &extra = "")
+    {
+        std::string all = labels;
+        if (!extra.empty())
+        {
+            all += (all.empty() ? "" : ",") + extra;
+        }
+        return all.empty() ? name : name + "{" + all + "}";
+    }
+
+public:
+    // References stay valid for the lifetime of the registry; look metrics up
+    // once and keep them, recording never takes the lock
+    Counter &counter(const std::string &name, const std::string &help, const std::string &labels = "")
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto &slot = family(name, help, "counter").counters[labels];
+        if (!slot)
+        {
+            slot.reset(new Counter());
+        }
+        return *slot;
+    }
+
+    Histogram &histogram(const std::string &name, const std::string &help, const std::string &labels = "")
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto &slot = family(name, help, "histogram").histograms[labels];
+        if (!slot)
+        {
+            slot.reset(new Histogram());
+        }
+        return *slot;
+    }
+
+    std::string exposition()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::ostringstream out;
+        for (const auto &item : families)
+        {
+            const std::string &name = item.first;
+            const Family &f = item.second;
+            out << "# HELP " << name << " " << f.help << "\n";
+            out << "# TYPE " << name << " " << f.type << "\n";
+            for (const auto &c : f.counters)
+            {
+                out << series(name, c.first) << " " << c.second->get() << "\n";
+            }
+            for (const auto &h : f.histograms)
+            {
+                for (const double le : EXPORTED_BUCKETS)
+                {
+                    std::ostringstream bound;
+                    bound << "le=\"" << le << "\"";
+                    out << series(name + "_bucket", h.first, bound.str()) << " "
+                        << h.second->count_below(static_cast<uint64_t>(le * 1e9)) << "\n";
+                }
+                out << series(name + "_bucket", h.first, "le=\"+Inf\"") << " " << h.second->count() << "\n";
+                out << series(name + "_sum", h.first) << " " << h.second->sum_seconds() << "\n";
+                out << series(name + "_count", h.first) << " " << h.second->count() << "\n";
+            }
+        }
+        return out.str();
+    }
+};
+
+static MetricsRegistry METRICS;
+
+// Nanoseconds between two profiling points of `event`, 0 if not available
+inline uint64_t profiling_delta_ns(const cl::Event &event, const cl_profiling_info from, const cl_profiling_info to)
+{
+    cl_ulong start = 0, end = 0;
+    if (event.getProfilingInfo(from, &start) != CL_SUCCESS || event.getProfilingInfo(to, &end) != CL_SUCCESS || end < start)
+    {
+        return 0;
+    }
+    return end - start;
+}
+
+// Per-request metrics of the FCNN, fed from the profiling data of the events
+// of a finished request
+class InferenceMetrics
+{
+private:
+    Counter &requests, &samples;
+    Histogram &queue_wait, &migration_in, &migration_out, &end_to_end;
+    std::vector<Histogram *> layers;
+
+    Histogram &layer(const uint index)
+    {
+        while (layers.size() <= index)
+        {
+            layers.push_back(&METRICS.histogram("fcnn_layer_kernel_seconds", "Kernel time per layer and request",
+                                                "layer=\"" + std::to_string(layers.size()) + "\""));
+        }
+        return *layers[index];
+    }
+
+public:
+    InferenceMetrics(const uint num_layers)
+        : requests(METRICS.counter("fcnn_requests_total", "Finished inference requests")),
+          samples(METRICS.counter("fcnn_samples_total", "Samples in finished inference requests")),
+          queue_wait(METRICS.histogram("fcnn_queue_wait_seconds", "Time from enqueueing a request until the device starts on it")),
+          migration_in(METRICS.histogram("fcnn_migration_in_seconds", "Host to device transfers per request")),
+          migration_out(METRICS.histogram("fcnn_migration_out_seconds", "Device to host transfer of the result")),
+          end_to_end(METRICS.histogram("fcnn_end_to_end_seconds", "Time from enqueueing a request until its result is on the host"))
+    {
+        // Registered upfront, record() must not allocate
+        layer(num_layers - 1);
+    }
+
+    // `kernels` holds `kernels_per_layer` consecutive events per layer.
+    // Migrations may be empty if the input already was on the device.
+    void record(const std::vector<cl::Event> &migrations, const std::vector<cl::Event> &kernels,
+                const uint kernels_per_layer, const cl::Event &readback, const uint rows)
+    {
+        requests.add();
+        samples.add(rows);
+
+        const cl::Event &first = migrations.empty() ? kernels.front() : migrations.front();
+        queue_wait.record_ns(profiling_delta_ns(first, CL_PROFILING_COMMAND_QUEUED, CL_PROFILING_COMMAND_START));
+        cl_ulong queued = 0, done = 0;
+        if (first.getProfilingInfo(CL_PROFILING_COMMAND_QUEUED, &queued) == CL_SUCCESS &&
+            readback.getProfilingInfo(CL_PROFILING_COMMAND_END, &done) == CL_SUCCESS && done >= queued)
+        {
+            end_to_end.record_ns(done - queued);
+        }
+
+        if (!migrations.empty())
+        {
+            uint64_t ns = 0;
+            for (const auto &event : migrations)
+            {
+                ns += profiling_delta_ns(event, CL_PROFILING_COMMAND_START, CL_PROFILING_COMMAND_END);
+            }
+            migration_in.record_ns(ns);
+        }
+        for (std::size_t i = 0; i + kernels_per_layer <= kernels.size(); i += kernels_per_layer)
+        {
+            uint64_t ns = 0;
+            for (std::size_t k = i; k < i + kernels_per_layer; k++)
+            {
+                ns += profiling_delta_ns(kernels[k], CL_PROFILING_COMMAND_START, CL_PROFILING_COMMAND_END);
+            }
+            layer(i / kernels_per_layer).record_ns(ns);
+        }
+        migration_out.record_ns(profiling_delta_ns(readback, CL_PROFILING_COMMAND_START, CL_PROFILING_COMMAND_END));
+    }
+};
+
+// Periodically writes METRICS to a file (atomically, e.g. for the node
+// exporter's textfile collector) or serves it to every client connecting to
+// a Unix socket, if `target` starts with "unix:"
+class MetricsExporter
+{
+private:
+    std::string target;
+    std::chrono::milliseconds interval;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping;
+    int listen_fd;
+    std::thread worker;
+
+    void write_file()
+    {
+        const std::string tmp = target + ".tmp";
+        {
+            std::ofstream out(tmp);
+            out << METRICS.exposition();
+        }
+        if (rename(tmp.c_str(), target.c_str()) != 0)
+        {
+            std::cerr << "Could not write metrics to " << target << ": " << strerror(errno) << std::endl;
+        }
+    }
+
+    void write_loop()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopping)
+        {
+            lock.unlock();
+            write_file();
+            lock.lock();
+            wake.wait_for(lock, interval, [this]() { return stopping; });
+        }
+        lock.unlock();
+        write_file();
+    }
+
+    void serve_loop()
+    {
+        while (true)
+        {
+            const int fd = accept(listen_fd, NULL, NULL);
+            if (fd < 0)
+            {
+                return;
+            }
+            const std::string text = METRICS.exposition();
+            std::size_t sent = 0;
+            while (sent < text.size())
+            {
+                const ssize_t n = send(fd, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+                if (n <= 0)
+                    break;
+                sent += n;
+            }
+            close(fd);
+        }
+    }
+
+public:
+    MetricsExporter(const std::string &target, const double interval_seconds = 5.)
+        : target(target), interval(static_cast<long>(interval_seconds * 1000)), stopping(false), listen_fd(-1)
+    {
+        if (target.compare(0, 5, "unix:") != 0)
+        {
+            worker = std::thread(&MetricsExporter::write_loop, this);
+            return;
+        }
+
+        const std::string path = target.substr(5);
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        unlink(path.c_str());
+        listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listen_fd < 0 || bind(listen_fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) != 0 ||
+            listen(listen_fd, 8) != 0)
+        {
+            throw std::runtime_error("Could not serve metrics on " + path + ": " + strerror(errno));
+        }
+        worker = std::thread(&MetricsExporter::serve_loop, this);
+    }
+
+    ~MetricsExporter()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        if (listen_fd >= 0)
+        {
+            // Unblocks accept
+            shutdown(listen_fd, SHUT_RDWR);
+            close(listen_fd);
+            unlink(target.substr(5).c_str());
+        }
+        worker.join();
+    }
+};
+
+#endif /* end of include guard: NNONFPGA_METRICS */
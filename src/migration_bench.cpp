@@ -0,0 +1,101 @@
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "cli.hpp"
+#include "host_memory.hpp"
+#include "matrix.hpp"
+#include "stats.hpp"
+#include "utils.hpp"
+#include "xcl2.hpp"
+
+// Compares to_device/to_cpu throughput of matrices on plain posix_memalign
+// memory with matrices from the locked huge page pool (host_memory.hpp).
+// to_device includes creating the buffer, i.e. pinning the host pages.
+//
+// Usage: migration_bench [--sizes-mb 1,16,64,256] [--repeats 10]
+
+struct Throughput
+{
+  double to_device, to_cpu;
+};
+
+double seconds_since(const std::chrono::steady_clock::time_point &start)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Median GB/s over `repeats` round trips of `matrix`
+Throughput measure(Matrix &matrix, const uint repeats)
+{
+  const double bytes = sizeof(float) * matrix.rows * matrix.cols;
+  std::vector<double> to_device, to_cpu;
+  for (uint r = 0; r <= repeats; r++)
+  {
+    auto start = std::chrono::steady_clock::now();
+    matrix.to_device();
+    finish_cl_queue();
+    const double device_seconds = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    matrix.to_cpu();
+    finish_cl_queue();
+    const double cpu_seconds = seconds_since(start);
+    // First round is a warmup
+    if (r > 0)
+    {
+      to_device.push_back(bytes / device_seconds * 1e-9);
+      to_cpu.push_back(bytes / cpu_seconds * 1e-9);
+    }
+  }
+  return {median(to_device), median(to_cpu)};
+}
+
+int main(int argc, const char *argv[])
+{
+  const CliArgs args(argc, argv);
+  const auto sizes_mb = args.get_uint_list("sizes-mb", {1, 16, 64, 256});
+  const uint repeats = args.get_uint("repeats", 10);
+
+  // Some headroom for the runtime's own allocations
+  std::size_t pool_mb = 16;
+  for (const uint size : sizes_mb)
+  {
+    pool_mb += size;
+  }
+  init_host_memory(pool_mb);
+  init_kernels();
+  if (HOST_POOL == NULL)
+  {
+    std::cerr << "Host memory pool disabled by FCNN_HOST_POOL_MB" << std::endl;
+    return 1;
+  }
+
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << std::setw(8) << "MB" << std::setw(22) << "to_device GB/s" << std::setw(22) << "to_cpu GB/s" << std::endl;
+  std::cout << std::setw(8) << "" << std::setw(11) << "memalign" << std::setw(11) << "pool"
+            << std::setw(11) << "memalign" << std::setw(11) << "pool" << std::endl;
+  for (const uint size : sizes_mb)
+  {
+    const uint rows = size * 256;
+    void *plain_data = NULL;
+    if (posix_memalign(&plain_data, DEFAULT_ALIGNMENT, sizeof(float) * rows * 1024))
+    {
+      throw std::bad_alloc();
+    }
+    memset(plain_data, 0, sizeof(float) * rows * 1024);
+    Throughput plain_result, pooled_result;
+    {
+      Matrix plain = Matrix::wrap(static_cast<float *>(plain_data), rows, 1024);
+      Matrix pooled = Matrix::constant(rows, 1024, 0.0);
+      plain_result = measure(plain, repeats);
+      pooled_result = measure(pooled, repeats);
+    }
+    std::cout << std::setw(8) << size
+              << std::setw(11) << plain_result.to_device << std::setw(11) << pooled_result.to_device
+              << std::setw(11) << plain_result.to_cpu << std::setw(11) << pooled_result.to_cpu << std::endl;
+    free(plain_data);
+  }
+}
@@ -2,8 +2,17 @@
 #define NNONFPGA_NET
 
 #include <CL/cl2.hpp>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
 #include <vector>
+#include "async.hpp"
+#include "hash.hpp"
 #include "matrix.hpp"
+#include "metrics.hpp"
+#include "stream_limits.hpp"
 #include "utils.hpp"
 #include "xcl2.hpp"
 
@@ -11,46 +20,316 @@ class FCNN
 {
 private:
     Matrix weight1, weight2, bias1, bias2;
+    // Hidden activations of the batch-1 path, allocated once with the
+    // weights. Requests take turns on it, see forward_gemv.
+    Matrix single_hidden;
+    std::shared_ptr<std::mutex> single_hidden_mutex;
+    bool gemv_enabled;
+    uint64_t weights_version;
+    // Bumped whenever the device weights change in place, e.g. by Trainer.
+    // Shared by copies, which share the device buffers as well.
+    std::shared_ptr<std::atomic<uint64_t>> weights_generation;
+
+    // Migrations of upload_weights, see wait_for_upload
+    std::vector<cl::Event> uploads;
+
+    void upload_weights()
+    {
+        uploads.resize(5);
+        weight1.to_device(HANDLE, bank_for(ROLE_WEIGHT), &uploads[0]);
+        bias1.to_device(HANDLE, bank_for(ROLE_WEIGHT), &uploads[1]);
+        weight2.to_device(HANDLE, bank_for(ROLE_WEIGHT), &uploads[2]);
+        bias2.to_device(HANDLE, bank_for(ROLE_WEIGHT), &uploads[3]);
+        single_hidden = Matrix::constant(1, weight1.cols, 0.0);
+        single_hidden.to_device(HANDLE, bank_for(ROLE_ACTIVATION), &uploads[4]);
+        single_hidden_mutex = std::make_shared<std::mutex>();
+        gemv_enabled = true;
+        weights_version = 0;
+        weights_generation = std::make_shared<std::atomic<uint64_t>>(0);
+        for (Matrix *m : {&weight1, &bias1, &weight2, &bias2})
+        {
+            weights_version = hash_floats(m->raw_data(), m->rows * m->cols, weights_version + m->rows);
+        }
+    }
+
+    // Shared by all models, see metrics.hpp
+    static InferenceMetrics &inference_metrics();
+
+    // Host side of the result of `rows` rows. The batch-1 path overwrites it,
+    // the generic one accumulates into it.
+    Matrix output_for(const uint rows) const
+    {
+        return uses_gemv(rows) ? Matrix(rows, weight2.cols) : Matrix::constant(rows, weight2.cols, 0.0);
+    }
 
 public:
     FCNN()
     {
         weight1 = Matrix::constant(784, 64, 1.0);
-        weight1.to_device();
         bias1 = Matrix::constant(64, 1, 0.0);
-        bias1.to_device();
         weight2 = Matrix::constant(64, 10, .001);
-        weight2.to_device();
         bias2 = Matrix::constant(10, 1, 0.0);
-        bias2.to_device();
+        upload_weights();
     }
 
     FCNN(const std::string &weights_dir)
     {
         weight1 = Matrix::from_npy(weights_dir + "/w1.npy");
-        weight1.to_device();
         bias1 = Matrix::from_npy(weights_dir + "/b1.npy");
-        bias1.to_device();
         weight2 = Matrix::from_npy(weights_dir + "/w2.npy");
-        weight2.to_device();
         bias2 = Matrix::from_npy(weights_dir + "/b2.npy");
-        bias2.to_device();
+        upload_weights();
+    }
+
+    // Takes ownership of host-side weights, e.g. handed over from Python
+    FCNN(Matrix &&w1, Matrix &&b1, Matrix &&w2, Matrix &&b2)
+    {
+        weight1 = std::move(w1);
+        bias1 = std::move(b1);
+        weight2 = std::move(w2);
+        bias2 = std::move(b2);
+        upload_weights();
+    }
+
+    static const uint NUM_LAYERS = 2;
+
+    // Host-side weights of `layer`, valid on the host and the device
+    Matrix &weight(const uint layer)
+    {
+        return layer == 0 ? weight1 : weight2;
+    }
+
+    Matrix &bias(const uint layer)
+    {
+        return layer == 0 ? bias1 : bias2;
+    }
+
+    // Device memory taken by the weights, biases and the batch-1 hidden
+    // activations, each buffer rounded up to whole pages
+    std::size_t device_bytes() const
+    {
+        std::size_t result = 0;
+        for (const Matrix *m : {&weight1, &bias1, &weight2, &bias2, &single_hidden})
+        {
+            result += (sizeof(float) * m->rows * m->cols + DEFAULT_ALIGNMENT - 1) / DEFAULT_ALIGNMENT * DEFAULT_ALIGNMENT;
+        }
+        return result;
+    }
+
+    // Blocks until the weights reached the device, without waiting for
+    // anything else on the queue
+    void wait_for_upload() const
+    {
+        cl::Event::waitForEvents(uploads);
+    }
+
+    // Hash of the weights as loaded, combined with the number of in-place
+    // updates since, e.g. to key cached results (see result_cache.hpp).
+    // Models with the same weights have the same version.
+    uint64_t version() const
+    {
+        return weights_version ^ (*weights_generation * 0x9E3779B97F4A7C15ULL);
+    }
+
+    // To be called by whoever changes the device weights in place, so that
+    // results keyed by the previous version() aren't used anymore
+    void weights_updated()
+    {
+        ++*weights_generation;
+    }
+
+    // Input size, hidden size and number of classes
+    std::vector<uint> shape() const
+    {
+        return {weight1.rows, weight1.cols, weight2.cols};
+    }
+
+    // Runs the network on `input`, accumulating the class probabilities into
+    // `output`, which has to be zero-initialized and on the device. See
+    // placement.hpp for the banks they have to be in. If
+    // `kernel_events` is given, the events of all enqueued kernels are
+    // appended to it, e.g. for profiling. Each kernel waits only for the
+    // commands touching its operands (see BufferAccesses), e.g. the input and
+    // output migrations, and the first one for `wait_on` as well. Returns the
+    // event of the last kernel. A single row goes through forward_gemv unless
+    // disabled with enable_gemv.
+    cl::Event forward(Matrix &input, Matrix &output, std::vector<cl::Event> *kernel_events = NULL, std::vector<cl::Event> *wait_on = NULL)
+    {
+        if (uses_gemv(input.rows))
+        {
+            return forward_gemv(input, output, kernel_events, wait_on);
+        }
+        return forward_batched(input, output, kernel_events, wait_on);
     }
 
-    Matrix operator()(Matrix &input)
+    // forward with the generic matmul and bias kernels, two per layer
+    cl::Event forward_batched(Matrix &input, Matrix &output, std::vector<cl::Event> *kernel_events = NULL, std::vector<cl::Event> *wait_on = NULL)
     {
-        std::vector<cl::Event> events;
-        events.resize(3);
+        std::vector<cl::Event> events(4);
         Matrix y;
-        std::tie(y, events[0]) = apply_matmul(input, weight1, MATMUL_KERNEL);
-        events[1] = events[0];
-        events[2] = events[0];
-        events[1] = apply_bias(y, bias1, BIAS_RELU6_KERNEL, &events);
+        std::tie(y, events[0]) = apply_matmul(input, weight1, matmul_kernel_for(weight1.rows, weight1.cols, MATMUL_KERNEL), wait_on);
+        events[1] = apply_bias(y, bias1, BIAS_RELU6_KERNEL);
+        events[2] = apply_matmul_into(y, weight2, output, matmul_kernel_for(weight2.rows, weight2.cols, MATMUL_OUTPUT_KERNEL));
+        events[3] = apply_bias(output, bias2, BIAS_SOFTMAX_KERNEL);
+
+        if (kernel_events != NULL)
+        {
+            kernel_events->insert(kernel_events->end(), events.begin(), events.end());
+        }
+        return events[3];
+    }
+
+    // forward for a single row with one gemv_kernel per layer, bias and
+    // activation included. Nothing is allocated: the hidden activations go to
+    // a device buffer kept with the weights, and `output` is overwritten, so
+    // it doesn't need to be zero-initialized.
+    cl::Event forward_gemv(Matrix &input, Matrix &output, std::vector<cl::Event> *kernel_events = NULL, std::vector<cl::Event> *wait_on = NULL)
+    {
+        std::vector<cl::Event> events(2);
+        {
+            // Both kernels have to be enqueued together. The hazards then
+            // keep the next request's first layer off the hidden activations
+            // until this one's second layer has read them.
+            std::lock_guard<std::mutex> lock(*single_hidden_mutex);
+            events[0] = apply_gemv(input, weight1, bias1, single_hidden, GEMV_ACTIVATION_RELU6, GEMV_KERNEL, wait_on);
+            events[1] = apply_gemv(single_hidden, weight2, bias2, output, GEMV_ACTIVATION_SOFTMAX, GEMV_OUTPUT_KERNEL);
+        }
+
+        if (kernel_events != NULL)
+        {
+            kernel_events->insert(kernel_events->end(), events.begin(), events.end());
+        }
+        return events[1];
+    }
+
+    // Whether forward takes the batch-1 path for `rows` rows. The layers have
+    // to fit on chip, see GEMV_MAX_INPUTS.
+    bool uses_gemv(const uint rows) const
+    {
+        return gemv_enabled && rows == 1 && std::max(weight1.rows, weight2.rows) <= GEMV_MAX_INPUTS &&
+               std::max(weight1.cols, weight2.cols) <= GEMV_MAX_OUTPUTS;
+    }
+
+    // E.g. to compare against the generic path
+    void enable_gemv(const bool enabled)
+    {
+        gemv_enabled = enabled;
+    }
 
-        std::tie(y, events[2]) = apply_matmul(y, weight2, MATMUL_KERNEL, &events);
-        apply_bias(y, bias2, BIAS_SOFTMAX_KERNEL, &events);
+    // Same result as forward, but runs the network on the dataflow pipeline:
+    // all six kernels are started at once and hand activations to each other
+    // over streams, so hidden activations never touch DDR. `output` doesn't
+    // need to be zero-initialized. Returns the event of the kernel writing it.
+    // There is only one instance of the pipeline, so calls must not overlap.
+    // Each layer has to fit the on-chip buffers, see stream_limits.hpp.
+    cl::Event forward_dataflow(Matrix &input, Matrix &output, std::vector<cl::Event> *kernel_events = NULL, std::vector<cl::Event> *wait_on = NULL)
+    {
+        for (const Matrix *weight : {&weight1, &weight2})
+        {
+            if (weight->rows * weight->cols > STREAM_MAX_WEIGHTS || weight->rows > STREAM_MAX_COLS ||
+                weight->cols > STREAM_MAX_COLS)
+            {
+                throw std::runtime_error("Layer of " + std::to_string(weight->rows) + "x" + std::to_string(weight->cols) +
+                                         " doesn't fit the dataflow kernels");
+            }
+        }
+        StreamKernels &k = STREAM_KERNELS;
+        k.load.setArg(0, input.get_buffer());
+        k.load.setArg(1, input.rows * input.cols);
+        // Stream ports are connected in the xclbin and skipped here
+        k.hidden_matmul.setArg(1, weight1.get_buffer());
+        k.hidden_matmul.setArg(2, input.rows);
+        k.hidden_matmul.setArg(3, weight1.rows);
+        k.hidden_matmul.setArg(4, weight1.cols);
+        k.bias_relu6.setArg(1, bias1.get_buffer());
+        k.bias_relu6.setArg(2, input.rows);
+        k.bias_relu6.setArg(3, weight1.cols);
+        k.output_matmul.setArg(1, weight2.get_buffer());
+        k.output_matmul.setArg(2, input.rows);
+        k.output_matmul.setArg(3, weight2.rows);
+        k.output_matmul.setArg(4, weight2.cols);
+        k.bias_softmax.setArg(1, bias2.get_buffer());
+        k.bias_softmax.setArg(2, input.rows);
+        k.bias_softmax.setArg(3, weight2.cols);
+        k.store.setArg(1, output.rows * output.cols);
+        k.store.setArg(2, output.get_buffer());
+
+        // Only the ends of the pipeline touch host-visible buffers, the
+        // kernels in between block on their input streams. Each kernel waits
+        // for the commands touching its own operands (see BufferAccesses).
+        const std::vector<cl::Event> caller_wait_on = wait_on != NULL ? *wait_on : std::vector<cl::Event>();
+        std::vector<std::vector<cl::Event>> dependencies(6);
+        dependencies[0] = caller_wait_on;
+        input.read_hazards(dependencies[0]);
+        weight1.read_hazards(dependencies[1]);
+        bias1.read_hazards(dependencies[2]);
+        weight2.read_hazards(dependencies[3]);
+        bias2.read_hazards(dependencies[4]);
+        dependencies[5] = caller_wait_on;
+        output.write_hazards(dependencies[5]);
+
+        const std::vector<cl::Kernel *> kernels = {&k.load, &k.hidden_matmul, &k.bias_relu6, &k.output_matmul, &k.bias_softmax, &k.store};
+        std::vector<cl::Event> events(6);
+        for (std::size_t i = 0; i < kernels.size(); i++)
+        {
+            HANDLE.q.enqueueTask(*kernels[i], dependencies[i].empty() ? NULL : &dependencies[i], &events[i]);
+        }
+        input.record_read(events[0]);
+        weight1.record_read(events[1]);
+        bias1.record_read(events[2]);
+        weight2.record_read(events[3]);
+        bias2.record_read(events[4]);
+        output.record_write(events[5]);
+
+        if (kernel_events != NULL)
+        {
+            kernel_events->insert(kernel_events->end(), events.begin(), events.end());
+        }
+        return events[5];
+    }
+
+    Matrix operator()(Matrix &input, std::vector<cl::Event> *kernel_events = NULL)
+    {
+        Matrix y = output_for(input.rows);
+        y.to_device(HANDLE, bank_for(ROLE_OUTPUT));
+        forward(input, y, kernel_events);
         return y;
     }
+
+    // Asynchronous variant of operator(): the result is read back to the host
+    // as soon as the last kernel finished, without draining the whole queue.
+    // `input` must already be on the device (in the ROLE_INPUT bank) and stay
+    // alive until completion.
+    InferenceHandle submit(Matrix &input)
+    {
+        Matrix y = output_for(input.rows);
+        y.to_device(HANDLE, bank_for(ROLE_OUTPUT));
+        return submit_into(input, std::move(y));
+    }
+
+    // Same as submit, but writes into the given zero-initialized device
+    // matrix in the ROLE_OUTPUT bank, e.g. a view on caller-owned memory
+    InferenceHandle submit_into(Matrix &input, Matrix &&output, std::vector<cl::Event> *wait_on = NULL)
+    {
+        std::vector<cl::Event> kernel_events;
+        const std::vector<cl::Event> readback_wait_on = {forward(input, output, &kernel_events, wait_on)};
+        cl::Event readback;
+        output.to_cpu(HANDLE, &readback_wait_on, &readback);
+
+        const std::vector<cl::Event> migrations = wait_on != NULL ? *wait_on : std::vector<cl::Event>();
+        const uint rows = input.rows, kernels_per_layer = uses_gemv(rows) ? 1 : 2;
+        InferenceHandle handle(std::move(output), readback);
+        handle.then([migrations, kernel_events, readback, rows, kernels_per_layer](Matrix &) {
+            inference_metrics().record(migrations, kernel_events, kernels_per_layer, readback, rows);
+        });
+        return handle;
+    }
 };
 
+InferenceMetrics &FCNN::inference_metrics()
+{
+    static InferenceMetrics metrics(NUM_LAYERS);
+    return metrics;
+}
+
 #endif /* end of include guard: NNONFPGA_NET */
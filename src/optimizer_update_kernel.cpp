@@ -0,0 +1,25 @@
+#include "training_kernels.hpp"
+#include "hls_math.h"
+
+extern "C" void optimizer_update_kernel(
+    float *const param, const float *const gradient, float *const m, float *const v, const uint size,
+    const uint algorithm, const float step_size, const float beta1, const float beta2, const float epsilon)
+{
+   for (uint i = 0; i < size; i++)
+   {
+#pragma HLS PIPELINE II = 1
+      const float g = gradient[i];
+      if (algorithm == OPTIMIZER_ADAM)
+      {
+         const float mi = beta1 * m[i] + (1.f - beta1) * g;
+         const float vi = beta2 * v[i] + (1.f - beta2) * g * g;
+         m[i] = mi;
+         v[i] = vi;
+         param[i] -= step_size * mi / (sqrt(vi) + epsilon);
+      }
+      else
+      {
+         param[i] -= step_size * g;
+      }
+   }
+}
@@ -0,0 +1,257 @@
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "cli.hpp"
+#include "json.hpp"
+#include "matrix.hpp"
+#include "net.hpp"
+#include "stats.hpp"
+#include "utils.hpp"
+#include "xcl2.hpp"
+
+// Runs a fixed benchmark set and compares it against a checked-in baseline.
+// Every metric is the median over `--repeats` runs in microseconds; a metric
+// regresses if it is slower than the baseline by more than its relative
+// tolerance. Exits non-zero on regression, and if no metric has a baseline
+// value yet, so that an unrecorded baseline can't pass the gate.
+//
+// Usage: perf_regression --baseline baselines/hw.json [--update] [--repeats 20]
+//                        [--weights DIR]
+//
+// `--update` writes the measured values back into the baseline, keeping the
+// tolerances already stored there.
+
+static const double DEFAULT_TOLERANCE = 0.15;
+
+struct Metric
+{
+  std::string name;
+  double value;
+};
+
+Metric measure(const std::string &name, const uint repeats, const std::function<double()> &run_once)
+{
+  // Warmup
+  run_once();
+  std::vector<double> samples;
+  for (uint r = 0; r < repeats; r++)
+  {
+    samples.push_back(run_once());
+  }
+  return {name, median(samples)};
+}
+
+std::vector<Metric> run_benchmarks(FCNN &model, const uint repeats)
+{
+  const std::vector<uint> batch_sizes = {1, 16, 256};
+  const bool emulation = xcl::is_emulation();
+  const auto shape = model.shape();
+  std::vector<Metric> result;
+
+  Matrix weight = Matrix::random(shape[0], shape[1], 1);
+  weight.to_device(HANDLE, bank_for(ROLE_WEIGHT));
+  Matrix hidden_bias = Matrix::random(shape[1], 1, 2);
+  hidden_bias.to_device(HANDLE, bank_for(ROLE_WEIGHT));
+  Matrix output_bias = Matrix::random(shape[2], 1, 3);
+  output_bias.to_device(HANDLE, bank_for(ROLE_WEIGHT));
+  finish_cl_queue();
+
+  for (const uint batch_size : batch_sizes)
+  {
+    const std::string suffix = "_b" + std::to_string(batch_size) + "_us";
+    Matrix input = Matrix::random(batch_size, shape[0]);
+
+    result.push_back(measure("to_device" + suffix, repeats, [&]() {
+      cl::Event event;
+      input.to_device(HANDLE, bank_for(ROLE_INPUT), &event);
+      finish_cl_queue();
+      return event_duration_ns(event) * 1e-3;
+    }));
+
+    result.push_back(measure("to_cpu" + suffix, repeats, [&]() {
+      cl::Event event;
+      input.to_cpu(HANDLE, NULL, &event);
+      finish_cl_queue();
+      return event_duration_ns(event) * 1e-3;
+    }));
+
+    result.push_back(measure("matmul" + suffix, repeats, [&]() {
+      auto out = apply_matmul(input, weight, MATMUL_KERNEL);
+      finish_cl_queue();
+      return event_duration_ns(out.second) * 1e-3;
+    }));
+
+    Matrix hidden = Matrix::random(batch_size, shape[1], 4);
+    hidden.to_device(HANDLE, bank_for(ROLE_ACTIVATION));
+    result.push_back(measure("bias_relu6" + suffix, repeats, [&]() {
+      const cl::Event event = apply_bias(hidden, hidden_bias, BIAS_RELU6_KERNEL);
+      finish_cl_queue();
+      return event_duration_ns(event) * 1e-3;
+    }));
+
+    Matrix logits = Matrix::random(batch_size, shape[2], 5);
+    logits.to_device(HANDLE, bank_for(ROLE_OUTPUT));
+    result.push_back(measure("bias_softmax" + suffix, repeats, [&]() {
+      const cl::Event event = apply_bias(logits, output_bias, BIAS_SOFTMAX_KERNEL);
+      finish_cl_queue();
+      return event_duration_ns(event) * 1e-3;
+    }));
+
+    // End-to-end including readback; wall clock is meaningless in emulation,
+    // so use the simulated device timeline there
+    result.push_back(measure("fcnn" + suffix, repeats, [&]() {
+      std::vector<cl::Event> events;
+      const auto start = std::chrono::steady_clock::now();
+      Matrix y = model(input, &events);
+      finish_cl_queue();
+      cl::Event readback;
+      y.to_cpu(HANDLE, NULL, &readback);
+      finish_cl_queue();
+      const auto stop = std::chrono::steady_clock::now();
+      events.push_back(readback);
+      return emulation ? events_span_ns(events) * 1e-3
+                       : std::chrono::duration<double, std::micro>(stop - start).count();
+    }));
+
+    // Same without DDR round trips of the hidden activations
+    result.push_back(measure("fcnn_dataflow" + suffix, repeats, [&]() {
+      std::vector<cl::Event> events;
+      Matrix y(batch_size, shape[2]);
+      y.to_device(HANDLE, bank_for(ROLE_OUTPUT));
+      finish_cl_queue();
+      const auto start = std::chrono::steady_clock::now();
+      model.forward_dataflow(input, y, &events);
+      cl::Event readback;
+      const std::vector<cl::Event> readback_wait_on = {events.back()};
+      y.to_cpu(HANDLE, &readback_wait_on, &readback);
+      finish_cl_queue();
+      const auto stop = std::chrono::steady_clock::now();
+      events.push_back(readback);
+      return emulation ? events_span_ns(events) * 1e-3
+                       : std::chrono::duration<double, std::micro>(stop - start).count();
+    }));
+  }
+  return result;
+}
+
+// Prints a table of baseline vs. measured values, returns false on regression
+// or if nothing could be compared
+bool compare(const JsonValue &baseline, const std::vector<Metric> &metrics)
+{
+  uint missing = 0;
+  const double default_tolerance = baseline.get("default_tolerance", DEFAULT_TOLERANCE);
+  const JsonValue empty = JsonValue::object();
+  const JsonValue &stored = baseline.contains("metrics") ? baseline.at("metrics") : empty;
+  bool passed = true;
+
+  std::cout << std::left << std::setw(24) << "metric" << std::right
+            << std::setw(14) << "baseline" << std::setw(14) << "measured"
+            << std::setw(10) << "delta" << std::setw(8) << "tol" << "  status" << std::endl;
+  std::cout << std::fixed << std::setprecision(2);
+  for (const auto &metric : metrics)
+  {
+    std::cout << std::left << std::setw(24) << metric.name << std::right;
+    if (!stored.contains(metric.name) || !stored.at(metric.name).contains("value") ||
+        stored.at(metric.name).at("value").is_null())
+    {
+      std::cout << std::setw(14) << "-" << std::setw(14) << metric.value
+                << std::setw(10) << "-" << std::setw(8) << "-" << "  new" << std::endl;
+      missing++;
+      continue;
+    }
+
+    const JsonValue &entry = stored.at(metric.name);
+    const double reference = entry.at("value").as_number();
+    const double tolerance = entry.get("tolerance", default_tolerance);
+    const double delta = (metric.value - reference) / reference;
+    std::string status = "ok";
+    if (delta > tolerance)
+    {
+      status = "REGRESSION";
+      passed = false;
+    }
+    else if (delta < -tolerance)
+    {
+      status = "faster, consider --update";
+    }
+
+    std::cout << std::setw(14) << reference << std::setw(14) << metric.value
+              << std::setw(9) << delta * 100 << "%" << std::setw(7) << tolerance * 100 << "%"
+              << "  " << status << std::endl;
+  }
+
+  for (const auto &item : stored.items())
+  {
+    bool measured = false;
+    for (const auto &metric : metrics)
+    {
+      measured = measured || metric.name == item.first;
+    }
+    if (!measured)
+    {
+      std::cout << "WARNING: baseline metric " << item.first << " was not measured" << std::endl;
+    }
+  }
+  if (missing == metrics.size())
+  {
+    std::cout << "ERROR: no metric has a baseline value, record them with --update on the reference machine"
+              << std::endl;
+    return false;
+  }
+  if (missing > 0)
+  {
+    std::cout << "WARNING: " << missing << " of " << metrics.size() << " metrics have no baseline value" << std::endl;
+  }
+  return passed;
+}
+
+JsonValue updated_baseline(const JsonValue &baseline, const std::vector<Metric> &metrics)
+{
+  JsonValue result = baseline;
+  const double default_tolerance = baseline.get("default_tolerance", DEFAULT_TOLERANCE);
+  result["default_tolerance"] = default_tolerance;
+  for (const auto &metric : metrics)
+  {
+    JsonValue &entry = result["metrics"][metric.name];
+    const double tolerance = entry.get("tolerance", default_tolerance);
+    entry["tolerance"] = tolerance;
+    entry["value"] = metric.value;
+  }
+  return result;
+}
+
+int main(int argc, const char *argv[])
+{
+  const CliArgs args(argc, argv);
+  const std::string baseline_path = args.get("baseline", "../baselines/hw.json");
+  const uint repeats = args.get_uint("repeats", 20);
+
+  init_kernels();
+  FCNN model(args.get("weights", "../weights"));
+  const auto metrics = run_benchmarks(model, repeats);
+
+  JsonValue baseline = JsonValue::object();
+  if (std::ifstream(baseline_path))
+  {
+    baseline = load_json(baseline_path);
+  }
+
+  if (args.has("update"))
+  {
+    save_json(baseline_path, updated_baseline(baseline, metrics));
+    std::cout << "Updated " << baseline_path << std::endl;
+    return 0;
+  }
+
+  if (!compare(baseline, metrics))
+  {
+    std::cout << "Failed against " << baseline_path << std::endl;
+    return 1;
+  }
+  return 0;
+}
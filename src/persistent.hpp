@@ -0,0 +1,198 @@
+#ifndef NNONFPGA_PERSISTENT
+#define NNONFPGA_PERSISTENT
+
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include <CL/cl2.hpp>
+#include "matrix.hpp"
+#include "net.hpp"
+#include "persistent_fcnn_kernel.hpp"
+#include "placement.hpp"
+#include "utils.hpp"
+
+// Host side of persistent_fcnn_kernel. The kernel is launched once, keeps the
+// weights of `model` on chip and then serves batches from a command ring in
+// device memory, so a batch costs two small writes and polling a status word
+// instead of a kernel launch, argument setup and the weight reads.
+//
+//     PersistentRunner runner(model);
+//     const uint ticket = runner.submit(sample, 1);
+//     runner.wait(ticket, probabilities);
+//
+// Up to PERSISTENT_RING_SLOTS batches of at most max_rows() rows can be in
+// flight; a slot is free again once its result was collected with wait().
+// The runner has its own command queues, since the kernel never finishes
+// while the runner is alive: HANDLE.q and finish_cl_queue stay usable. It
+// is not thread-safe, and the model has to outlive it.
+class PersistentRunner
+{
+private:
+    const uint input_dim, output_dim, max_batch_rows;
+    cl::CommandQueue launch_queue, transfer_queue;
+    cl::Kernel kernel;
+    cl::Buffer commands, status, inputs, outputs;
+    cl::Event finished;
+    // Next sequence number, sequence n + 1 goes into slot n % slots
+    uint next_sequence;
+    bool running;
+    uint slot_rows[PERSISTENT_RING_SLOTS];
+    bool slot_busy[PERSISTENT_RING_SLOTS];
+    // The descriptors have to stay alive until their write completes
+    uint descriptors[PERSISTENT_RING_SLOTS][PERSISTENT_COMMAND_WORDS];
+
+    static uint slot_of(const uint sequence)
+    {
+        return (sequence - 1) % PERSISTENT_RING_SLOTS;
+    }
+
+    // Writes the descriptor of the next sequence number and returns it. The
+    // transfer queue is in order, so everything enqueued before lands first.
+    uint push_command(const uint rows, const uint opcode)
+    {
+        const uint sequence = next_sequence++;
+        uint *descriptor = descriptors[slot_of(sequence)];
+        descriptor[PERSISTENT_COMMAND_ROWS] = rows;
+        descriptor[PERSISTENT_COMMAND_OPCODE] = opcode;
+        descriptor[PERSISTENT_COMMAND_RESERVED] = 0;
+        descriptor[PERSISTENT_COMMAND_SEQUENCE] = sequence;
+        transfer_queue.enqueueWriteBuffer(commands, CL_FALSE, sizeof(uint) * PERSISTENT_COMMAND_WORDS * slot_of(sequence),
+                                          sizeof(uint) * PERSISTENT_COMMAND_WORDS, descriptor);
+        transfer_queue.flush();
+        return sequence;
+    }
+
+public:
+    PersistentRunner(FCNN &model, const uint max_rows = 1)
+        : input_dim(model.weight(0).rows), output_dim(model.weight(1).cols), max_batch_rows(max_rows),
+          launch_queue(HANDLE.context, HANDLE.device, CL_QUEUE_PROFILING_ENABLE),
+          transfer_queue(HANDLE.context, HANDLE.device),
+          next_sequence(1), running(true)
+    {
+        Matrix &w1 = model.weight(0), &w2 = model.weight(1);
+        if (w1.rows > PERSISTENT_MAX_INPUT || w1.cols > PERSISTENT_MAX_HIDDEN || w2.cols > PERSISTENT_MAX_OUTPUT)
+        {
+            throw std::runtime_error("Model does not fit into persistent_fcnn_kernel");
+        }
+        if (max_rows == 0)
+        {
+            throw std::runtime_error("PersistentRunner needs at least one row per batch");
+        }
+
+        commands = device_scratch(sizeof(uint) * PERSISTENT_COMMAND_WORDS * PERSISTENT_RING_SLOTS, bank_for(ROLE_INPUT));
+        status = device_scratch(sizeof(uint) * PERSISTENT_RING_SLOTS, bank_for(ROLE_INPUT));
+        inputs = device_scratch(sizeof(float) * PERSISTENT_RING_SLOTS * max_rows * input_dim, bank_for(ROLE_INPUT));
+        outputs = device_scratch(sizeof(float) * PERSISTENT_RING_SLOTS * max_rows * output_dim, bank_for(ROLE_OUTPUT));
+        transfer_queue.enqueueFillBuffer(commands, 0u, 0, sizeof(uint) * PERSISTENT_COMMAND_WORDS * PERSISTENT_RING_SLOTS);
+        transfer_queue.enqueueFillBuffer(status, 0u, 0, sizeof(uint) * PERSISTENT_RING_SLOTS);
+        transfer_queue.finish();
+        for (uint slot = 0; slot < PERSISTENT_RING_SLOTS; slot++)
+        {
+            slot_busy[slot] = false;
+        }
+
+        // The weights are uploaded by the model on HANDLE.q
+        finish_cl_queue();
+        kernel = cl::Kernel(PROGRAM, "persistent_fcnn_kernel");
+        kernel.setArg(0, w1.get_buffer());
+        kernel.setArg(1, model.bias(0).get_buffer());
+        kernel.setArg(2, w2.get_buffer());
+        kernel.setArg(3, model.bias(1).get_buffer());
+        kernel.setArg(4, w1.rows);
+        kernel.setArg(5, w1.cols);
+        kernel.setArg(6, w2.cols);
+        kernel.setArg(7, max_rows);
+        kernel.setArg(8, commands);
+        kernel.setArg(9, status);
+        kernel.setArg(10, inputs);
+        kernel.setArg(11, outputs);
+        launch_queue.enqueueTask(kernel, NULL, &finished);
+        launch_queue.flush();
+    }
+
+    PersistentRunner(const PersistentRunner &) = delete;
+    PersistentRunner &operator=(const PersistentRunner &) = delete;
+
+    ~PersistentRunner()
+    {
+        stop();
+    }
+
+    uint max_rows() const
+    {
+        return max_batch_rows;
+    }
+
+    // Queues `rows` samples of `input` and returns the ticket to wait on. The
+    // input is copied before submit returns.
+    uint submit(const float *input, const uint rows)
+    {
+        if (!running)
+        {
+            throw std::runtime_error("PersistentRunner is stopped");
+        }
+        if (rows == 0 || rows > max_batch_rows)
+        {
+            throw std::runtime_error("Batch of " + std::to_string(rows) + " rows does not fit into a slot of " +
+                                     std::to_string(max_batch_rows));
+        }
+        const uint slot = slot_of(next_sequence);
+        if (slot_busy[slot])
+        {
+            throw std::runtime_error("Command ring is full, wait for earlier tickets first");
+        }
+        slot_busy[slot] = true;
+        slot_rows[slot] = rows;
+        transfer_queue.enqueueWriteBuffer(inputs, CL_TRUE, sizeof(float) * slot * max_batch_rows * input_dim,
+                                          sizeof(float) * rows * input_dim, input);
+        return push_command(rows, PERSISTENT_OP_RUN);
+    }
+
+    // True once the kernel has finished `ticket`, one status read over PCIe
+    bool poll(const uint ticket)
+    {
+        uint done = 0;
+        transfer_queue.enqueueReadBuffer(status, CL_TRUE, sizeof(uint) * slot_of(ticket), sizeof(uint), &done);
+        return done == ticket;
+    }
+
+    // Busy-waits for `ticket` and copies its rows x output columns of class
+    // probabilities to `output`, which frees the slot
+    void wait(const uint ticket, float *output)
+    {
+        const uint slot = slot_of(ticket);
+        if (ticket == 0 || ticket >= next_sequence || !slot_busy[slot])
+        {
+            throw std::runtime_error("Unknown ticket " + std::to_string(ticket));
+        }
+        while (!poll(ticket))
+        {
+        }
+        transfer_queue.enqueueReadBuffer(outputs, CL_TRUE, sizeof(float) * slot * max_batch_rows * output_dim,
+                                         sizeof(float) * slot_rows[slot] * output_dim, output);
+        slot_busy[slot] = false;
+    }
+
+    // Lets the kernel return after the batches already submitted. Results
+    // that were not collected are lost.
+    void stop()
+    {
+        if (!running)
+        {
+            return;
+        }
+        running = false;
+        // The stop command needs a slot of its own
+        const uint slot = slot_of(next_sequence);
+        if (slot_busy[slot])
+        {
+            while (!poll(next_sequence - PERSISTENT_RING_SLOTS))
+            {
+            }
+        }
+        push_command(0, PERSISTENT_OP_STOP);
+        finished.wait();
+    }
+};
+
+#endif /* end of include guard: NNONFPGA_PERSISTENT */
@@ -0,0 +1,120 @@
+#include "persistent_fcnn_kernel.hpp"
+#include "hls_math.h"
+
+inline float relu6(const float x)
+{
+   if (x < 0.f)
+      return 0.f;
+   if (x > 6.f)
+      return 6.f;
+   return x;
+}
+
+// Whole FCNN as a single kernel that is launched once and then serves batches
+// from the command ring until it receives PERSISTENT_OP_STOP. The weights are
+// loaded once, so a batch costs neither a launch nor operand reloads. Inputs
+// and outputs of slot s start at s * max_rows rows of the respective ring.
+extern "C" void persistent_fcnn_kernel(
+    const float *const weights1, const float *const bias1, const float *const weights2, const float *const bias2,
+    const uint input_dim, const uint hidden_dim, const uint output_dim, const uint max_rows,
+    volatile uint *const commands, volatile uint *const status, const float *const inputs, float *const outputs)
+{
+   float local_w1[PERSISTENT_MAX_INPUT][PERSISTENT_MAX_HIDDEN];
+#pragma HLS ARRAY_PARTITION variable = local_w1 complete dim = 2
+   float local_b1[PERSISTENT_MAX_HIDDEN];
+   float local_w2[PERSISTENT_MAX_HIDDEN][PERSISTENT_MAX_OUTPUT];
+#pragma HLS ARRAY_PARTITION variable = local_w2 complete dim = 2
+   float local_b2[PERSISTENT_MAX_OUTPUT];
+   float hidden[PERSISTENT_MAX_HIDDEN];
+#pragma HLS ARRAY_PARTITION variable = hidden complete
+   float out[PERSISTENT_MAX_OUTPUT];
+#pragma HLS ARRAY_PARTITION variable = out complete
+
+   for (uint k = 0; k < input_dim; k++)
+   {
+      for (uint h = 0; h < hidden_dim; h++)
+      {
+#pragma HLS PIPELINE II = 1
+         local_w1[k][h] = weights1[hidden_dim * k + h];
+      }
+   }
+   for (uint h = 0; h < hidden_dim; h++)
+   {
+      local_b1[h] = bias1[h];
+      for (uint o = 0; o < output_dim; o++)
+      {
+#pragma HLS PIPELINE II = 1
+         local_w2[h][o] = weights2[output_dim * h + o];
+      }
+   }
+   for (uint o = 0; o < output_dim; o++)
+   {
+      local_b2[o] = bias2[o];
+   }
+
+   for (uint n = 0;; n++)
+   {
+      const uint slot = n % PERSISTENT_RING_SLOTS;
+      volatile uint *const command = commands + slot * PERSISTENT_COMMAND_WORDS;
+      while (command[PERSISTENT_COMMAND_SEQUENCE] != n + 1)
+      {
+         // Busy-wait for the host
+      }
+      if (command[PERSISTENT_COMMAND_OPCODE] == PERSISTENT_OP_STOP)
+      {
+         status[slot] = n + 1;
+         return;
+      }
+
+      const uint rows = command[PERSISTENT_COMMAND_ROWS];
+      for (uint r = 0; r < rows; r++)
+      {
+         const float *const x = inputs + (slot * max_rows + r) * input_dim;
+         for (uint h = 0; h < PERSISTENT_MAX_HIDDEN; h++)
+         {
+#pragma HLS UNROLL
+            hidden[h] = 0.f;
+         }
+         for (uint k = 0; k < input_dim; k++)
+         {
+#pragma HLS PIPELINE II = 1
+            const float xk = x[k];
+            for (uint h = 0; h < PERSISTENT_MAX_HIDDEN; h++)
+            {
+#pragma HLS UNROLL
+               hidden[h] += xk * local_w1[k][h];
+            }
+         }
+
+         for (uint o = 0; o < PERSISTENT_MAX_OUTPUT; o++)
+         {
+#pragma HLS UNROLL
+            out[o] = 0.f;
+         }
+         for (uint h = 0; h < hidden_dim; h++)
+         {
+#pragma HLS PIPELINE II = 1
+            const float activation = relu6(hidden[h] + local_b1[h]);
+            for (uint o = 0; o < PERSISTENT_MAX_OUTPUT; o++)
+            {
+#pragma HLS UNROLL
+               out[o] += activation * local_w2[h][o];
+            }
+         }
+
+         float accum = 0.f;
+         for (uint o = 0; o < output_dim; o++)
+         {
+            out[o] = exp(out[o] + local_b2[o]);
+            accum += out[o];
+         }
+         float *const y = outputs + (slot * max_rows + r) * output_dim;
+         for (uint o = 0; o < output_dim; o++)
+         {
+#pragma HLS PIPELINE II = 1
+            y[o] = out[o] / accum;
+         }
+      }
+      status[slot] = n + 1;
+   }
+}
@@ -0,0 +1,27 @@
+typedef unsigned int uint;
+
+// Limits of persistent_fcnn_kernel, whose weights live on chip for its whole
+// lifetime
+#define PERSISTENT_MAX_INPUT 1024
+#define PERSISTENT_MAX_HIDDEN 64
+#define PERSISTENT_MAX_OUTPUT 16
+
+// Command ring shared with the host (see persistent.hpp). Descriptor n lives
+// in slot n % PERSISTENT_RING_SLOTS and is valid once its sequence word reads
+// n + 1; the sequence is the last word so that it lands after the payload.
+// Once slot n is done the kernel writes n + 1 into status[slot].
+#define PERSISTENT_RING_SLOTS 16
+#define PERSISTENT_COMMAND_WORDS 4
+#define PERSISTENT_COMMAND_ROWS 0
+#define PERSISTENT_COMMAND_OPCODE 1
+// Unused, written as 0
+#define PERSISTENT_COMMAND_RESERVED 2
+#define PERSISTENT_COMMAND_SEQUENCE 3
+
+#define PERSISTENT_OP_RUN 0
+#define PERSISTENT_OP_STOP 1
+
+extern "C" void persistent_fcnn_kernel(
+    const float *const weights1, const float *const bias1, const float *const weights2, const float *const bias2,
+    const uint input_dim, const uint hidden_dim, const uint output_dim, const uint max_rows,
+    volatile uint *const commands, volatile uint *const status, const float *const inputs, float *const outputs);
@@ -0,0 +1,213 @@
+#ifndef NNONFPGA_PLACEMENT
+#define NNONFPGA_PLACEMENT
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <CL/cl2.hpp>
+#include "specialization.hpp"
+
+typedef unsigned int uint;
+
+// Which DDR bank each kind of tensor lives in. The assignment has to match the
+// kernels' port connectivity in the xclbin, so the same policy is used to
+// generate the `[connectivity]` section at build time (gen_connectivity) and
+// to place buffers at runtime (bank_for).
+enum TensorRole
+{
+    ROLE_INPUT,
+    ROLE_WEIGHT,
+    ROLE_ACTIVATION,
+    ROLE_OUTPUT,
+    NUM_ROLES
+};
+
+static const uint NUM_DDR_BANKS = 4;
+static const int DDR_BANK_FLAGS[NUM_DDR_BANKS] = {XCL_MEM_DDR_BANK0, XCL_MEM_DDR_BANK1, XCL_MEM_DDR_BANK2, XCL_MEM_DDR_BANK3};
+
+struct Placement
+{
+    std::string name;
+    uint banks[NUM_ROLES];
+    // Number of matmul_kernel compute units in the xclbin
+    uint matmul_compute_units;
+    // If true, the first matmul CU is dedicated to the hidden layer and the
+    // second one to the output layer, so that each of them only touches the
+    // banks of its own operands
+    bool matmul_per_layer;
+
+    // Everything in one bank, the compute units are interchangeable
+    static Placement single_bank(const uint bank, const uint compute_units = 1)
+    {
+        return {"single", {bank, bank, bank, bank}, compute_units, false};
+    }
+
+    // Inputs, weights, hidden activations and outputs each get their own
+    // memory controller
+    static Placement spread()
+    {
+        return {"spread", {0, 1, 2, 3}, 2, true};
+    }
+
+    int flags(const TensorRole role) const
+    {
+        return DDR_BANK_FLAGS[banks[role]];
+    }
+
+    // Kernel name to instantiate for the matmul of `layer` (0 or 1), `kernel`
+    // is matmul_kernel or one of its variants with the same ports
+    std::string matmul_kernel_name(const uint layer, const std::string &kernel = "matmul_kernel") const
+    {
+        if (!matmul_per_layer)
+        {
+            return kernel;
+        }
+        return kernel + ":{" + kernel + "_" + std::to_string(layer + 1) + "}";
+    }
+
+    // Connectivity section for the v++ linker
+    std::string connectivity() const
+    {
+        std::ostringstream cfg;
+        cfg << "# Generated by gen_connectivity for the '" << name << "' placement" << std::endl;
+        cfg << "[connectivity]" << std::endl;
+        cfg << "nk=matmul_kernel:" << matmul_compute_units << std::endl;
+        for (uint cu = 1; cu <= matmul_compute_units; cu++)
+        {
+            const bool output_layer = matmul_per_layer && cu % 2 == 0;
+            const std::string prefix = "sp=matmul_kernel_" + std::to_string(cu);
+            cfg << prefix << ".matrixA:" << ddr(output_layer ? ROLE_ACTIVATION : ROLE_INPUT) << std::endl;
+            cfg << prefix << ".matrixB:" << ddr(ROLE_WEIGHT) << std::endl;
+            cfg << prefix << ".out:" << ddr(output_layer ? ROLE_OUTPUT : ROLE_ACTIVATION) << std::endl;
+        }
+        cfg << "sp=bias_relu6_kernel_1.activation:" << ddr(ROLE_ACTIVATION) << std::endl;
+        cfg << "sp=bias_relu6_kernel_1.bias:" << ddr(ROLE_WEIGHT) << std::endl;
+        cfg << "sp=bias_softmax_kernel_1.activation:" << ddr(ROLE_OUTPUT) << std::endl;
+        cfg << "sp=bias_softmax_kernel_1.bias:" << ddr(ROLE_WEIGHT) << std::endl;
+        for (const auto &shape : SPECIALIZED_MATMULS)
+        {
+            const bool output_layer = shape.layer > 0;
+            const std::string prefix = "sp=" + shape.kernel_name() + "_1";
+            cfg << prefix << ".matrixA:" << ddr(output_layer ? ROLE_ACTIVATION : ROLE_INPUT) << std::endl;
+            cfg << prefix << ".matrixB:" << ddr(ROLE_WEIGHT) << std::endl;
+            cfg << prefix << ".out:" << ddr(output_layer ? ROLE_OUTPUT : ROLE_ACTIVATION) << std::endl;
+        }
+
+        // Batch-1 path, see gemv_kernel.hpp
+        cfg << "nk=gemv_kernel:2" << std::endl;
+        for (uint cu = 1; cu <= 2; cu++)
+        {
+            const bool output_layer = cu == 2;
+            const std::string prefix = "sp=gemv_kernel_" + std::to_string(cu);
+            cfg << prefix << ".x:" << ddr(output_layer ? ROLE_ACTIVATION : ROLE_INPUT) << std::endl;
+            cfg << prefix << ".weights:" << ddr(ROLE_WEIGHT) << std::endl;
+            cfg << prefix << ".bias:" << ddr(ROLE_WEIGHT) << std::endl;
+            cfg << prefix << ".out:" << ddr(output_layer ? ROLE_OUTPUT : ROLE_ACTIVATION) << std::endl;
+        }
+
+        // Dataflow pipeline, see stream_kernels.hpp
+        cfg << "nk=matmul_stream_kernel:2" << std::endl;
+        cfg << "sp=load_stream_kernel_1.input:" << ddr(ROLE_INPUT) << std::endl;
+        cfg << "sp=matmul_stream_kernel_1.weights:" << ddr(ROLE_WEIGHT) << std::endl;
+        cfg << "sp=bias_relu6_stream_kernel_1.bias:" << ddr(ROLE_WEIGHT) << std::endl;
+        cfg << "sp=matmul_stream_kernel_2.weights:" << ddr(ROLE_WEIGHT) << std::endl;
+        cfg << "sp=bias_softmax_stream_kernel_1.bias:" << ddr(ROLE_WEIGHT) << std::endl;
+        cfg << "sp=store_stream_kernel_1.output:" << ddr(ROLE_OUTPUT) << std::endl;
+        cfg << "stream_connect=load_stream_kernel_1.out:matmul_stream_kernel_1.in" << std::endl;
+        cfg << "stream_connect=matmul_stream_kernel_1.out:bias_relu6_stream_kernel_1.in" << std::endl;
+        cfg << "stream_connect=bias_relu6_stream_kernel_1.out:matmul_stream_kernel_2.in" << std::endl;
+        cfg << "stream_connect=matmul_stream_kernel_2.out:bias_softmax_stream_kernel_1.in" << std::endl;
+        cfg << "stream_connect=bias_softmax_stream_kernel_1.out:store_stream_kernel_1.in" << std::endl;
+
+        // bfloat16 path, see bf16_net.hpp. Laid out like matmul_kernel, with a
+        // compute unit per layer if the placement asks for it.
+        const uint bf16_units = matmul_per_layer ? 2 : 1;
+        cfg << "nk=matmul_bf16_kernel:" << bf16_units << std::endl;
+        for (uint cu = 1; cu <= bf16_units; cu++)
+        {
+            const bool output_layer = cu == 2;
+            const std::string prefix = "sp=matmul_bf16_kernel_" + std::to_string(cu);
+            cfg << prefix << ".matrixA:" << ddr(output_layer ? ROLE_ACTIVATION : ROLE_INPUT) << std::endl;
+            cfg << prefix << ".matrixB:" << ddr(ROLE_WEIGHT) << std::endl;
+            cfg << prefix << ".out:" << ddr(output_layer ? ROLE_OUTPUT : ROLE_ACTIVATION) << std::endl;
+        }
+        cfg << "sp=bias_relu6_bf16_kernel_1.activation:" << ddr(ROLE_ACTIVATION) << std::endl;
+        cfg << "sp=bias_relu6_bf16_kernel_1.bias:" << ddr(ROLE_WEIGHT) << std::endl;
+        cfg << "sp=bias_relu6_bf16_kernel_1.out:" << ddr(ROLE_ACTIVATION) << std::endl;
+        // Persistent kernel, see persistent.hpp
+        cfg << "sp=persistent_fcnn_kernel_1.weights1:" << ddr(ROLE_WEIGHT) << std::endl;
+        cfg << "sp=persistent_fcnn_kernel_1.bias1:" << ddr(ROLE_WEIGHT) << std::endl;
+        cfg << "sp=persistent_fcnn_kernel_1.weights2:" << ddr(ROLE_WEIGHT) << std::endl;
+        cfg << "sp=persistent_fcnn_kernel_1.bias2:" << ddr(ROLE_WEIGHT) << std::endl;
+        cfg << "sp=persistent_fcnn_kernel_1.commands:" << ddr(ROLE_INPUT) << std::endl;
+        cfg << "sp=persistent_fcnn_kernel_1.status:" << ddr(ROLE_INPUT) << std::endl;
+        cfg << "sp=persistent_fcnn_kernel_1.inputs:" << ddr(ROLE_INPUT) << std::endl;
+        cfg << "sp=persistent_fcnn_kernel_1.outputs:" << ddr(ROLE_OUTPUT) << std::endl;
+        // Convolution, see conv.hpp. Its input is either images or the
+        // activations of a previous conv layer.
+        cfg << "sp=conv_relu6_kernel_1.input:" << ddr_span() << std::endl;
+        cfg << "sp=conv_relu6_kernel_1.weights:" << ddr(ROLE_WEIGHT) << std::endl;
+        cfg << "sp=conv_relu6_kernel_1.bias:" << ddr(ROLE_WEIGHT) << std::endl;
+        cfg << "sp=conv_relu6_kernel_1.out:" << ddr(ROLE_ACTIVATION) << std::endl;
+        // Training kernels, see trainer.hpp. The transposed matmul multiplies
+        // inputs, weights and activations with each other, so its operands
+        // can come from any bank in use.
+        cfg << "sp=matmul_transposed_kernel_1.matrixA:" << ddr_span() << std::endl;
+        cfg << "sp=matmul_transposed_kernel_1.matrixB:" << ddr_span() << std::endl;
+        cfg << "sp=matmul_transposed_kernel_1.out:" << ddr(ROLE_ACTIVATION) << std::endl;
+        cfg << "sp=softmax_xent_backward_kernel_1.probabilities:" << ddr(ROLE_OUTPUT) << std::endl;
+        cfg << "sp=softmax_xent_backward_kernel_1.labels:" << ddr(ROLE_INPUT) << std::endl;
+        cfg << "sp=softmax_xent_backward_kernel_1.gradient:" << ddr(ROLE_ACTIVATION) << std::endl;
+        cfg << "sp=softmax_xent_backward_kernel_1.loss:" << ddr(ROLE_ACTIVATION) << std::endl;
+        cfg << "sp=relu6_backward_kernel_1.activation:" << ddr(ROLE_ACTIVATION) << std::endl;
+        cfg << "sp=relu6_backward_kernel_1.gradient:" << ddr(ROLE_ACTIVATION) << std::endl;
+        cfg << "sp=optimizer_update_kernel_1.param:" << ddr(ROLE_WEIGHT) << std::endl;
+        cfg << "sp=optimizer_update_kernel_1.gradient:" << ddr(ROLE_ACTIVATION) << std::endl;
+        cfg << "sp=optimizer_update_kernel_1.m:" << ddr(ROLE_ACTIVATION) << std::endl;
+        cfg << "sp=optimizer_update_kernel_1.v:" << ddr(ROLE_ACTIVATION) << std::endl;
+        return cfg.str();
+    }
+
+private:
+    std::string ddr(const TensorRole role) const
+    {
+        return "DDR[" + std::to_string(banks[role]) + "]";
+    }
+
+    // Range of all banks used by some role
+    std::string ddr_span() const
+    {
+        uint lo = banks[0], hi = banks[0];
+        for (uint role = 1; role < NUM_ROLES; role++)
+        {
+            lo = std::min(lo, banks[role]);
+            hi = std::max(hi, banks[role]);
+        }
+        if (lo == hi)
+        {
+            return "DDR[" + std::to_string(lo) + "]";
+        }
+        return "DDR[" + std::to_string(lo) + ":" + std::to_string(hi) + "]";
+    }
+};
+
+#ifndef MATMUL_COMPUTE_UNITS
+#define MATMUL_COMPUTE_UNITS 1
+#endif
+
+#if defined(MEMORY_PLACEMENT_SPREAD)
+static const Placement PLACEMENT = Placement::spread();
+#elif defined(HW_MODE_ON)
+static const Placement PLACEMENT = Placement::single_bank(0, MATMUL_COMPUTE_UNITS);
+#else
+// Hardware emulation doesn't work with any other bank
+static const Placement PLACEMENT = Placement::single_bank(1, MATMUL_COMPUTE_UNITS);
+#endif
+
+// Memory flags for a tensor of the given role under the compiled-in placement
+inline int bank_for(const TensorRole role)
+{
+    return PLACEMENT.flags(role);
+}
+
+#endif /* end of include guard: NNONFPGA_PLACEMENT */
@@ -0,0 +1,119 @@
+#ifndef NNONFPGA_PLAN
+#define NNONFPGA_PLAN
+
+#include <cstring>
+#include <vector>
+#include <CL/cl2.hpp>
+#include "matrix.hpp"
+#include "net.hpp"
+#include "utils.hpp"
+
+// A forward pass of an FCNN captured for one batch size. Buffers for input,
+// hidden activations and output are allocated and put on the device once, and
+// the plan binds them to its own kernel objects, so arguments are set once
+// instead of on every call. Replaying only enqueues the zeroing of the
+// accumulators, the input migration, the four kernels and the readback along a
+// fixed dependency graph.
+//
+// A plan has at most one pass in flight; use several plans to overlap
+// batches. The model has to outlive its plans.
+class InferencePlan
+{
+private:
+    Matrix input_matrix, hidden, output;
+    cl::Kernel matmul1, bias_relu6, matmul2, bias_softmax;
+    std::vector<cl::Memory> input_buffers, output_buffers;
+    // Wait lists of the dependency graph, reused by every replay
+    std::vector<cl::Event> inputs_ready, matmul1_done, bias_relu6_done, matmul2_done, bias_softmax_done;
+    cl::Event readback;
+
+public:
+    InferencePlan(FCNN &model, const uint batch_size)
+        : input_matrix(Matrix::constant(batch_size, model.weight(0).rows, 0.0)),
+          hidden(Matrix::constant(batch_size, model.weight(0).cols, 0.0)),
+          output(Matrix::constant(batch_size, model.weight(1).cols, 0.0)),
+          inputs_ready(3), matmul1_done(1), bias_relu6_done(1), matmul2_done(1), bias_softmax_done(1)
+    {
+        Matrix &w1 = model.weight(0), &w2 = model.weight(1);
+        input_matrix.to_device(HANDLE, bank_for(ROLE_INPUT));
+        hidden.to_device(HANDLE, bank_for(ROLE_ACTIVATION));
+        output.to_device(HANDLE, bank_for(ROLE_OUTPUT));
+        input_buffers.push_back(input_matrix.get_buffer());
+        output_buffers.push_back(output.get_buffer());
+
+        matmul1 = cl::Kernel(PROGRAM, matmul_kernel_name_for(w1.rows, w1.cols, 0).c_str());
+        matmul1.setArg(0, input_matrix.get_buffer());
+        matmul1.setArg(1, w1.get_buffer());
+        matmul1.setArg(2, batch_size);
+        matmul1.setArg(3, w1.rows);
+        matmul1.setArg(4, w1.cols);
+        matmul1.setArg(5, hidden.get_buffer());
+
+        bias_relu6 = cl::Kernel(PROGRAM, "bias_relu6_kernel");
+        bias_relu6.setArg(0, hidden.get_buffer());
+        bias_relu6.setArg(1, model.bias(0).get_buffer());
+        bias_relu6.setArg(2, batch_size);
+        bias_relu6.setArg(3, w1.cols);
+
+        matmul2 = cl::Kernel(PROGRAM, matmul_kernel_name_for(w2.rows, w2.cols, 1).c_str());
+        matmul2.setArg(0, hidden.get_buffer());
+        matmul2.setArg(1, w2.get_buffer());
+        matmul2.setArg(2, batch_size);
+        matmul2.setArg(3, w2.rows);
+        matmul2.setArg(4, w2.cols);
+        matmul2.setArg(5, output.get_buffer());
+
+        bias_softmax = cl::Kernel(PROGRAM, "bias_softmax_kernel");
+        bias_softmax.setArg(0, output.get_buffer());
+        bias_softmax.setArg(1, model.bias(1).get_buffer());
+        bias_softmax.setArg(2, batch_size);
+        bias_softmax.setArg(3, w2.cols);
+        finish_cl_queue();
+    }
+
+    InferencePlan(const InferencePlan &) = delete;
+    InferencePlan &operator=(const InferencePlan &) = delete;
+
+    uint batch_size() const
+    {
+        return input_matrix.rows;
+    }
+
+    // Host-side input of the next replay, batch_size() x input columns
+    float *input()
+    {
+        return input_matrix.raw_data();
+    }
+
+    // Enqueues a pass over the current input and returns the event of the
+    // readback, after which result() holds the class probabilities
+    const cl::Event &enqueue()
+    {
+        // matmul_kernel accumulates into its output
+        HANDLE.q.enqueueFillBuffer(hidden.get_buffer(), 0.f, 0, sizeof(float) * hidden.rows * hidden.cols, NULL, &inputs_ready[0]);
+        HANDLE.q.enqueueFillBuffer(output.get_buffer(), 0.f, 0, sizeof(float) * output.rows * output.cols, NULL, &inputs_ready[1]);
+        HANDLE.q.enqueueMigrateMemObjects(input_buffers, 0, NULL, &inputs_ready[2]);
+
+        HANDLE.q.enqueueTask(matmul1, &inputs_ready, &matmul1_done[0]);
+        HANDLE.q.enqueueTask(bias_relu6, &matmul1_done, &bias_relu6_done[0]);
+        HANDLE.q.enqueueTask(matmul2, &bias_relu6_done, &matmul2_done[0]);
+        HANDLE.q.enqueueTask(bias_softmax, &matmul2_done, &bias_softmax_done[0]);
+        HANDLE.q.enqueueMigrateMemObjects(output_buffers, CL_MIGRATE_MEM_OBJECT_HOST, &bias_softmax_done, &readback);
+        return readback;
+    }
+
+    Matrix &result()
+    {
+        return output;
+    }
+
+    // Replays the plan on `input` (batch_size() rows) and waits for the result
+    Matrix &run(const float *input)
+    {
+        memcpy(input_matrix.raw_data(), input, sizeof(float) * input_matrix.rows * input_matrix.cols);
+        enqueue().wait();
+        return output;
+    }
+};
+
+#endif /* end of include guard: NNONFPGA_PLAN */
@@ -0,0 +1,101 @@
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "cli.hpp"
+#include "matrix.hpp"
+#include "net.hpp"
+#include "persistent.hpp"
+#include "plan.hpp"
+#include "stats.hpp"
+#include "utils.hpp"
+#include "xcl2.hpp"
+
+// Host-side cost of issuing one inference with FCNN::submit against replaying
+// a captured InferencePlan and against handing the batch to the persistent
+// kernel, all starting from input in a host array. "issue" is the time until
+// all commands are enqueued, "total" includes waiting for the result.
+//
+// Usage: plan_bench [--weights DIR] [--batch-sizes 1,16,256] [--repeats 200]
+int main(int argc, const char *argv[])
+{
+  const CliArgs args(argc, argv);
+  const auto batch_sizes = args.get_uint_list("batch-sizes", {1, 16, 256});
+  const uint repeats = args.get_uint("repeats", 200);
+
+  init_kernels();
+  FCNN model(args.get("weights", "../weights"));
+  finish_cl_queue();
+
+  typedef std::chrono::steady_clock clock;
+  auto us_since = [](const clock::time_point &start) {
+    return std::chrono::duration<double, std::micro>(clock::now() - start).count();
+  };
+
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << std::setw(8) << "batch" << std::setw(10) << "api"
+            << std::setw(12) << "issue us" << std::setw(12) << "total us" << std::endl;
+  for (const uint batch_size : batch_sizes)
+  {
+    const Matrix samples = Matrix::random(batch_size, model.shape()[0]);
+    std::vector<double> issue, total;
+
+    // First round is a warmup
+    for (uint r = 0; r <= repeats; r++)
+    {
+      const auto start = clock::now();
+      Matrix input = samples.slice_rows(0, batch_size);
+      input.to_device(HANDLE, bank_for(ROLE_INPUT));
+      auto request = model.submit(input);
+      const double issued = us_since(start);
+      request.wait();
+      if (r > 0)
+      {
+        issue.push_back(issued);
+        total.push_back(us_since(start));
+      }
+    }
+    std::cout << std::setw(8) << batch_size << std::setw(10) << "submit"
+              << std::setw(12) << median(issue) << std::setw(12) << median(total) << std::endl;
+
+    InferencePlan plan(model, batch_size);
+    issue.clear();
+    total.clear();
+    for (uint r = 0; r <= repeats; r++)
+    {
+      const auto start = clock::now();
+      memcpy(plan.input(), const_cast<Matrix &>(samples).raw_data(), sizeof(float) * samples.rows * samples.cols);
+      const cl::Event &done = plan.enqueue();
+      const double issued = us_since(start);
+      done.wait();
+      if (r > 0)
+      {
+        issue.push_back(issued);
+        total.push_back(us_since(start));
+      }
+    }
+    std::cout << std::setw(8) << batch_size << std::setw(10) << "plan"
+              << std::setw(12) << median(issue) << std::setw(12) << median(total) << std::endl;
+
+    PersistentRunner runner(model, batch_size);
+    std::vector<float> probabilities(batch_size * model.shape()[2]);
+    issue.clear();
+    total.clear();
+    for (uint r = 0; r <= repeats; r++)
+    {
+      const auto start = clock::now();
+      const uint ticket = runner.submit(const_cast<Matrix &>(samples).raw_data(), batch_size);
+      const double issued = us_since(start);
+      runner.wait(ticket, probabilities.data());
+      if (r > 0)
+      {
+        issue.push_back(issued);
+        total.push_back(us_since(start));
+      }
+    }
+    std::cout << std::setw(8) << batch_size << std::setw(10) << "persist"
+              << std::setw(12) << median(issue) << std::setw(12) << median(total) << std::endl;
+  }
+}
@@ -0,0 +1,114 @@
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "bf16_net.hpp"
+#include "cli.hpp"
+#include "matrix.hpp"
+#include "net.hpp"
+#include "scheduler.hpp"
+#include "utils.hpp"
+#include "xcl2.hpp"
+
+// Accuracy and throughput of the bfloat16 network (bf16_net.hpp) against the
+// FP32 one with the same weights. Accuracy compares the class probabilities
+// on `--samples`; throughput is measured from the input migration to the
+// result being back on the host, with inputs already in each network's
+// storage format.
+//
+// Usage: precision_bench [--weights DIR] [--samples FILE]
+//                        [--batch-sizes 1,16,256] [--repeats 50]
+
+uint argmax_row(Matrix &m, const uint row)
+{
+  uint best = 0;
+  for (uint j = 1; j < m.cols; j++)
+  {
+    best = m(row, j) > m(row, best) ? j : best;
+  }
+  return best;
+}
+
+int main(int argc, const char *argv[])
+{
+  const CliArgs args(argc, argv);
+  const std::string weights = args.get("weights", "../weights");
+  const auto batch_sizes = args.get_uint_list("batch-sizes", {1, 16, 256});
+  const uint repeats = args.get_uint("repeats", 50);
+
+  init_kernels();
+  FCNN model(weights);
+  Bf16FCNN half_model(model);
+  Matrix samples = Matrix::from_npy(args.get("samples", weights + "/samples.npy"));
+  finish_cl_queue();
+  if (xcl::is_emulation())
+  {
+    std::cerr << "WARNING: Running in emulation, throughput is not representative" << std::endl;
+  }
+
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << "weights: fp32 " << model.device_bytes() / 1024. << "KB, bf16 "
+            << half_model.device_bytes() / 1024. << "KB" << std::endl;
+
+  Matrix input = samples.slice_rows(0, samples.rows);
+  input.to_device(HANDLE, bank_for(ROLE_INPUT));
+  Matrix expected = model(input);
+  Bf16Matrix half_input = Bf16Matrix::from_float(samples);
+  half_input.to_device(HANDLE, bank_for(ROLE_INPUT));
+  Matrix result = half_model(half_input);
+  finish_cl_queue();
+  expected.to_cpu();
+  result.to_cpu();
+  finish_cl_queue();
+
+  uint agree = 0;
+  double max_error = 0., sum_error = 0.;
+  for (uint i = 0; i < samples.rows; i++)
+  {
+    agree += argmax_row(expected, i) == argmax_row(result, i);
+    for (uint j = 0; j < expected.cols; j++)
+    {
+      const double error = std::fabs(expected(i, j) - result(i, j));
+      max_error = std::max(max_error, error);
+      sum_error += error;
+    }
+  }
+  std::cout << std::setprecision(6);
+  std::cout << "accuracy over " << samples.rows << " samples: top-1 agreement "
+            << 100. * agree / samples.rows << "%, max abs error " << max_error
+            << ", mean abs error " << sum_error / (samples.rows * expected.cols) << std::endl;
+
+  std::cout << std::endl << std::setprecision(1);
+  std::cout << std::setw(8) << "batch" << std::setw(8) << "type"
+            << std::setw(12) << "median us" << std::setw(14) << "samples/s" << std::endl;
+  for (const uint batch_size : batch_sizes)
+  {
+    Matrix batch = Matrix::random(batch_size, model.shape()[0]);
+    Bf16Matrix half_batch = Bf16Matrix::from_float(batch);
+
+    const double fp32_us = median_us(repeats, [&]() {
+      std::vector<cl::Event> migrated(1);
+      batch.to_device(HANDLE, bank_for(ROLE_INPUT), &migrated[0]);
+      Matrix y = Matrix::constant(batch_size, model.shape()[2], 0.0);
+      y.to_device(HANDLE, bank_for(ROLE_OUTPUT));
+      const std::vector<cl::Event> done = {model.forward(batch, y, NULL, &migrated)};
+      y.to_cpu(HANDLE, &done);
+      finish_cl_queue();
+    });
+    const double bf16_us = median_us(repeats, [&]() {
+      std::vector<cl::Event> migrated(1);
+      half_batch.to_device(HANDLE, bank_for(ROLE_INPUT), &migrated[0]);
+      Matrix y = Matrix::constant(batch_size, model.shape()[2], 0.0);
+      y.to_device(HANDLE, bank_for(ROLE_OUTPUT));
+      const std::vector<cl::Event> done = {half_model.forward(half_batch, y, NULL, &migrated)};
+      y.to_cpu(HANDLE, &done);
+      finish_cl_queue();
+    });
+    std::cout << std::setw(8) << batch_size << std::setw(8) << "fp32" << std::setw(12) << fp32_us
+              << std::setw(14) << batch_size / fp32_us * 1e6 << std::endl;
+    std::cout << std::setw(8) << batch_size << std::setw(8) << "bf16" << std::setw(12) << bf16_us
+              << std::setw(14) << batch_size / bf16_us * 1e6 << std::endl;
+  }
+}
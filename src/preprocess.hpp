@@ -0,0 +1,347 @@
+#ifndef NNONFPGA_PREPROCESS
+#define NNONFPGA_PREPROCESS
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <climits>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "matrix.hpp"
+#include "metrics.hpp"
+
+// Turns raw grayscale images into model input rows: decodes PGM (P2/P5, 8 or
+// 16 bit) or headerless 8-bit buffers, resamples them to 28x28 and
+// normalizes to [0, 1] like train.py. A batch is written straight into the
+// rows of a page-aligned Matrix by a pool of worker threads, so the next
+// batch can be prepared while the device works on the current one:
+//
+//     Preprocessor preprocessor(4);
+//     auto next = preprocessor.submit(images);
+//     ...
+//     Matrix batch = next.get();
+//     batch.to_device(HANDLE, bank_for(ROLE_INPUT));
+//
+// Preprocessing time is exported apart from inference, as
+// fcnn_preprocess_batch_seconds (submit until the batch is ready) and
+// fcnn_preprocess_images_total.
+
+static const uint MODEL_IMAGE_SIZE = 28;
+// Largest width or height accepted from an image header
+static const uint MAX_IMAGE_SIZE = 16384;
+
+// Encoded image as handed to us. `width` and `height` are only used for raw
+// buffers, PGM carries its own.
+struct EncodedImage
+{
+    enum Format
+    {
+        PGM,
+        RAW
+    };
+
+    Format format;
+    std::vector<uint8_t> bytes;
+    uint width, height;
+
+    static EncodedImage pgm(std::vector<uint8_t> bytes)
+    {
+        return {PGM, std::move(bytes), 0, 0};
+    }
+
+    static EncodedImage raw(std::vector<uint8_t> bytes, const uint width, const uint height)
+    {
+        return {RAW, std::move(bytes), width, height};
+    }
+};
+
+// Decoded pixels in [0, 1], row-major
+struct GrayImage
+{
+    uint width, height;
+    std::vector<float> pixels;
+};
+
+namespace detail
+{
+    // Next whitespace-separated PGM token, skipping `#` comments
+    inline uint pgm_number(const std::vector<uint8_t> &bytes, std::size_t &pos)
+    {
+        while (pos < bytes.size() && (std::isspace(bytes[pos]) || bytes[pos] == '#'))
+        {
+            if (bytes[pos] == '#')
+            {
+                while (pos < bytes.size() && bytes[pos] != '\n')
+                {
+                    pos++;
+                }
+            }
+            else
+            {
+                pos++;
+            }
+        }
+        if (pos >= bytes.size() || !std::isdigit(bytes[pos]))
+        {
+            throw std::runtime_error("Malformed PGM header");
+        }
+        uint value = 0;
+        while (pos < bytes.size() && std::isdigit(bytes[pos]))
+        {
+            const uint digit = bytes[pos++] - '0';
+            if (value > (UINT_MAX - digit) / 10)
+            {
+                throw std::runtime_error("PGM number out of range");
+            }
+            value = value * 10 + digit;
+        }
+        return value;
+    }
+} // namespace detail
+
+inline GrayImage decode_pgm(const std::vector<uint8_t> &bytes)
+{
+    if (bytes.size() < 2 || bytes[0] != 'P' || (bytes[1] != '2' && bytes[1] != '5'))
+    {
+        throw std::runtime_error("Not a PGM image");
+    }
+    const bool binary = bytes[1] == '5';
+    std::size_t pos = 2;
+    GrayImage image;
+    image.width = detail::pgm_number(bytes, pos);
+    image.height = detail::pgm_number(bytes, pos);
+    const uint max_value = detail::pgm_number(bytes, pos);
+    if (image.width == 0 || image.height == 0 || image.width > MAX_IMAGE_SIZE || image.height > MAX_IMAGE_SIZE ||
+        max_value == 0 || max_value > 65535)
+    {
+        throw std::runtime_error("Unsupported PGM dimensions or maximum value");
+    }
+    const std::size_t count = static_cast<std::size_t>(image.width) * image.height;
+    const float scale = 1.f / max_value;
+    // Checked before allocating, so that a header alone can't claim gigabytes.
+    // ASCII pixels take at least a digit and a separator each.
+    const std::size_t remaining = bytes.size() - std::min(bytes.size(), pos + 1);
+    const uint bytes_per_pixel = max_value < 256 ? 1 : 2;
+    if (binary ? remaining < count * bytes_per_pixel : remaining + 1 < 2 * count)
+    {
+        throw std::runtime_error("Truncated PGM image");
+    }
+    image.pixels.resize(count);
+
+    if (!binary)
+    {
+        for (std::size_t i = 0; i < count; i++)
+        {
+            image.pixels[i] = detail::pgm_number(bytes, pos) * scale;
+        }
+        return image;
+    }
+    // A single whitespace separates the header from the pixels
+    pos++;
+    const uint8_t *data = bytes.data() + pos;
+    for (std::size_t i = 0; i < count; i++)
+    {
+        // 16-bit samples are big-endian
+        const uint value = bytes_per_pixel == 1 ? data[i] : (data[2 * i] << 8) | data[2 * i + 1];
+        image.pixels[i] = value * scale;
+    }
+    return image;
+}
+
+inline GrayImage decode_raw(const std::vector<uint8_t> &bytes, const uint width, const uint height)
+{
+    if (width == 0 || height == 0 || width > MAX_IMAGE_SIZE || height > MAX_IMAGE_SIZE || bytes.size() < static_cast<std::size_t>(width) * height)
+    {
+        throw std::runtime_error("Raw image has fewer than width * height bytes");
+    }
+    GrayImage image = {width, height, std::vector<float>(static_cast<std::size_t>(width) * height)};
+    for (std::size_t i = 0; i < image.pixels.size(); i++)
+    {
+        image.pixels[i] = bytes[i] * (1.f / 255.f);
+    }
+    return image;
+}
+
+inline GrayImage decode(const EncodedImage &image)
+{
+    return image.format == EncodedImage::PGM ? decode_pgm(image.bytes) : decode_raw(image.bytes, image.width, image.height);
+}
+
+// Area resampling: every output pixel is the mean of the source area it
+// covers, weighted by coverage. Averages when shrinking and replicates when
+// enlarging, with no aliasing from skipped pixels either way.
+inline void resize_into(const GrayImage &image, float *out, const uint width = MODEL_IMAGE_SIZE, const uint height = MODEL_IMAGE_SIZE)
+{
+    const float scale_x = static_cast<float>(image.width) / width, scale_y = static_cast<float>(image.height) / height;
+    for (uint oy = 0; oy < height; oy++)
+    {
+        const float y0 = oy * scale_y, y1 = y0 + scale_y;
+        for (uint ox = 0; ox < width; ox++)
+        {
+            const float x0 = ox * scale_x, x1 = x0 + scale_x;
+            float sum = 0.f;
+            for (uint sy = static_cast<uint>(y0); sy < std::min(static_cast<uint>(std::ceil(y1)), image.height); sy++)
+            {
+                const float wy = std::min(y1, sy + 1.f) - std::max(y0, static_cast<float>(sy));
+                const float *row = image.pixels.data() + static_cast<std::size_t>(sy) * image.width;
+                for (uint sx = static_cast<uint>(x0); sx < std::min(static_cast<uint>(std::ceil(x1)), image.width); sx++)
+                {
+                    const float wx = std::min(x1, sx + 1.f) - std::max(x0, static_cast<float>(sx));
+                    sum += wx * wy * row[sx];
+                }
+            }
+            out[oy * width + ox] = sum / (scale_x * scale_y);
+        }
+    }
+}
+
+// Fixed pool of worker threads preparing batches. Images of a batch are
+// spread over the workers, each writing its rows in place.
+class Preprocessor
+{
+private:
+    struct Batch
+    {
+        std::vector<EncodedImage> images;
+        Matrix output;
+        std::size_t next, done;
+        bool invert;
+        std::string error;
+        std::chrono::steady_clock::time_point submitted;
+        std::promise<Matrix> result;
+    };
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable work_available;
+    std::vector<std::shared_ptr<Batch>> queue;
+    bool stopping;
+    Counter &images_total;
+    Histogram &batch_time;
+
+    void work()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            work_available.wait(lock, [this]() { return stopping || !queue.empty(); });
+            if (queue.empty())
+            {
+                return;
+            }
+            std::shared_ptr<Batch> batch = queue.front();
+            const std::size_t index = batch->next++;
+            if (batch->next == batch->images.size())
+            {
+                queue.erase(queue.begin());
+            }
+            lock.unlock();
+
+            std::string error;
+            try
+            {
+                float *row = batch->output.raw_data() + index * MODEL_IMAGE_SIZE * MODEL_IMAGE_SIZE;
+                resize_into(decode(batch->images[index]), row);
+                if (batch->invert)
+                {
+                    for (uint i = 0; i < MODEL_IMAGE_SIZE * MODEL_IMAGE_SIZE; i++)
+                    {
+                        row[i] = 1.f - row[i];
+                    }
+                }
+            }
+            catch (const std::exception &e)
+            {
+                error = "Image " + std::to_string(index) + ": " + e.what();
+            }
+
+            lock.lock();
+            if (!error.empty() && batch->error.empty())
+            {
+                batch->error = error;
+            }
+            if (++batch->done == batch->images.size())
+            {
+                images_total.add(batch->images.size());
+                batch_time.record_ns(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - batch->submitted).count());
+                if (batch->error.empty())
+                {
+                    batch->result.set_value(std::move(batch->output));
+                }
+                else
+                {
+                    batch->result.set_exception(std::make_exception_ptr(std::runtime_error(batch->error)));
+                }
+            }
+        }
+    }
+
+public:
+    explicit Preprocessor(const uint threads = std::max(1u, std::thread::hardware_concurrency() / 2)) : stopping(false),
+          images_total(METRICS.counter("fcnn_preprocess_images_total", "Images decoded, resized and normalized on the host")),
+          batch_time(METRICS.histogram("fcnn_preprocess_batch_seconds", "Time from submitting a batch for preprocessing until its rows are ready"))
+    {
+        for (uint i = 0; i < std::max(threads, 1u); i++)
+        {
+            workers.push_back(std::thread(&Preprocessor::work, this));
+        }
+    }
+
+    Preprocessor(const Preprocessor &) = delete;
+    Preprocessor &operator=(const Preprocessor &) = delete;
+
+    // Finishes the batches already submitted
+    ~Preprocessor()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        work_available.notify_all();
+        for (auto &worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    uint num_threads() const
+    {
+        return workers.size();
+    }
+
+    // Batch of one 784-column row per image. `invert` turns dark digits on a
+    // light background into MNIST's light on dark. The future throws if an
+    // image can't be decoded.
+    std::future<Matrix> submit(std::vector<EncodedImage> images, const bool invert = false)
+    {
+        auto batch = std::make_shared<Batch>();
+        batch->output = Matrix(images.size(), MODEL_IMAGE_SIZE * MODEL_IMAGE_SIZE);
+        batch->images = std::move(images);
+        batch->next = 0;
+        batch->done = 0;
+        batch->invert = invert;
+        batch->submitted = std::chrono::steady_clock::now();
+        std::future<Matrix> result = batch->result.get_future();
+        if (batch->images.empty())
+        {
+            batch->result.set_value(std::move(batch->output));
+            return result;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(batch);
+        }
+        work_available.notify_all();
+        return result;
+    }
+};
+
+#endif /* end of include guard: NNONFPGA_PREPROCESS */
@@ -0,0 +1,186 @@
+#include <chrono>
+#include <fstream>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "cli.hpp"
+#include "matrix.hpp"
+#include "net.hpp"
+#include "preprocess.hpp"
+#include "utils.hpp"
+
+// Throughput of the host preprocessing pipeline (preprocess.hpp) on its own,
+// of inference on already prepared batches, and of both together, once one
+// after the other and once with batch i+1 being prepared while the device
+// works on batch i.
+//
+// Without image files, `--count` synthetic images are generated, alternating
+// between binary PGM and raw 8-bit buffers of random sizes up to
+// `--max-side` pixels. Given PGM files, the predicted class of each one is
+// printed as well.
+//
+// Usage: preprocess_bench [--weights DIR] [--batch-size 256] [--threads N]
+//                         [--count 8192] [--max-side 256] [--invert] [FILE.pgm ...]
+
+typedef std::chrono::steady_clock bench_clock;
+
+double seconds_since(const bench_clock::time_point start)
+{
+  return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+std::vector<EncodedImage> synthetic_images(const uint count, const uint max_side)
+{
+  std::mt19937 rng(1);
+  std::uniform_int_distribution<uint> side(8, std::max(max_side, 8u)), value(0, 255);
+  std::vector<EncodedImage> images;
+  for (uint i = 0; i < count; i++)
+  {
+    const uint width = side(rng), height = side(rng);
+    std::vector<uint8_t> pixels(width * height);
+    for (auto &pixel : pixels)
+    {
+      pixel = value(rng);
+    }
+    if (i % 2 == 0)
+    {
+      images.push_back(EncodedImage::raw(std::move(pixels), width, height));
+      continue;
+    }
+    const std::string header = "P5\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+    std::vector<uint8_t> bytes(header.begin(), header.end());
+    bytes.insert(bytes.end(), pixels.begin(), pixels.end());
+    images.push_back(EncodedImage::pgm(std::move(bytes)));
+  }
+  return images;
+}
+
+std::vector<EncodedImage> read_images(const std::vector<std::string> &paths)
+{
+  std::vector<EncodedImage> images;
+  for (const auto &path : paths)
+  {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+      throw std::runtime_error("Can't open " + path);
+    }
+    images.push_back(EncodedImage::pgm(std::vector<uint8_t>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>())));
+  }
+  return images;
+}
+
+void print_row(const std::string &stage, const uint images, const double seconds)
+{
+  std::cout << std::setw(28) << stage << std::setw(12) << seconds * 1e3 << std::setw(14) << images / seconds << std::endl;
+}
+
+int main(int argc, const char *argv[])
+{
+  const CliArgs args(argc, argv);
+  const uint batch_size = args.get_uint("batch-size", 256);
+  const bool invert = args.has("invert");
+  const std::vector<std::string> &paths = args.get_positional();
+  const std::vector<EncodedImage> images =
+      paths.empty() ? synthetic_images(args.get_uint("count", 8192), args.get_uint("max-side", 256)) : read_images(paths);
+  if (images.empty() || batch_size == 0)
+  {
+    throw std::runtime_error("Need at least one image and one image per batch");
+  }
+
+  std::vector<std::vector<EncodedImage>> batches;
+  for (uint start = 0; start < images.size(); start += batch_size)
+  {
+    batches.push_back(std::vector<EncodedImage>(images.begin() + start, images.begin() + std::min<std::size_t>(start + batch_size, images.size())));
+  }
+
+  init_kernels();
+  FCNN model(args.get("weights", "../weights"));
+  Preprocessor preprocessor(args.get_uint("threads", std::max(1u, std::thread::hardware_concurrency() / 2)));
+  finish_cl_queue();
+
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << images.size() << " images in " << batches.size() << " batches, " << preprocessor.num_threads()
+            << " preprocessing threads" << std::endl;
+  std::cout << std::setw(28) << "stage" << std::setw(12) << "ms" << std::setw(14) << "images/s" << std::endl;
+
+  // Preprocessing alone, all batches queued at once
+  std::vector<Matrix> prepared;
+  auto start = bench_clock::now();
+  {
+    std::vector<std::future<Matrix>> pending;
+    for (const auto &batch : batches)
+    {
+      pending.push_back(preprocessor.submit(batch, invert));
+    }
+    for (auto &batch : pending)
+    {
+      prepared.push_back(batch.get());
+    }
+  }
+  print_row("preprocess", images.size(), seconds_since(start));
+
+  // Inference alone on the prepared batches
+  start = bench_clock::now();
+  for (auto &batch : prepared)
+  {
+    batch.to_device(HANDLE, bank_for(ROLE_INPUT));
+    model.submit(batch).wait();
+  }
+  print_row("inference", images.size(), seconds_since(start));
+
+  // One after the other
+  start = bench_clock::now();
+  for (const auto &batch : batches)
+  {
+    Matrix input = preprocessor.submit(batch, invert).get();
+    input.to_device(HANDLE, bank_for(ROLE_INPUT));
+    model.submit(input).wait();
+  }
+  print_row("preprocess + inference", images.size(), seconds_since(start));
+
+  // Overlapped: the next batch is prepared while the device runs this one.
+  // Waiting time on the preprocessor is what the overlap couldn't hide.
+  std::vector<uint> predictions;
+  double preprocess_wait = 0.;
+  start = bench_clock::now();
+  {
+    std::future<Matrix> next = preprocessor.submit(batches[0], invert);
+    for (uint i = 0; i < batches.size(); i++)
+    {
+      const auto wait_start = bench_clock::now();
+      Matrix input = next.get();
+      preprocess_wait += seconds_since(wait_start);
+      input.to_device(HANDLE, bank_for(ROLE_INPUT));
+      InferenceHandle request = model.submit(input);
+      HANDLE.q.flush();
+      if (i + 1 < batches.size())
+      {
+        next = preprocessor.submit(batches[i + 1], invert);
+      }
+      Matrix &result = request.wait();
+      for (uint row = 0; row < result.rows; row++)
+      {
+        uint best = 0;
+        for (uint col = 1; col < result.cols; col++)
+        {
+          best = result(row, col) > result(row, best) ? col : best;
+        }
+        predictions.push_back(best);
+      }
+    }
+  }
+  print_row("overlapped", images.size(), seconds_since(start));
+  std::cout << "Waited " << preprocess_wait * 1e3 << "ms for preprocessing while overlapped" << std::endl;
+
+  for (uint i = 0; i < paths.size(); i++)
+  {
+    std::cout << paths[i] << ": " << predictions[i] << std::endl;
+  }
+}
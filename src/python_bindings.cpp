@@ -0,0 +1,117 @@
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+#include "matrix.hpp"
+#include "net.hpp"
+#include "utils.hpp"
+#include "xcl2.hpp"
+
+namespace py = pybind11;
+
+// Python bindings for the FCNN runtime. NumPy arrays that are float32,
+// C-contiguous and page-aligned (e.g. from fcnn.empty_aligned) are used as
+// Matrix storage directly; anything else is copied once into aligned memory.
+// Device work runs with the GIL released.
+
+static bool is_zero_copy_compatible(const py::array &array)
+{
+    return array.ndim() == 2 && array.dtype().is(py::dtype::of<float>()) &&
+           (array.flags() & py::array::c_style) &&
+           reinterpret_cast<std::uintptr_t>(array.data()) % DEFAULT_ALIGNMENT == 0;
+}
+
+static Matrix copy_from_array(const py::array &array)
+{
+    const auto contiguous = py::array_t<float, py::array::c_style | py::array::forcecast>::ensure(array);
+    if (!contiguous || contiguous.ndim() != 2)
+    {
+        throw std::invalid_argument("Expected a 2D float array");
+    }
+    Matrix result(contiguous.shape(0), contiguous.shape(1));
+    memcpy(result.raw_data(), contiguous.data(), sizeof(float) * result.rows * result.cols);
+    return result;
+}
+
+// Wraps `array` if possible, the caller has to keep it alive in that case
+static Matrix matrix_from_array(const py::array &array)
+{
+    if (is_zero_copy_compatible(array))
+    {
+        return Matrix::wrap(static_cast<float *>(const_cast<void *>(array.data())), array.shape(0), array.shape(1));
+    }
+    return copy_from_array(array);
+}
+
+// NumPy view on a heap-allocated matrix, which is freed with the array
+static py::array_t<float> array_from_matrix(Matrix &&matrix)
+{
+    Matrix *owned = new Matrix(std::move(matrix));
+    py::capsule free_when_done(owned, [](void *ptr) { delete static_cast<Matrix *>(ptr); });
+    return py::array_t<float>({owned->rows, owned->cols}, owned->raw_data(), free_when_done);
+}
+
+static py::array_t<float> run_inference(FCNN &model, const py::array &input)
+{
+    Matrix x = matrix_from_array(input);
+    Matrix result;
+    {
+        py::gil_scoped_release release;
+        std::vector<cl::Event> migrations(2);
+        x.to_device(HANDLE, bank_for(ROLE_INPUT), &migrations[0]);
+        Matrix y = Matrix::constant(x.rows, model.shape()[2], 0.0);
+        y.to_device(HANDLE, bank_for(ROLE_OUTPUT), &migrations[1]);
+        auto request = model.submit_into(x, std::move(y), &migrations);
+        result = std::move(request.wait());
+    }
+    return array_from_matrix(std::move(result));
+}
+
+PYBIND11_MODULE(fcnn, m)
+{
+    m.doc() = "FPGA inference runtime for the MNIST FCNN";
+
+    m.def("init", &init_kernels, py::arg("binary") = KERNELS_BIN,
+          "Programs the device with the given xclbin and sets up the kernels");
+    m.def("finish", &finish_cl_queue, py::call_guard<py::gil_scoped_release>(),
+          "Blocks until all enqueued device work finished");
+
+    py::class_<DeviceHandle>(m, "DeviceHandle")
+        .def_property_readonly("name", [](const DeviceHandle &handle) { return handle.device.getInfo<CL_DEVICE_NAME>(); })
+        .def("finish", [](DeviceHandle &handle) { handle.q.finish(); }, py::call_guard<py::gil_scoped_release>());
+    m.def("device", []() -> DeviceHandle & { return HANDLE; }, py::return_value_policy::reference,
+          "Handle of the device set up by init()");
+
+    m.def("empty_aligned", [](const uint rows, const uint cols) { return array_from_matrix(Matrix(rows, cols)); },
+          py::arg("rows"), py::arg("cols"),
+          "Uninitialized float32 array on page-aligned memory, which the runtime uses without copying");
+
+    py::class_<Matrix>(m, "Matrix")
+        .def(py::init(&matrix_from_array), py::keep_alive<1, 2>(), py::arg("array"),
+             "Wraps `array` without copying if it is float32, C-contiguous and page-aligned, copies it otherwise")
+        .def_readonly("rows", &Matrix::rows)
+        .def_readonly("cols", &Matrix::cols)
+        .def("to_device", [](Matrix &matrix) { matrix.to_device(); }, py::call_guard<py::gil_scoped_release>())
+        .def("to_cpu", [](Matrix &matrix) { matrix.to_cpu(); }, py::call_guard<py::gil_scoped_release>())
+        .def("numpy", [](py::object self) {
+                 Matrix &matrix = self.cast<Matrix &>();
+                 return py::array_t<float>({matrix.rows, matrix.cols}, matrix.raw_data(), self);
+             },
+             "View on the host-side data, valid as long as the Matrix lives");
+
+    py::class_<FCNN>(m, "FCNN")
+        .def(py::init<const std::string &>(), py::arg("weights_dir"),
+             "Loads w1.npy, b1.npy, w2.npy and b2.npy from `weights_dir`")
+        .def(py::init([](const py::array &w1, const py::array &b1, const py::array &w2, const py::array &b2) {
+                 return new FCNN(copy_from_array(w1), copy_from_array(b1), copy_from_array(w2), copy_from_array(b2));
+             }),
+             py::arg("w1"), py::arg("b1"), py::arg("w2"), py::arg("b2"),
+             "Uploads weights given as arrays, e.g. straight from the training loop")
+        .def_property_readonly("shape", &FCNN::shape)
+        .def("__call__", &run_inference, py::arg("input"),
+             "Class probabilities for a batch of flattened images");
+}
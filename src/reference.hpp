@@ -0,0 +1,151 @@
+#ifndef NNONFPGA_REFERENCE
+#define NNONFPGA_REFERENCE
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "conv.hpp"
+#include "matrix.hpp"
+
+// Straightforward host implementations of the kernels for correctness tests
+
+Matrix conv_relu6_reference(Matrix &input, Matrix &weights, Matrix &bias, const ConvShape &shape)
+{
+    const uint K = CONV_KERNEL_SIZE;
+    Matrix conv(input.rows, shape.filters * shape.conv_height() * shape.conv_width());
+    for (uint b = 0; b < input.rows; b++)
+    {
+        for (uint f = 0; f < shape.filters; f++)
+        {
+            for (uint oy = 0; oy < shape.conv_height(); oy++)
+            {
+                for (uint ox = 0; ox < shape.conv_width(); ox++)
+                {
+                    float acc = bias(f, 0);
+                    for (uint c = 0; c < shape.channels; c++)
+                    {
+                        for (uint ky = 0; ky < K; ky++)
+                        {
+                            for (uint kx = 0; kx < K; kx++)
+                            {
+                                const uint in_idx = (c * shape.height + oy + ky) * shape.width + ox + kx;
+                                acc += weights(f, (c * K + ky) * K + kx) * input(b, in_idx);
+                            }
+                        }
+                    }
+                    conv(b, (f * shape.conv_height() + oy) * shape.conv_width() + ox) = std::min(std::max(acc, 0.f), 6.f);
+                }
+            }
+        }
+    }
+
+    if (!shape.pool)
+    {
+        return conv;
+    }
+
+    Matrix pooled(input.rows, shape.output_size());
+    for (uint b = 0; b < input.rows; b++)
+    {
+        for (uint f = 0; f < shape.filters; f++)
+        {
+            for (uint py = 0; py < shape.out_height(); py++)
+            {
+                for (uint px = 0; px < shape.out_width(); px++)
+                {
+                    float value = 0.f;
+                    for (uint dy = 0; dy < 2; dy++)
+                    {
+                        for (uint dx = 0; dx < 2; dx++)
+                        {
+                            const uint idx = (f * shape.conv_height() + 2 * py + dy) * shape.conv_width() + 2 * px + dx;
+                            value = std::max(value, conv(b, idx));
+                        }
+                    }
+                    pooled(b, (f * shape.out_height() + py) * shape.out_width() + px) = value;
+                }
+            }
+        }
+    }
+    return pooled;
+}
+
+// One SGD step of the FCNN on `input` with class indices `labels`, like
+// Trainer::step. Updates the weights in place and returns the loss.
+float fcnn_sgd_step_reference(Matrix &w1, Matrix &b1, Matrix &w2, Matrix &b2, Matrix &input, const uint *labels, const float learning_rate)
+{
+    const uint batch = input.rows, in = w1.rows, hidden = w1.cols, classes = w2.cols;
+    std::vector<float> h(batch * hidden), dy(batch * classes), dh(batch * hidden, 0.f);
+    float loss = 0.f;
+    for (uint b = 0; b < batch; b++)
+    {
+        for (uint j = 0; j < hidden; j++)
+        {
+            float acc = b1.raw_data()[j];
+            for (uint k = 0; k < in; k++)
+            {
+                acc += input(b, k) * w1(k, j);
+            }
+            h[b * hidden + j] = std::min(std::max(acc, 0.f), 6.f);
+        }
+        float max_logit = -INFINITY;
+        for (uint c = 0; c < classes; c++)
+        {
+            float acc = b2.raw_data()[c];
+            for (uint j = 0; j < hidden; j++)
+            {
+                acc += h[b * hidden + j] * w2(j, c);
+            }
+            dy[b * classes + c] = acc;
+            max_logit = std::max(max_logit, acc);
+        }
+        float total = 0.f;
+        for (uint c = 0; c < classes; c++)
+        {
+            dy[b * classes + c] = std::exp(dy[b * classes + c] - max_logit);
+            total += dy[b * classes + c];
+        }
+        for (uint c = 0; c < classes; c++)
+        {
+            const float p = dy[b * classes + c] / total;
+            if (c == labels[b])
+            {
+                loss -= std::log(p) / batch;
+            }
+            dy[b * classes + c] = (p - (c == labels[b] ? 1.f : 0.f)) / batch;
+        }
+        for (uint j = 0; j < hidden; j++)
+        {
+            const float a = h[b * hidden + j];
+            for (uint c = 0; a > 0.f && a < 6.f && c < classes; c++)
+            {
+                dh[b * hidden + j] += dy[b * classes + c] * w2(j, c);
+            }
+        }
+    }
+
+    for (uint b = 0; b < batch; b++)
+    {
+        for (uint c = 0; c < classes; c++)
+        {
+            const float g = dy[b * classes + c];
+            b2.raw_data()[c] -= learning_rate * g;
+            for (uint j = 0; j < hidden; j++)
+            {
+                w2(j, c) -= learning_rate * h[b * hidden + j] * g;
+            }
+        }
+        for (uint j = 0; j < hidden; j++)
+        {
+            const float g = dh[b * hidden + j];
+            b1.raw_data()[j] -= learning_rate * g;
+            for (uint k = 0; k < in; k++)
+            {
+                w1(k, j) -= learning_rate * input(b, k) * g;
+            }
+        }
+    }
+    return loss;
+}
+
+#endif /* end of include guard: NNONFPGA_REFERENCE */
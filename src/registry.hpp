@@ -0,0 +1,249 @@
+#ifndef NNONFPGA_REGISTRY
+#define NNONFPGA_REGISTRY
+
+#include <chrono>
+#include <functional>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "metrics.hpp"
+#include "net.hpp"
+#include "utils.hpp"
+
+// Many weight sets of the same architecture, e.g. A/B variants or per-customer
+// fine-tunes, registered by name and loaded on first use. Loaded models stay
+// resident in device memory as long as they fit into the budget; beyond that,
+// the least recently used ones that nobody holds are evicted and reloaded the
+// next time they are asked for. Loads run on a thread of their own, so a miss
+// doesn't stall requests for other models.
+//
+// Hits, misses, evictions and load times are exported per model through
+// METRICS, labelled `model="<name>"`.
+
+struct ModelStats
+{
+    uint64_t hits, misses, evictions, loads;
+    double load_seconds;
+};
+
+class ModelRegistry
+{
+public:
+    typedef std::shared_ptr<FCNN> ModelPtr;
+    typedef std::function<ModelPtr()> Loader;
+
+private:
+    struct Entry
+    {
+        Loader loader;
+        ModelPtr model;
+        // Latest load, kept until the next one since dropping the last
+        // reference to an std::async state joins its thread
+        std::shared_future<void> loading;
+        // Device bytes, known after the first load
+        std::size_t bytes;
+        std::list<std::string>::iterator lru_position;
+        Counter *hits, *misses, *evictions;
+        Histogram *load_time;
+    };
+
+    std::size_t budget, resident;
+    std::mutex mutex;
+    std::map<std::string, Entry> entries;
+    // Resident models, most recently used first
+    std::list<std::string> lru;
+
+    Entry &entry(const std::string &name)
+    {
+        auto it = entries.find(name);
+        if (it == entries.end())
+        {
+            throw std::runtime_error("Unknown model " + name);
+        }
+        return it->second;
+    }
+
+    // Drops the least recently used models nobody holds until `incoming`
+    // more bytes fit into the budget, never touching `keep`
+    void evict_for(const std::size_t incoming, const std::string &keep)
+    {
+        auto it = lru.end();
+        while (resident + incoming > budget && it != lru.begin())
+        {
+            --it;
+            Entry &candidate = entries.at(*it);
+            if (*it == keep || candidate.model.use_count() > 1)
+            {
+                continue;
+            }
+            // Releasing the last reference frees the device buffers
+            candidate.model.reset();
+            candidate.evictions->add();
+            resident -= candidate.bytes;
+            it = lru.erase(it);
+        }
+    }
+
+    void load(const std::string &name)
+    {
+        Loader loader;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            Entry &e = entry(name);
+            loader = e.loader;
+            // Make room up front if the size is known from an earlier load
+            evict_for(e.bytes, name);
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        ModelPtr model = loader();
+        // Weights have to be on the device before the model is handed out.
+        // Only waits for them, other models' requests keep running.
+        model->wait_for_upload();
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        Entry &e = entry(name);
+        e.load_time->record_ns(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+        e.bytes = model->device_bytes();
+        e.model = model;
+        resident += e.bytes;
+        lru.push_front(name);
+        e.lru_position = lru.begin();
+        evict_for(0, name);
+    }
+
+    // Latest load of `e`, started unless one is in flight
+    std::shared_future<void> start_load(Entry &e, const std::string &name)
+    {
+        // A finished load without a model was evicted since, or failed
+        if (!e.loading.valid() || e.loading.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+        {
+            e.loading = std::async(std::launch::async, &ModelRegistry::load, this, name).share();
+        }
+        return e.loading;
+    }
+
+public:
+    ModelRegistry(const std::size_t budget_bytes) : budget(budget_bytes), resident(0) {}
+
+    ModelRegistry(const ModelRegistry &) = delete;
+    ModelRegistry &operator=(const ModelRegistry &) = delete;
+
+    ~ModelRegistry()
+    {
+        std::vector<std::shared_future<void>> pending;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (const auto &item : entries)
+            {
+                if (item.second.loading.valid())
+                {
+                    pending.push_back(item.second.loading);
+                }
+            }
+        }
+        for (auto &load : pending)
+        {
+            load.wait();
+        }
+    }
+
+    void add(const std::string &name, const Loader &loader)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (entries.count(name))
+        {
+            throw std::runtime_error("Model " + name + " is already registered");
+        }
+        const std::string labels = "model=\"" + name + "\"";
+        Entry &e = entries[name];
+        e.loader = loader;
+        e.bytes = 0;
+        e.hits = &METRICS.counter("fcnn_model_hits_total", "Requests for a model that was resident", labels);
+        e.misses = &METRICS.counter("fcnn_model_misses_total", "Requests for a model that had to be loaded", labels);
+        e.evictions = &METRICS.counter("fcnn_model_evictions_total", "Evictions from device memory", labels);
+        e.load_time = &METRICS.histogram("fcnn_model_load_seconds", "Time to load a model and upload its weights", labels);
+    }
+
+    // Weights from w1.npy, b1.npy, w2.npy and b2.npy in `weights_dir`
+    void add(const std::string &name, const std::string &weights_dir)
+    {
+        add(name, [weights_dir]() { return std::make_shared<FCNN>(weights_dir); });
+    }
+
+    // Starts loading `name` in the background unless it is resident. The
+    // future is ready once the load finished and rethrows its errors.
+    std::shared_future<void> prefetch(const std::string &name)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Entry &e = entry(name);
+        if (e.model)
+        {
+            std::promise<void> ready;
+            ready.set_value();
+            return ready.get_future().share();
+        }
+        return start_load(e, name);
+    }
+
+    // The model, resident on the device. Waits for it to be loaded on a miss,
+    // concurrent misses share the same load. Holding the pointer pins the
+    // model in device memory.
+    ModelPtr get(const std::string &name)
+    {
+        std::shared_future<void> pending;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            Entry &e = entry(name);
+            if (e.model)
+            {
+                e.hits->add();
+                lru.splice(lru.begin(), lru, e.lru_position);
+                return e.model;
+            }
+            e.misses->add();
+            pending = start_load(e, name);
+        }
+        while (true)
+        {
+            pending.get();
+            std::lock_guard<std::mutex> lock(mutex);
+            Entry &e = entry(name);
+            if (e.model)
+            {
+                lru.splice(lru.begin(), lru, e.lru_position);
+                return e.model;
+            }
+            // Evicted again before we got hold of it
+            pending = start_load(e, name);
+        }
+    }
+
+    bool is_resident(const std::string &name)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return static_cast<bool>(entry(name).model);
+    }
+
+    // Exceeds the budget if the models in use don't fit into it
+    std::size_t resident_bytes()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return resident;
+    }
+
+    ModelStats stats(const std::string &name)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        const Entry &e = entry(name);
+        return {e.hits->get(), e.misses->get(), e.evictions->get(), e.load_time->count(), e.load_time->sum_seconds()};
+    }
+};
+
+#endif /* end of include guard: NNONFPGA_REGISTRY */
@@ -0,0 +1,15 @@
+#include "training_kernels.hpp"
+
+extern "C" void relu6_backward_kernel(
+    const float *const activation, float *const gradient, const uint batch_size, const uint dim)
+{
+   for (uint i = 0; i < batch_size * dim; i++)
+   {
+#pragma HLS PIPELINE II = 1
+      const float a = activation[i];
+      if (a <= 0.f || a >= 6.f)
+      {
+         gradient[i] = 0.f;
+      }
+   }
+}
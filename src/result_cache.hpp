@@ -0,0 +1,265 @@
+#ifndef NNONFPGA_RESULT_CACHE
+#define NNONFPGA_RESULT_CACHE
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+#include "hash.hpp"
+#include "matrix.hpp"
+#include "metrics.hpp"
+#include "net.hpp"
+#include "utils.hpp"
+
+// Content-addressed cache of inference results, for traffic with exact
+// repeats (retries, duplicate submissions). Each row is keyed by the hash of
+// its bytes and the model version, so results of other weights are never
+// returned. Rows are looked up one by one, and only the misses of a batch go
+// to the device:
+//
+//     ResultCache cache(64 << 20, model.shape()[2]);
+//     CacheLookup lookup = cache.lookup_rows(input, rows, cols, model.version(), output);
+//     ... run the lookup.misses rows, compacted, on the device ...
+//     cache.fill(lookup, miss_output, output);
+//
+// Entries live in `shards` independent LRU lists, each behind its own lock
+// and with an equal share of `max_bytes`. Only the 64-bit key is compared,
+// so two distinct inputs colliding would share a result; with n entries
+// that happens with a probability of about n^2 / 2^65.
+//
+// Hits and misses are exported as fcnn_cache_lookups_total. The latency
+// saved per request with hits, fcnn_cache_saved_seconds, is estimated from
+// the device latency per row of recent misses (see record_device_latency).
+
+struct CacheStats
+{
+    uint64_t hits, misses, evictions, entries;
+    // Estimated, see ResultCache::record_device_latency
+    double saved_seconds;
+
+    double hit_rate() const
+    {
+        return hits + misses > 0 ? static_cast<double>(hits) / (hits + misses) : 0.;
+    }
+};
+
+// Rows of one batch that weren't cached, in order, and the keys of all rows
+struct CacheLookup
+{
+    std::vector<uint64_t> keys;
+    std::vector<uint> misses;
+};
+
+class ResultCache
+{
+private:
+    struct Entry
+    {
+        uint64_t key;
+        std::vector<float> output;
+    };
+
+    struct Shard
+    {
+        std::mutex mutex;
+        // Most recently used first
+        std::list<Entry> entries;
+        std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+    };
+
+    // Per-entry bookkeeping on top of the output: key, list and hash nodes
+    static const std::size_t ENTRY_OVERHEAD = 96;
+
+    const uint output_cols;
+    std::size_t entries_per_shard;
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::mutex estimate_mutex;
+    double row_seconds, saved_seconds;
+    // Of this cache, the exported ones add up all caches of the process
+    Counter hits, misses, evictions;
+    Counter &hits_total, &misses_total, &evictions_total;
+    Histogram &saved;
+
+    Shard &shard_of(const uint64_t key)
+    {
+        // The low bits pick the bucket within the shard's hash map
+        return *shards[(key >> 40) % shards.size()];
+    }
+
+public:
+    ResultCache(const std::size_t max_bytes, const uint output_cols, const uint num_shards = 16)
+        : output_cols(output_cols), row_seconds(0.), saved_seconds(0.),
+          hits_total(METRICS.counter("fcnn_cache_lookups_total", "Rows looked up in the result cache", "result=\"hit\"")),
+          misses_total(METRICS.counter("fcnn_cache_lookups_total", "Rows looked up in the result cache", "result=\"miss\"")),
+          evictions_total(METRICS.counter("fcnn_cache_evictions_total", "Results evicted from the result cache")),
+          saved(METRICS.histogram("fcnn_cache_saved_seconds", "Estimated device latency saved per request with cache hits"))
+    {
+        if (num_shards == 0 || output_cols == 0)
+        {
+            throw std::runtime_error("ResultCache needs at least one shard and one output column");
+        }
+        entries_per_shard = std::max<std::size_t>(1, max_bytes / num_shards / (sizeof(float) * output_cols + ENTRY_OVERHEAD));
+        for (uint i = 0; i < num_shards; i++)
+        {
+            shards.emplace_back(new Shard());
+        }
+    }
+
+    ResultCache(const ResultCache &) = delete;
+    ResultCache &operator=(const ResultCache &) = delete;
+
+    static uint64_t key(const float *row, const uint cols, const uint64_t model_version)
+    {
+        return hash_floats(row, cols, model_version);
+    }
+
+    // Copies the cached result of `key` to `output`
+    bool lookup(const uint64_t key, float *output)
+    {
+        Shard &shard = shard_of(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        const auto it = shard.index.find(key);
+        if (it == shard.index.end())
+        {
+            return false;
+        }
+        shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+        memcpy(output, it->second->output.data(), sizeof(float) * output_cols);
+        return true;
+    }
+
+    void insert(const uint64_t key, const float *output)
+    {
+        Shard &shard = shard_of(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        const auto it = shard.index.find(key);
+        if (it != shard.index.end())
+        {
+            shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+            return;
+        }
+        if (shard.entries.size() >= entries_per_shard)
+        {
+            shard.index.erase(shard.entries.back().key);
+            shard.entries.pop_back();
+            evictions.add();
+            evictions_total.add();
+        }
+        shard.entries.push_front({key, std::vector<float>(output, output + output_cols)});
+        shard.index[key] = shard.entries.begin();
+    }
+
+    // Looks up each of the `rows` rows of `input`, copying hits into their
+    // row of `output`. The other rows are left untouched.
+    CacheLookup lookup_rows(const float *input, const uint rows, const uint cols, const uint64_t model_version, float *output)
+    {
+        CacheLookup result;
+        result.keys.resize(rows);
+        for (uint r = 0; r < rows; r++)
+        {
+            result.keys[r] = key(input + static_cast<std::size_t>(r) * cols, cols, model_version);
+            if (!lookup(result.keys[r], output + static_cast<std::size_t>(r) * output_cols))
+            {
+                result.misses.push_back(r);
+            }
+        }
+        const uint hit_rows = rows - result.misses.size();
+        hits.add(hit_rows);
+        hits_total.add(hit_rows);
+        misses.add(result.misses.size());
+        misses_total.add(result.misses.size());
+        if (hit_rows > 0)
+        {
+            std::lock_guard<std::mutex> lock(estimate_mutex);
+            saved.record_ns(static_cast<uint64_t>(hit_rows * row_seconds * 1e9));
+            saved_seconds += hit_rows * row_seconds;
+        }
+        return result;
+    }
+
+    // The rows of `input` that missed, compacted into a page-aligned matrix
+    Matrix gather_misses(const CacheLookup &lookup, const float *input, const uint cols) const
+    {
+        Matrix result(lookup.misses.size(), cols);
+        for (std::size_t i = 0; i < lookup.misses.size(); i++)
+        {
+            memcpy(result.raw_data() + i * cols, input + static_cast<std::size_t>(lookup.misses[i]) * cols, sizeof(float) * cols);
+        }
+        return result;
+    }
+
+    // Caches the results of the misses, row i of `miss_output` belonging to
+    // row lookup.misses[i], and copies them to their rows of `output` unless
+    // they were computed there in place
+    void fill(const CacheLookup &lookup, const float *miss_output, float *output)
+    {
+        for (std::size_t i = 0; i < lookup.misses.size(); i++)
+        {
+            const float *row = miss_output + i * output_cols;
+            float *target = output + static_cast<std::size_t>(lookup.misses[i]) * output_cols;
+            if (row != target)
+            {
+                memcpy(target, row, sizeof(float) * output_cols);
+            }
+            insert(lookup.keys[lookup.misses[i]], row);
+        }
+    }
+
+    // Feeds the estimate of the latency a hit saves: `seconds` for a device
+    // request of `rows` rows, averaged over recent requests
+    void record_device_latency(const double seconds, const uint rows)
+    {
+        if (rows == 0)
+        {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(estimate_mutex);
+        row_seconds = row_seconds == 0. ? seconds / rows : 0.9 * row_seconds + 0.1 * seconds / rows;
+    }
+
+    CacheStats stats()
+    {
+        CacheStats result = {hits.get(), misses.get(), evictions.get(), 0, 0.};
+        {
+            std::lock_guard<std::mutex> lock(estimate_mutex);
+            result.saved_seconds = saved_seconds;
+        }
+        for (auto &shard : shards)
+        {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            result.entries += shard->entries.size();
+        }
+        return result;
+    }
+
+    std::size_t capacity() const
+    {
+        return entries_per_shard * shards.size();
+    }
+};
+
+// Runs `rows` rows of `input` through `model`, answering repeated rows from
+// `cache` and sending only the misses to the device. Blocks until `output`
+// holds all results.
+inline void infer_cached(FCNN &model, ResultCache &cache, const float *input, const uint rows, float *output)
+{
+    const auto shape = model.shape();
+    const CacheLookup lookup = cache.lookup_rows(input, rows, shape[0], model.version(), output);
+    if (lookup.misses.empty())
+    {
+        return;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    Matrix misses = cache.gather_misses(lookup, input, shape[0]);
+    misses.to_device(HANDLE, bank_for(ROLE_INPUT));
+    Matrix &result = model.submit(misses).wait();
+    cache.record_device_latency(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), misses.rows);
+    cache.fill(lookup, result.raw_data(), output);
+}
+
+#endif /* end of include guard: NNONFPGA_RESULT_CACHE */
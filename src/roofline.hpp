@@ -0,0 +1,160 @@
+#ifndef NNONFPGA_ROOFLINE
+#define NNONFPGA_ROOFLINE
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <CL/cl2.hpp>
+#include "json.hpp"
+#include "matrix.hpp"
+#include "metrics.hpp"
+
+// Roofline model of the kernels traced from apply_matmul_into and apply_bias
+// (KERNEL_TRACE in matrix.hpp). Work and traffic follow from the shapes
+// they ran on, the duration from the kernel's profiling events. A kernel
+// whose arithmetic intensity (FLOP per byte of DDR traffic) is below the
+// platform's ridge point peak_gflops / peak_gbps can't reach the compute peak
+// and is bandwidth-bound.
+
+struct PlatformPeaks
+{
+    std::string name;
+    double gflops, gbps;
+
+    // FLOP per byte at which the compute and bandwidth roofs meet
+    double ridge() const
+    {
+        return gflops / gbps;
+    }
+
+    // AWS F1 (VU9P): 6840 DSPs at 250MHz with five DSPs per FP32 multiply-add,
+    // four DDR4-2400 banks. A single-bank placement only reaches a quarter of
+    // the bandwidth.
+    static PlatformPeaks aws_f1()
+    {
+        return {"aws-f1", 684., 76.8};
+    }
+
+    // Peaks of `platform` from a JSON file of the form
+    // {"<platform>": {"gflops": 684, "gbps": 76.8}, ...}
+    static PlatformPeaks from_file(const std::string &path, const std::string &platform)
+    {
+        const JsonValue root = load_json(path);
+        if (!root.contains(platform))
+        {
+            throw std::runtime_error(path + " has no peaks for platform " + platform);
+        }
+        const JsonValue &entry = root.at(platform);
+        return {platform, entry.get("gflops", 0.), entry.get("gbps", 0.)};
+    }
+};
+
+struct KernelRoofline
+{
+    TracedKernel kernel;
+    double flops, bytes, seconds;
+
+    double gflops() const
+    {
+        return seconds > 0. ? flops / seconds * 1e-9 : 0.;
+    }
+
+    double gbps() const
+    {
+        return seconds > 0. ? bytes / seconds * 1e-9 : 0.;
+    }
+
+    double intensity() const
+    {
+        return flops / bytes;
+    }
+
+    // Best GFLOP/s the platform allows at this intensity
+    double attainable_gflops(const PlatformPeaks &peaks) const
+    {
+        return std::min(peaks.gflops, intensity() * peaks.gbps);
+    }
+
+    bool memory_bound(const PlatformPeaks &peaks) const
+    {
+        return intensity() < peaks.ridge();
+    }
+};
+
+// FLOPs and bytes moved by one traced kernel, counted as the kernels are
+// written: matmul_kernel reads both operands and reads and writes the
+// accumulated result, the bias kernels update their input in place. Softmax
+// is counted at four operations per element (add, exp, sum, divide).
+inline KernelRoofline roofline_of(const TracedKernel &kernel)
+{
+    const double rows = kernel.rows, inner = kernel.inner, cols = kernel.cols, word = sizeof(float);
+    KernelRoofline result = {kernel, 0., 0., 0.};
+    if (kernel.inner > 0)
+    {
+        result.flops = 2. * rows * inner * cols;
+        result.bytes = word * (rows * inner + inner * cols + 2. * rows * cols);
+    }
+    else
+    {
+        const bool softmax = kernel.name.find("softmax") != std::string::npos;
+        result.flops = (softmax ? 4. : 2.) * rows * cols;
+        result.bytes = word * (2. * rows * cols + cols);
+    }
+    result.seconds = profiling_delta_ns(kernel.event, CL_PROFILING_COMMAND_START, CL_PROFILING_COMMAND_END) * 1e-9;
+    return result;
+}
+
+// All events of `trace` have to be complete
+inline std::vector<KernelRoofline> roofline_of(const std::vector<TracedKernel> &trace)
+{
+    std::vector<KernelRoofline> result;
+    for (const auto &kernel : trace)
+    {
+        result.push_back(roofline_of(kernel));
+    }
+    return result;
+}
+
+inline std::string shape_of(const TracedKernel &kernel)
+{
+    return kernel.inner > 0 ? std::to_string(kernel.rows) + "x" + std::to_string(kernel.inner) + "x" + std::to_string(kernel.cols)
+                            : std::to_string(kernel.rows) + "x" + std::to_string(kernel.cols);
+}
+
+inline void print_roofline(std::ostream &out, const std::vector<KernelRoofline> &rows, const PlatformPeaks &peaks)
+{
+    out << "Platform " << peaks.name << ": " << peaks.gflops << " GFLOP/s, " << peaks.gbps << " GB/s, ridge at "
+        << std::setprecision(2) << std::fixed << peaks.ridge() << " FLOP/B" << std::endl;
+    out << std::setw(24) << "kernel" << std::setw(14) << "shape" << std::setw(12) << "us"
+        << std::setw(10) << "GFLOP/s" << std::setw(10) << "GB/s" << std::setw(10) << "FLOP/B"
+        << std::setw(10) << "%peak" << std::setw(10) << "%roof" << std::setw(9) << "bound" << std::endl;
+    for (const auto &row : rows)
+    {
+        out << std::setw(24) << row.kernel.name << std::setw(14) << shape_of(row.kernel) << std::setw(12) << row.seconds * 1e6
+            << std::setw(10) << row.gflops() << std::setw(10) << row.gbps() << std::setw(10) << row.intensity()
+            << std::setw(10) << 100. * row.gflops() / peaks.gflops
+            << std::setw(10) << 100. * row.gflops() / row.attainable_gflops(peaks)
+            << std::setw(9) << (row.memory_bound(peaks) ? "memory" : "compute") << std::endl;
+    }
+}
+
+inline void write_roofline_csv(std::ostream &out, const std::vector<KernelRoofline> &rows, const PlatformPeaks &peaks)
+{
+    out << "platform,kernel,rows,inner,cols,seconds,flops,bytes,gflops,gbps,intensity,percent_compute_peak,"
+           "percent_bandwidth_peak,percent_roofline,bound"
+        << std::endl;
+    for (const auto &row : rows)
+    {
+        out << peaks.name << "," << row.kernel.name << "," << row.kernel.rows << "," << row.kernel.inner << ","
+            << row.kernel.cols << "," << row.seconds << "," << row.flops << "," << row.bytes << "," << row.gflops() << ","
+            << row.gbps() << "," << row.intensity() << "," << 100. * row.gflops() / peaks.gflops << ","
+            << 100. * row.gbps() / peaks.gbps << "," << 100. * row.gflops() / row.attainable_gflops(peaks) << ","
+            << (row.memory_bound(peaks) ? "memory" : "compute") << std::endl;
+    }
+}
+
+#endif /* end of include guard: NNONFPGA_ROOFLINE */
@@ -0,0 +1,67 @@
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include "cli.hpp"
+#include "matrix.hpp"
+#include "net.hpp"
+#include "roofline.hpp"
+#include "utils.hpp"
+#include "xcl2.hpp"
+
+// Roofline report of every kernel of FCNN::forward per batch size: achieved
+// GFLOP/s and GB/s, arithmetic intensity, percent of the platform's compute
+// peak and of the roofline at that intensity, and whether the kernel is
+// memory- or compute-bound (roofline.hpp).
+//
+// Peaks default to AWS F1. `--peaks FILE` reads them for `--platform` (the
+// device name by default) from a JSON file, `--peak-gflops` and `--peak-gbps`
+// override either one.
+//
+// Usage: roofline_report [--weights DIR] [--batch-sizes 1,16,256,1024]
+//                        [--peaks FILE] [--platform NAME]
+//                        [--peak-gflops X] [--peak-gbps X] [--csv FILE]
+
+int main(int argc, const char *argv[])
+{
+  const CliArgs args(argc, argv);
+  const auto batch_sizes = args.get_uint_list("batch-sizes", {1, 16, 256, 1024});
+
+  init_kernels();
+  if (xcl::is_emulation())
+  {
+    std::cerr << "WARNING: Kernel times in emulation are not representative" << std::endl;
+  }
+  FCNN model(args.get("weights", "../weights"));
+  finish_cl_queue();
+
+  PlatformPeaks peaks = PlatformPeaks::aws_f1();
+  if (args.has("peaks"))
+  {
+    peaks = PlatformPeaks::from_file(args.get("peaks", ""), args.get("platform", HANDLE.device.getInfo<CL_DEVICE_NAME>()));
+  }
+  peaks.gflops = args.get_double("peak-gflops", peaks.gflops);
+  peaks.gbps = args.get_double("peak-gbps", peaks.gbps);
+
+  std::vector<TracedKernel> trace;
+  for (const uint batch_size : batch_sizes)
+  {
+    Matrix input = Matrix::random(batch_size, model.shape()[0]);
+    input.to_device(HANDLE, bank_for(ROLE_INPUT));
+    // Once untraced so that the traced run doesn't include first-use costs
+    model(input);
+    finish_cl_queue();
+    KERNEL_TRACE = &trace;
+    model(input);
+    KERNEL_TRACE = NULL;
+    finish_cl_queue();
+  }
+
+  const std::vector<KernelRoofline> rows = roofline_of(trace);
+  print_roofline(std::cout, rows, peaks);
+  if (args.has("csv"))
+  {
+    std::ofstream csv(args.get("csv", ""));
+    write_roofline_csv(csv, rows, peaks);
+  }
+}
@@ -0,0 +1,55 @@
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "cli.hpp"
+#include "matrix.hpp"
+#include "net.hpp"
+#include "scheduler.hpp"
+#include "utils.hpp"
+#include "xcl2.hpp"
+
+// Calibrates the CPU/FPGA cost model (scheduler.hpp) and compares predicted
+// and measured end-to-end latency of every layer placement per batch size,
+// host input to host output. `*` marks the plan the scheduler picks.
+//
+// Usage: schedule_bench [--weights DIR] [--batch-sizes 1,4,16,64,256]
+//                       [--repeats 20]
+int main(int argc, const char *argv[])
+{
+  const CliArgs args(argc, argv);
+  const auto batch_sizes = args.get_uint_list("batch-sizes", {1, 4, 16, 64, 256});
+  const uint repeats = args.get_uint("repeats", 20);
+
+  init_kernels();
+  FCNN model(args.get("weights", "../weights"));
+  finish_cl_queue();
+  LayerScheduler scheduler(model, calibrate_costs(model, repeats));
+  const CostModel &costs = scheduler.cost_model();
+
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << "to_device: " << costs.to_device.fixed_us << "us + " << costs.to_device.per_unit_us * 1e3 << "us/KB" << std::endl;
+  std::cout << "to_cpu:    " << costs.to_cpu.fixed_us << "us + " << costs.to_cpu.per_unit_us * 1e3 << "us/KB" << std::endl;
+  for (uint layer = 0; layer < FCNN::NUM_LAYERS; layer++)
+  {
+    std::cout << "layer " << layer << ":   fpga " << costs.fpga_layer[layer].fixed_us << "us + "
+              << costs.fpga_layer[layer].per_unit_us << "us/row, cpu " << costs.cpu_layer[layer].fixed_us
+              << "us + " << costs.cpu_layer[layer].per_unit_us << "us/row" << std::endl;
+  }
+
+  std::cout << std::endl
+            << std::setw(8) << "batch" << std::setw(12) << "plan"
+            << std::setw(16) << "predicted us" << std::setw(16) << "measured us" << std::endl;
+  for (const uint batch_size : batch_sizes)
+  {
+    Matrix input = Matrix::random(batch_size, model.shape()[0]);
+    const std::string chosen = scheduler.plan_for(batch_size).name();
+    for (const auto &plan : LayerPlan::all(FCNN::NUM_LAYERS))
+    {
+      const double measured = median_us(repeats, [&]() { execute_plan(model, input, plan); });
+      std::cout << std::setw(8) << batch_size << std::setw(12) << plan.name()
+                << std::setw(16) << costs.predict(plan, batch_size) << std::setw(16) << measured
+                << (plan.name() == chosen ? "  *" : "") << std::endl;
+    }
+  }
+}
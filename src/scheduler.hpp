@@ -0,0 +1,288 @@
+#ifndef NNONFPGA_SCHEDULER
+#define NNONFPGA_SCHEDULER
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <string>
+#include <vector>
+#include "cpu_layers.hpp"
+#include "matrix.hpp"
+#include "net.hpp"
+#include "stats.hpp"
+#include "utils.hpp"
+#include "xcl2.hpp"
+
+// Decides per batch size which layers of an FCNN run on the FPGA and which on
+// the host. Small layers can be cheaper to compute on the CPU than the kernel
+// launch and the migrations around it; the cost model is calibrated from
+// measured launch, kernel and transfer times and picks the plan with the
+// lowest predicted end-to-end latency, host input to host output.
+
+enum Device
+{
+    DEVICE_FPGA,
+    DEVICE_CPU
+};
+
+struct LayerPlan
+{
+    std::vector<Device> devices;
+
+    // E.g. "fpga+cpu"
+    std::string name() const
+    {
+        std::string result;
+        for (std::size_t layer = 0; layer < devices.size(); layer++)
+        {
+            result += (layer > 0 ? "+" : "") + std::string(devices[layer] == DEVICE_FPGA ? "fpga" : "cpu");
+        }
+        return result;
+    }
+
+    // Every combination of devices for `num_layers` layers
+    static std::vector<LayerPlan> all(const uint num_layers)
+    {
+        std::vector<LayerPlan> result;
+        for (uint mask = 0; mask < (1u << num_layers); mask++)
+        {
+            LayerPlan plan;
+            for (uint layer = 0; layer < num_layers; layer++)
+            {
+                plan.devices.push_back((mask >> layer) & 1 ? DEVICE_CPU : DEVICE_FPGA);
+            }
+            result.push_back(plan);
+        }
+        return result;
+    }
+};
+
+// Cost in microseconds that grows linearly in some size, e.g. bytes or rows
+struct LinearCost
+{
+    double fixed_us, per_unit_us;
+
+    double operator()(const double units) const
+    {
+        return fixed_us + per_unit_us * units;
+    }
+
+    // Line through two measurements, clamped to non-negative coefficients
+    static LinearCost fit(const double units0, const double us0, const double units1, const double us1)
+    {
+        const double slope = std::max((us1 - us0) / (units1 - units0), 0.);
+        return {std::max(us0 - slope * units0, 0.), slope};
+    }
+};
+
+struct CostModel
+{
+    // Per byte
+    LinearCost to_device, to_cpu;
+    // Per row of the batch, the FPGA cost includes launching both kernels
+    std::vector<LinearCost> fpga_layer, cpu_layer;
+    // Input size, followed by the output size of every layer
+    std::vector<uint> widths;
+
+    double predict(const LayerPlan &plan, const uint batch_size) const
+    {
+        const double row_bytes = sizeof(float) * batch_size;
+        double total = 0.;
+        bool on_device = false;
+        for (std::size_t layer = 0; layer < plan.devices.size(); layer++)
+        {
+            const bool fpga = plan.devices[layer] == DEVICE_FPGA;
+            if (fpga != on_device)
+            {
+                total += (fpga ? to_device : to_cpu)(row_bytes * widths[layer]);
+                on_device = fpga;
+            }
+            total += (fpga ? fpga_layer : cpu_layer)[layer](batch_size);
+        }
+        if (on_device)
+        {
+            total += to_cpu(row_bytes * widths.back());
+        }
+        return total;
+    }
+};
+
+// Runs `model` on the host matrix `input` according to `plan`, migrating
+// activations whenever consecutive layers run on different devices, and
+// returns the result on the host
+Matrix execute_plan(FCNN &model, Matrix &input, const LayerPlan &plan)
+{
+    const uint num_layers = plan.devices.size();
+    // Every activation stays alive until the end, kernels may still read them
+    std::vector<Matrix> activations;
+    activations.reserve(num_layers);
+    Matrix *current = &input;
+    bool on_device = false;
+    std::vector<cl::Event> pending;
+
+    for (uint layer = 0; layer < num_layers; layer++)
+    {
+        const bool last = layer == num_layers - 1;
+        Matrix &weight = model.weight(layer);
+        Matrix &bias = model.bias(layer);
+
+        if (plan.devices[layer] == DEVICE_CPU)
+        {
+            if (on_device)
+            {
+                current->to_cpu(HANDLE, &pending);
+                finish_cl_queue();
+                pending.clear();
+                on_device = false;
+            }
+            activations.push_back(cpu_dense(*current, weight, bias, last ? ACTIVATION_SOFTMAX : ACTIVATION_RELU6));
+            current = &activations.back();
+            continue;
+        }
+
+        if (!on_device)
+        {
+            pending.resize(1);
+            current->to_device(HANDLE, bank_for(layer == 0 ? ROLE_INPUT : ROLE_ACTIVATION), &pending[0]);
+            on_device = true;
+        }
+        activations.push_back(Matrix::constant(current->rows, weight.cols, 0.0));
+        Matrix &result = activations.back();
+        result.to_device(HANDLE, bank_for(last ? ROLE_OUTPUT : ROLE_ACTIVATION));
+
+        cl::Kernel &matmul = matmul_kernel_for(weight.rows, weight.cols, layer == 0 ? MATMUL_KERNEL : MATMUL_OUTPUT_KERNEL);
+        std::vector<cl::Event> matmul_done = {apply_matmul_into(*current, weight, result, matmul, &pending)};
+        pending = {apply_bias(result, bias, last ? BIAS_SOFTMAX_KERNEL : BIAS_RELU6_KERNEL, &matmul_done)};
+        current = &result;
+    }
+
+    if (on_device)
+    {
+        current->to_cpu(HANDLE, &pending);
+        finish_cl_queue();
+    }
+    return std::move(activations.back());
+}
+
+// Median wall clock time of `run` in microseconds, after one warmup run
+inline double median_us(const uint repeats, const std::function<void()> &run)
+{
+    run();
+    std::vector<double> samples;
+    for (uint r = 0; r < repeats; r++)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        run();
+        samples.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+    }
+    return median(samples);
+}
+
+// Measures every cost at a small and a large batch and interpolates in between
+CostModel calibrate_costs(FCNN &model, const uint repeats = 20, const uint small_batch = 1, const uint large_batch = 256)
+{
+    if (xcl::is_emulation())
+    {
+        std::cerr << "WARNING: Calibrating in emulation, FPGA costs are not representative" << std::endl;
+    }
+
+    CostModel costs;
+    costs.widths = {model.weight(0).rows};
+    const uint batches[2] = {small_batch, large_batch};
+    for (uint layer = 0; layer < FCNN::NUM_LAYERS; layer++)
+    {
+        Matrix &weight = model.weight(layer);
+        Matrix &bias = model.bias(layer);
+        const bool last = layer == FCNN::NUM_LAYERS - 1;
+        costs.widths.push_back(weight.cols);
+
+        double fpga_us[2], cpu_us[2];
+        for (uint i = 0; i < 2; i++)
+        {
+            Matrix input = Matrix::random(batches[i], weight.rows, layer);
+            input.to_device(HANDLE, bank_for(layer == 0 ? ROLE_INPUT : ROLE_ACTIVATION));
+            Matrix result = Matrix::constant(batches[i], weight.cols, 0.0);
+            result.to_device(HANDLE, bank_for(last ? ROLE_OUTPUT : ROLE_ACTIVATION));
+            finish_cl_queue();
+
+            cl::Kernel &matmul = matmul_kernel_for(weight.rows, weight.cols, layer == 0 ? MATMUL_KERNEL : MATMUL_OUTPUT_KERNEL);
+            fpga_us[i] = median_us(repeats, [&]() {
+                std::vector<cl::Event> matmul_done = {apply_matmul_into(input, weight, result, matmul)};
+                apply_bias(result, bias, last ? BIAS_SOFTMAX_KERNEL : BIAS_RELU6_KERNEL, &matmul_done);
+                finish_cl_queue();
+            });
+            cpu_us[i] = median_us(repeats, [&]() {
+                cpu_dense(input, weight, bias, last ? ACTIVATION_SOFTMAX : ACTIVATION_RELU6);
+            });
+        }
+        costs.fpga_layer.push_back(LinearCost::fit(batches[0], fpga_us[0], batches[1], fpga_us[1]));
+        costs.cpu_layer.push_back(LinearCost::fit(batches[0], cpu_us[0], batches[1], cpu_us[1]));
+    }
+
+    // Transfers are measured on the largest tensor, the input
+    double bytes[2], to_device_us[2], to_cpu_us[2];
+    for (uint i = 0; i < 2; i++)
+    {
+        Matrix data = Matrix::random(batches[i], costs.widths[0]);
+        bytes[i] = sizeof(float) * data.rows * data.cols;
+        to_device_us[i] = median_us(repeats, [&]() {
+            data.to_device(HANDLE, bank_for(ROLE_INPUT));
+            finish_cl_queue();
+        });
+        to_cpu_us[i] = median_us(repeats, [&]() {
+            data.to_cpu();
+            finish_cl_queue();
+        });
+    }
+    costs.to_device = LinearCost::fit(bytes[0], to_device_us[0], bytes[1], to_device_us[1]);
+    costs.to_cpu = LinearCost::fit(bytes[0], to_cpu_us[0], bytes[1], to_cpu_us[1]);
+    return costs;
+}
+
+class LayerScheduler
+{
+private:
+    FCNN &model;
+    CostModel costs;
+    std::map<uint, LayerPlan> plans;
+
+public:
+    LayerScheduler(FCNN &model, const CostModel &costs) : model(model), costs(costs) {}
+
+    // Plan with the lowest predicted latency, cached per batch size
+    const LayerPlan &plan_for(const uint batch_size)
+    {
+        auto it = plans.find(batch_size);
+        if (it != plans.end())
+        {
+            return it->second;
+        }
+        LayerPlan best;
+        double best_us = std::numeric_limits<double>::infinity();
+        for (const auto &plan : LayerPlan::all(FCNN::NUM_LAYERS))
+        {
+            const double us = costs.predict(plan, batch_size);
+            if (us < best_us)
+            {
+                best = plan;
+                best_us = us;
+            }
+        }
+        return plans[batch_size] = best;
+    }
+
+    const CostModel &cost_model() const
+    {
+        return costs;
+    }
+
+    // Host input to host output
+    Matrix operator()(Matrix &input)
+    {
+        return execute_plan(model, input, plan_for(input.rows));
+    }
+};
+
+#endif /* end of include guard: NNONFPGA_SCHEDULER */
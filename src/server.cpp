@@ -0,0 +1,371 @@
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "async.hpp"
+#include "cli.hpp"
+#include "ipc.hpp"
+#include "matrix.hpp"
+#include "metrics.hpp"
+#include "net.hpp"
+#include "result_cache.hpp"
+#include "tuning.hpp"
+#include "utils.hpp"
+#include "xcl2.hpp"
+
+// Long-running inference daemon. Owns the device, keeps the FCNN weights
+// resident and serves clients (see client.hpp) over a Unix socket. Inputs and
+// outputs live in per-connection shared-memory rings that are wrapped as
+// device buffers directly, so the only copies are the PCIe transfers.
+//
+// Usage: fcnn_server [--socket /tmp/fcnn.sock] [--weights DIR]
+//                    [--max-slots 64] [--max-rows 1024] [--cache-mb N]
+//                    [--metrics FILE|unix:SOCKET] [--metrics-interval 5]
+//
+// With --metrics, request metrics are exported in the Prometheus text format,
+// either rewritten to FILE every interval or served on SOCKET on connect.
+// With --cache-mb, results of repeated input rows are answered from a
+// ResultCache of that size and only the other rows go to the device.
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void request_stop(int)
+{
+  stop_requested = 1;
+}
+
+struct PendingRequest
+{
+  Matrix input;
+  InferenceHandle handle;
+};
+
+struct Connection
+{
+  int fd;
+  bool open;
+  std::unique_ptr<SharedRing> ring;
+  std::map<uint32_t, PendingRequest> pending;
+};
+
+struct Completion
+{
+  uint64_t connection;
+  uint32_t slot;
+  uint64_t sequence;
+  // Replied with MSG_ERROR instead of MSG_DONE
+  bool failed;
+};
+
+class Server
+{
+private:
+  FCNN &model;
+  // Optional
+  ResultCache *cache;
+  int listen_fd;
+  int wake_pipe[2];
+  uint32_t max_slots, max_rows;
+  uint64_t next_connection;
+  std::map<uint64_t, Connection> connections;
+
+  // Filled from the runtime's callback thread
+  std::mutex completions_mutex;
+  std::vector<Completion> completions;
+
+public:
+  Server(FCNN &model, const std::string &socket_path, const uint32_t max_slots, const uint32_t max_rows,
+         ResultCache *cache = NULL)
+      : model(model), cache(cache), max_slots(max_slots), max_rows(max_rows), next_connection(0)
+  {
+    unlink(socket_path.c_str());
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    const sockaddr_un addr = socket_address(socket_path);
+    if (listen_fd < 0 || bind(listen_fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) != 0 ||
+        listen(listen_fd, 64) != 0)
+    {
+      throw std::runtime_error("Could not listen on " + socket_path + ": " + strerror(errno));
+    }
+    if (pipe(wake_pipe) != 0)
+    {
+      throw std::runtime_error(std::string("pipe: ") + strerror(errno));
+    }
+  }
+
+  void run()
+  {
+    while (!stop_requested)
+    {
+      std::vector<pollfd> fds = {{listen_fd, POLLIN, 0}, {wake_pipe[0], POLLIN, 0}};
+      std::vector<uint64_t> ids;
+      for (auto &item : connections)
+      {
+        if (item.second.open)
+        {
+          fds.push_back({item.second.fd, POLLIN, 0});
+          ids.push_back(item.first);
+        }
+      }
+
+      if (poll(fds.data(), fds.size(), -1) < 0)
+      {
+        if (errno == EINTR)
+          continue;
+        throw std::runtime_error(std::string("poll: ") + strerror(errno));
+      }
+
+      if (fds[0].revents & POLLIN)
+      {
+        accept_connection();
+      }
+      if (fds[1].revents & POLLIN)
+      {
+        deliver_completions();
+      }
+      for (std::size_t i = 0; i < ids.size(); i++)
+      {
+        // Connections may have been closed while delivering completions
+        const auto it = connections.find(ids[i]);
+        if (it != connections.end() && it->second.open && (fds[i + 2].revents & (POLLIN | POLLHUP | POLLERR)))
+        {
+          handle_message(ids[i]);
+        }
+      }
+    }
+    finish_cl_queue();
+  }
+
+private:
+  void accept_connection()
+  {
+    const int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0)
+    {
+      return;
+    }
+    Connection &connection = connections[next_connection++];
+    connection.fd = fd;
+    connection.open = true;
+  }
+
+  void close_connection(const uint64_t id)
+  {
+    Connection &connection = connections.at(id);
+    if (connection.open)
+    {
+      close(connection.fd);
+      connection.open = false;
+    }
+    // The ring has to stay mapped until all requests on it finished
+    if (connection.pending.empty())
+    {
+      connections.erase(id);
+    }
+  }
+
+  void reply(Connection &connection, const uint32_t type, const Message &request)
+  {
+    Message msg = request;
+    msg.type = type;
+    if (!send_message(connection.fd, msg))
+    {
+      close(connection.fd);
+      connection.open = false;
+    }
+  }
+
+  void handle_message(const uint64_t id)
+  {
+    Connection &connection = connections.at(id);
+    Message msg;
+    if (!receive_message(connection.fd, msg))
+    {
+      close_connection(id);
+      return;
+    }
+
+    if (msg.type == MSG_HELLO && !connection.ring)
+    {
+      if (msg.num_slots == 0 || msg.num_slots > max_slots || msg.rows == 0 || msg.rows > max_rows)
+      {
+        reply(connection, MSG_ERROR, msg);
+        return;
+      }
+      const auto shape = model.shape();
+      const RingLayout layout = {msg.num_slots, msg.rows, shape[0], shape[2]};
+      const std::string name = "/fcnn-" + std::to_string(getpid()) + "-" + std::to_string(id);
+      connection.ring.reset(new SharedRing());
+      connection.ring->create(name, layout);
+
+      msg.input_cols = layout.input_cols;
+      msg.output_cols = layout.output_cols;
+      memset(msg.shm_name, 0, sizeof(msg.shm_name));
+      strncpy(msg.shm_name, name.c_str(), sizeof(msg.shm_name) - 1);
+      reply(connection, MSG_HELLO_OK, msg);
+      return;
+    }
+
+    if (msg.type == MSG_INFER && connection.ring)
+    {
+      const RingLayout &layout = connection.ring->get_layout();
+      if (msg.slot >= layout.num_slots || msg.rows == 0 || msg.rows > layout.max_rows ||
+          connection.pending.count(msg.slot) > 0)
+      {
+        reply(connection, MSG_ERROR, msg);
+        return;
+      }
+      submit(id, connection, msg);
+      return;
+    }
+
+    reply(connection, MSG_ERROR, msg);
+  }
+
+  void submit(const uint64_t id, Connection &connection, const Message &msg)
+  {
+    const RingLayout &layout = connection.ring->get_layout();
+    float *input_data = connection.ring->input(msg.slot);
+    float *output_data = connection.ring->output(msg.slot);
+    const Completion completion = {id, msg.slot, msg.sequence, false};
+
+    // Cached rows are answered right away, only the rest goes to the device
+    std::shared_ptr<CacheLookup> lookup;
+    if (cache != NULL)
+    {
+      lookup = std::make_shared<CacheLookup>(
+          cache->lookup_rows(input_data, msg.rows, layout.input_cols, model.version(), output_data));
+      if (lookup->misses.empty())
+      {
+        complete(completion);
+        return;
+      }
+    }
+
+    std::vector<cl::Event> migrations(2);
+    PendingRequest &request = connection.pending[msg.slot];
+    Matrix output;
+    if (lookup && lookup->misses.size() < msg.rows)
+    {
+      // Some rows hit, the misses are compacted into staging matrices
+      request.input = cache->gather_misses(*lookup, input_data, layout.input_cols);
+      output = Matrix::constant(request.input.rows, layout.output_cols, 0.0);
+    }
+    else
+    {
+      memset(output_data, 0, sizeof(float) * msg.rows * layout.output_cols);
+      request.input = Matrix::wrap(input_data, msg.rows, layout.input_cols);
+      output = Matrix::wrap(output_data, msg.rows, layout.output_cols);
+    }
+    request.input.to_device(HANDLE, bank_for(ROLE_INPUT), &migrations[0]);
+    output.to_device(HANDLE, bank_for(ROLE_OUTPUT), &migrations[1]);
+
+    const auto start = std::chrono::steady_clock::now();
+    request.handle = model.submit_into(request.input, std::move(output), &migrations);
+    request.handle.then([this, completion, lookup, output_data, start](Matrix &result) {
+      if (lookup)
+      {
+        cache->record_device_latency(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), result.rows);
+        cache->fill(*lookup, result.raw_data(), output_data);
+      }
+      complete(completion);
+    }, [this, completion](cl_int) {
+      // Frees the slot; the client gets MSG_ERROR instead of waiting forever
+      Completion failed = completion;
+      failed.failed = true;
+      complete(failed);
+    });
+  }
+
+  // Queues the reply to `completion` for the server loop. Called from the
+  // runtime's callback thread, or directly for requests answered from cache.
+  void complete(const Completion &completion)
+  {
+    {
+      std::lock_guard<std::mutex> lock(completions_mutex);
+      completions.push_back(completion);
+    }
+    const char byte = 0;
+    if (write(wake_pipe[1], &byte, 1) < 0)
+    {
+      std::cerr << "Could not wake up server loop" << std::endl;
+    }
+  }
+
+  void deliver_completions()
+  {
+    char buffer[256];
+    if (read(wake_pipe[0], buffer, sizeof(buffer)) < 0)
+    {
+      return;
+    }
+
+    std::vector<Completion> done;
+    {
+      std::lock_guard<std::mutex> lock(completions_mutex);
+      done.swap(completions);
+    }
+
+    for (const auto &completion : done)
+    {
+      auto it = connections.find(completion.connection);
+      if (it == connections.end())
+      {
+        continue;
+      }
+      Connection &connection = it->second;
+      connection.pending.erase(completion.slot);
+
+      if (connection.open)
+      {
+        Message msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.slot = completion.slot;
+        msg.sequence = completion.sequence;
+        reply(connection, completion.failed ? MSG_ERROR : MSG_DONE, msg);
+      }
+      if (!connection.open && connection.pending.empty())
+      {
+        connections.erase(it);
+      }
+    }
+  }
+};
+
+int main(int argc, const char *argv[])
+{
+  const CliArgs args(argc, argv);
+  const std::string socket_path = args.get("socket", DEFAULT_SOCKET_PATH);
+
+  signal(SIGINT, request_stop);
+  signal(SIGTERM, request_stop);
+  signal(SIGPIPE, SIG_IGN);
+
+  init_kernels();
+  FCNN model(args.get("weights", "../weights"));
+  std::unique_ptr<ResultCache> cache;
+  if (args.get_uint("cache-mb", 0) > 0)
+  {
+    cache.reset(new ResultCache(static_cast<std::size_t>(args.get_uint("cache-mb", 0)) << 20, model.shape()[2]));
+  }
+  Server server(model, socket_path, args.get_uint("max-slots", 64), args.get_uint("max-rows", 1024), cache.get());
+  std::unique_ptr<MetricsExporter> exporter;
+  if (args.has("metrics"))
+  {
+    exporter.reset(new MetricsExporter(args.get("metrics", ""), args.get_double("metrics-interval", 5.)));
+  }
+
+  std::cout << "Serving " << shape_key(model.shape()) << " on " << socket_path << std::endl;
+  server.run();
+  unlink(socket_path.c_str());
+  std::cout << "Shutting down" << std::endl;
+}
@@ -0,0 +1,26 @@
+#include "training_kernels.hpp"
+#include "hls_math.h"
+
+extern "C" void softmax_xent_backward_kernel(
+    const float *const probabilities, const uint *const labels, const uint batch_size, const uint classes,
+    float *const gradient, float *const loss)
+{
+   const float scale = 1.f / batch_size;
+   float total = 0.f;
+   for (uint b = 0; b < batch_size; b++)
+   {
+      const uint label = labels[b];
+      for (uint c = 0; c < classes; c++)
+      {
+#pragma HLS PIPELINE II = 1
+         const uint i = classes * b + c;
+         const float p = probabilities[i];
+         gradient[i] = (p - (c == label ? 1.f : 0.f)) * scale;
+         if (c == label)
+         {
+            total -= log(p);
+         }
+      }
+   }
+   loss[0] = total * scale;
+}
@@ -0,0 +1,28 @@
+#ifndef NNONFPGA_SPECIALIZATION
+#define NNONFPGA_SPECIALIZATION
+
+#include <string>
+#include <vector>
+
+typedef unsigned int uint;
+
+// Matmul kernel compiled for fixed inner dimensions (see matmul_fixed.hpp),
+// generated for layer `layer` of the model by gen_kernels.py
+struct MatmulShape
+{
+    uint cols_a, cols_b, layer;
+
+    std::string kernel_name() const
+    {
+        return "matmul_kernel_" + std::to_string(cols_a) + "x" + std::to_string(cols_b);
+    }
+};
+
+#ifdef SPECIALIZED_KERNELS
+#include "generated/specialized_kernels.hpp"
+static const std::vector<MatmulShape> SPECIALIZED_MATMULS = SPECIALIZED_MATMUL_SHAPES;
+#else
+static const std::vector<MatmulShape> SPECIALIZED_MATMULS;
+#endif
+
+#endif /* end of include guard: NNONFPGA_SPECIALIZATION */
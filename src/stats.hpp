@@ -0,0 +1,37 @@
+#ifndef NNONFPGA_STATS
+#define NNONFPGA_STATS
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <vector>
+
+// Percentile with linear interpolation, `p` in [0, 100]
+double percentile(std::vector<double> values, const double p)
+{
+    if (values.empty())
+    {
+        return 0.;
+    }
+    std::sort(values.begin(), values.end());
+    const double pos = p / 100. * (values.size() - 1);
+    const std::size_t lower = static_cast<std::size_t>(std::floor(pos));
+    const std::size_t upper = std::min(lower + 1, values.size() - 1);
+    return values[lower] + (pos - lower) * (values[upper] - values[lower]);
+}
+
+double median(const std::vector<double> &values)
+{
+    return percentile(values, 50.);
+}
+
+double mean(const std::vector<double> &values)
+{
+    if (values.empty())
+    {
+        return 0.;
+    }
+    return std::accumulate(values.begin(), values.end(), 0.) / values.size();
+}
+
+#endif /* end of include guard: NNONFPGA_STATS */
@@ -0,0 +1,11 @@
+#include "stream_kernels.hpp"
+
+// Tail of the dataflow pipeline, writes `size` floats back to DDR
+extern "C" void store_stream_kernel(float_stream &in, const uint size, float *const output)
+{
+   for (uint i = 0; i < size; i++)
+   {
+#pragma HLS PIPELINE II = 1
+      output[i] = from_packet(in.read());
+   }
+}
@@ -0,0 +1,54 @@
+#include <ap_axi_sdata.h>
+#include <hls_stream.h>
+#include "matmul_kernel.hpp"
+#include "stream_limits.hpp"
+
+typedef unsigned int uint;
+
+// Kernels of the dataflow pipeline. Activations are passed between them over
+// AXI4-Stream ports, linked with `stream_connect` at build time (see
+// placement.hpp), so only inputs, weights and outputs go through DDR:
+//
+//   load -> matmul -> bias_relu6 -> matmul -> bias_softmax -> store
+//
+// Every kernel consumes and produces a row-major matrix as a sequence of
+// floats, with `last` set on the final element, so they can be chained in
+// any order that fits the shapes.
+typedef ap_axiu<32, 0, 0, 0> float_packet;
+typedef hls::stream<float_packet> float_stream;
+
+
+inline float_packet to_packet(const float value, const bool last)
+{
+   union
+   {
+      float f;
+      unsigned int u;
+   } bits;
+   bits.f = value;
+   float_packet packet;
+   packet.data = bits.u;
+   packet.keep = -1;
+   packet.last = last;
+   return packet;
+}
+
+inline float from_packet(const float_packet &packet)
+{
+   union
+   {
+      float f;
+      unsigned int u;
+   } bits;
+   bits.u = packet.data;
+   return bits.f;
+}
+
+extern "C" void load_stream_kernel(const float *const input, const uint size, float_stream &out);
+extern "C" void matmul_stream_kernel(
+    float_stream &in, const float *const weights, const uint rows, const uint cols_in, const uint cols_out, float_stream &out);
+extern "C" void bias_relu6_stream_kernel(
+    float_stream &in, const float *const bias, const uint batch_size, const uint dim, float_stream &out);
+extern "C" void bias_softmax_stream_kernel(
+    float_stream &in, const float *const bias, const uint batch_size, const uint dim, float_stream &out);
+extern "C" void store_stream_kernel(float_stream &in, const uint size, float *const output);
@@ -0,0 +1,13 @@
+#ifndef NNONFPGA_STREAM_LIMITS
+#define NNONFPGA_STREAM_LIMITS
+
+// Sizes of the on-chip buffers of the dataflow kernels (see
+// stream_kernels.hpp), checked by the host before launching them.
+
+// Upper bound for the number of columns a kernel buffers per row
+#define STREAM_MAX_COLS 1024
+// Upper bound for the weights of a layer, which matmul_stream_kernel keeps on
+// chip (784 x 64 for the hidden layer of the default model)
+#define STREAM_MAX_WEIGHTS 65536
+
+#endif /* end of include guard: NNONFPGA_STREAM_LIMITS */
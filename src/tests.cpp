@@ -4,7 +4,22 @@
 #include "gtest/gtest.h"
 
 #include "utils.hpp"
+#include "bf16_net.hpp"
+#include "deadline.hpp"
 #include "matrix.hpp"
+#include "load_test.hpp"
+#include "net.hpp"
+#include "persistent.hpp"
+#include "plan.hpp"
+#include "reference.hpp"
+#include "expr.hpp"
+#include "preprocess.hpp"
+#include "registry.hpp"
+#include "result_cache.hpp"
+#include "roofline.hpp"
+#include "scheduler.hpp"
+#include "trainer.hpp"
+#include "tuning.hpp"
 
 TEST(KernelTest, MatmulCorrect)
 {
@@ -81,6 +96,732 @@ TEST(KernelTest, BiasRelu6Kernel)
     ASSERT_FLOAT_EQ(mat(1, 0), 5);
     ASSERT_FLOAT_EQ(mat(1, 1), 6);
 }
+
+TEST(KernelTest, WaitsOnlyForBufferHazards)
+{
+    Matrix mat = Matrix::constant(2, 2, 1.0), bias = Matrix::constant(2, 1, 1.0);
+    cl::Event mat_upload, bias_upload;
+    mat.to_device(HANDLE, DEFAULT_MEMORY_BANK, &mat_upload);
+    bias.to_device(HANDLE, DEFAULT_MEMORY_BANK, &bias_upload);
+
+    // Reading waits for the last write only, writing for reads as well
+    std::vector<cl::Event> hazards;
+    bias.read_hazards(hazards);
+    ASSERT_EQ(hazards.size(), 1u);
+    ASSERT_EQ(hazards[0](), bias_upload());
+
+    const cl::Event kernel = apply_bias(mat, bias, BIAS_RELU6_KERNEL);
+    hazards.clear();
+    mat.read_hazards(hazards);
+    ASSERT_EQ(hazards.size(), 1u);
+    ASSERT_EQ(hazards[0](), kernel());
+
+    cl::Event readback;
+    mat.to_cpu(HANDLE, NULL, &readback);
+    readback.wait();
+    ASSERT_FLOAT_EQ(mat(0, 0), 2);
+    hazards.clear();
+    mat.write_hazards(hazards);
+    ASSERT_EQ(hazards.size(), 2u);
+    ASSERT_EQ(hazards[1](), readback());
+    finish_cl_queue();
+}
+
+void check_conv_against_reference(const ConvShape &shape)
+{
+    Matrix input = Matrix::random(2, shape.input_size(), 1);
+    input.to_device(HANDLE, bank_for(ROLE_INPUT));
+    // Centered weights so that relu6 clips in both directions
+    Matrix weights = Matrix::random(shape.filters, shape.weight_size(), 2);
+    for (uint i = 0; i < weights.rows; i++)
+    {
+        for (uint j = 0; j < weights.cols; j++)
+        {
+            weights(i, j) = 4 * (weights(i, j) - 0.5);
+        }
+    }
+    weights.to_device(HANDLE, bank_for(ROLE_WEIGHT));
+    Matrix bias = Matrix::random(shape.filters, 1, 3);
+    bias.to_device(HANDLE, bank_for(ROLE_WEIGHT));
+    finish_cl_queue();
+
+    auto result = std::get<0>(apply_conv(input, weights, bias, shape, CONV_RELU6_KERNEL));
+    finish_cl_queue();
+    result.to_cpu();
+    finish_cl_queue();
+
+    auto expected = conv_relu6_reference(input, weights, bias, shape);
+    ASSERT_EQ(result.cols, expected.cols);
+    for (uint i = 0; i < expected.rows; i++)
+    {
+        for (uint j = 0; j < expected.cols; j++)
+        {
+            ASSERT_NEAR(result(i, j), expected(i, j), 1e-4);
+        }
+    }
+}
+
+TEST(KernelTest, ConvRelu6Correct)
+{
+    check_conv_against_reference({2, 7, 9, 3, false});
+}
+
+TEST(KernelTest, ConvRelu6PoolCorrect)
+{
+    check_conv_against_reference({1, 28, 28, 8, true});
+}
+
+TEST(KernelTest, SpecializedMatmulMatchesGeneric)
+{
+    for (const auto &shape : SPECIALIZED_MATMULS)
+    {
+        Matrix a = Matrix::random(3, shape.cols_a, 1);
+        Matrix b = Matrix::random(shape.cols_a, shape.cols_b, 2);
+        a.to_device();
+        b.to_device();
+        auto expected = apply_matmul(a, b, MATMUL_KERNEL);
+        auto result = apply_matmul(a, b, matmul_kernel_for(shape.cols_a, shape.cols_b, MATMUL_KERNEL));
+        finish_cl_queue();
+        expected.first.to_cpu();
+        result.first.to_cpu();
+        finish_cl_queue();
+
+        for (uint i = 0; i < expected.first.rows; i++)
+        {
+            for (uint j = 0; j < expected.first.cols; j++)
+            {
+                ASSERT_NEAR(result.first(i, j), expected.first(i, j), 1e-4) << shape.kernel_name();
+            }
+        }
+    }
+    // Shapes without a specialization use the generic kernel
+    ASSERT_EQ(&matmul_kernel_for(3, 5, MATMUL_KERNEL), &MATMUL_KERNEL);
+}
+
+TEST(KernelTest, AsyncInferenceMatchesSync)
+{
+    FCNN model;
+    Matrix input = Matrix::random(4, 784);
+    input.to_device();
+    finish_cl_queue();
+
+    auto expected = model(input);
+    finish_cl_queue();
+    expected.to_cpu();
+    finish_cl_queue();
+
+    bool continuation_called = false;
+    auto request = model.submit(input);
+    request.then([&](Matrix &) { continuation_called = true; });
+    auto &result = request.wait();
+
+    ASSERT_TRUE(request.ready());
+    for (uint i = 0; i < expected.rows; i++)
+    {
+        for (uint j = 0; j < expected.cols; j++)
+        {
+            ASSERT_FLOAT_EQ(result(i, j), expected(i, j));
+        }
+    }
+    ASSERT_TRUE(continuation_called);
+    ASSERT_FALSE(InferenceHandle().valid());
+    ASSERT_THROW(InferenceHandle().wait(), std::runtime_error);
+}
+
+TEST(KernelTest, GemvMatchesBatchedForward)
+{
+    // Small centered weights, so that neither relu6 nor softmax saturate
+    Matrix w1 = Matrix::random(784, 64, 1), w2 = Matrix::random(64, 10, 2);
+    evaluate_into((w1 - ScalarExpr(0.5f)) * 0.05f, w1);
+    evaluate_into(w2 - ScalarExpr(0.5f), w2);
+    FCNN model(std::move(w1), Matrix::random(64, 1, 3), std::move(w2), Matrix::random(10, 1, 4));
+    ASSERT_TRUE(model.uses_gemv(1));
+    ASSERT_FALSE(model.uses_gemv(2));
+    Matrix input = Matrix::random(1, 784, 5);
+    input.to_device(HANDLE, bank_for(ROLE_INPUT));
+
+    model.enable_gemv(false);
+    std::vector<cl::Event> generic_events;
+    Matrix expected = model(input, &generic_events);
+    model.enable_gemv(true);
+    std::vector<cl::Event> gemv_events;
+    Matrix result = model(input, &gemv_events);
+    finish_cl_queue();
+    expected.to_cpu();
+    result.to_cpu();
+    finish_cl_queue();
+
+    ASSERT_EQ(generic_events.size(), 4);
+    ASSERT_EQ(gemv_events.size(), 2);
+    for (uint j = 0; j < result.cols; j++)
+    {
+        ASSERT_NEAR(result(0, j), expected(0, j), 1e-5);
+    }
+}
+
+TEST(KernelTest, DataflowMatchesSync)
+{
+    FCNN model(Matrix::random(784, 64, 1), Matrix::random(64, 1, 2), Matrix::random(64, 10, 3), Matrix::random(10, 1, 4));
+    Matrix input = Matrix::random(5, 784, 5);
+    input.to_device();
+    finish_cl_queue();
+
+    auto expected = model(input);
+    Matrix result = Matrix::constant(5, 10, -1.0);
+    result.to_device();
+    finish_cl_queue();
+    // The readback orders after the pipeline's store by itself
+    model.forward_dataflow(input, result);
+    expected.to_cpu();
+    result.to_cpu();
+    finish_cl_queue();
+
+    for (uint i = 0; i < expected.rows; i++)
+    {
+        for (uint j = 0; j < expected.cols; j++)
+        {
+            ASSERT_NEAR(result(i, j), expected(i, j), 1e-5);
+        }
+    }
+
+    // Too large for the on-chip weights
+    FCNN large(Matrix::random(1024, 128, 1), Matrix::random(128, 1, 2), Matrix::random(128, 10, 3), Matrix::random(10, 1, 4));
+    Matrix large_input = Matrix::random(1, 1024, 5);
+    large_input.to_device();
+    ASSERT_THROW(large.forward_dataflow(large_input, result), std::runtime_error);
+}
+
+TEST(KernelTest, InferencePlanReplaysForward)
+{
+    FCNN model(Matrix::random(784, 64, 1), Matrix::random(64, 1, 2), Matrix::random(64, 10, 3), Matrix::random(10, 1, 4));
+    Matrix input = Matrix::random(4, 784, 5);
+    input.to_device();
+    auto expected = model(input);
+    finish_cl_queue();
+    expected.to_cpu();
+    finish_cl_queue();
+
+    InferencePlan plan(model, 4);
+    // Replaying twice checks that the accumulators are reset
+    for (uint replay = 0; replay < 2; replay++)
+    {
+        Matrix &result = plan.run(input.raw_data());
+        for (uint i = 0; i < expected.rows; i++)
+        {
+            for (uint j = 0; j < expected.cols; j++)
+            {
+                ASSERT_NEAR(result(i, j), expected(i, j), 1e-5);
+            }
+        }
+    }
+}
+
+TEST(KernelTest, PersistentKernelMatchesForward)
+{
+    FCNN model(Matrix::random(784, 64, 1), Matrix::random(64, 1, 2), Matrix::random(64, 10, 3), Matrix::random(10, 1, 4));
+    Matrix input = Matrix::random(3, 784, 5);
+    input.to_device();
+    auto expected = model(input);
+    finish_cl_queue();
+    expected.to_cpu();
+    finish_cl_queue();
+
+    PersistentRunner runner(model, 2);
+    // More batches than ring slots, so that slots are reused
+    for (uint batch = 0; batch < PERSISTENT_RING_SLOTS + 2; batch++)
+    {
+        const uint first = batch % 2, rows = 1 + batch % 2;
+        const uint ticket = runner.submit(&input(first, 0), rows);
+        std::vector<float> result(rows * expected.cols);
+        runner.wait(ticket, result.data());
+        for (uint i = 0; i < rows; i++)
+        {
+            for (uint j = 0; j < expected.cols; j++)
+            {
+                ASSERT_NEAR(result[i * expected.cols + j], expected(first + i, j), 1e-5);
+            }
+        }
+    }
+}
+
+TEST(KernelTest, PersistentKernelFillsRing)
+{
+    FCNN model(Matrix::random(784, 64, 1), Matrix::random(64, 1, 2), Matrix::random(64, 10, 3), Matrix::random(10, 1, 4));
+    Matrix input = Matrix::random(PERSISTENT_RING_SLOTS, 784, 5);
+    input.to_device();
+    auto expected = model(input);
+    finish_cl_queue();
+    expected.to_cpu();
+    finish_cl_queue();
+
+    PersistentRunner runner(model);
+    // Twice around the ring with every slot in flight at once, the second
+    // round reusing slots that were freed out of order
+    for (uint round = 0; round < 2; round++)
+    {
+        std::vector<uint> tickets;
+        for (uint row = 0; row < PERSISTENT_RING_SLOTS; row++)
+        {
+            tickets.push_back(runner.submit(&input(row, 0), 1));
+        }
+        ASSERT_THROW(runner.submit(&input(0, 0), 1), std::runtime_error);
+        for (uint i = 0; i < PERSISTENT_RING_SLOTS; i++)
+        {
+            const uint row = round == 0 ? PERSISTENT_RING_SLOTS - 1 - i : i;
+            std::vector<float> result(expected.cols);
+            runner.wait(tickets[row], result.data());
+            for (uint j = 0; j < expected.cols; j++)
+            {
+                ASSERT_NEAR(result[j], expected(row, j), 1e-5);
+            }
+        }
+    }
+}
+
+TEST(KernelTest, Bf16ForwardMatchesFp32)
+{
+    // Small weights keep the logits in a range where bfloat16 rounding
+    // doesn't flip the softmax
+    Matrix w1 = Matrix::random(784, 64, 1), w2 = Matrix::random(64, 10, 3);
+    for (uint i = 0; i < w1.rows * w1.cols; i++)
+    {
+        w1.raw_data()[i] *= 0.01f;
+    }
+    for (uint i = 0; i < w2.rows * w2.cols; i++)
+    {
+        w2.raw_data()[i] *= 0.1f;
+    }
+    FCNN model(std::move(w1), Matrix::random(64, 1, 2), std::move(w2), Matrix::random(10, 1, 4));
+    Bf16FCNN half_model(model);
+    Matrix input = Matrix::random(4, 784, 5);
+    input.to_device();
+    auto expected = model(input);
+    Bf16Matrix half_input = Bf16Matrix::from_float(input);
+    half_input.to_device();
+    auto result = half_model(half_input);
+    finish_cl_queue();
+    expected.to_cpu();
+    result.to_cpu();
+    finish_cl_queue();
+
+    for (uint i = 0; i < expected.rows; i++)
+    {
+        for (uint j = 0; j < expected.cols; j++)
+        {
+            ASSERT_NEAR(result(i, j), expected(i, j), 1e-2);
+        }
+    }
+}
+
+TEST(KernelTest, TrainingStepMatchesHost)
+{
+    // Small weights so that relu6 is neither all zero nor saturated
+    Matrix w1 = Matrix::random(784, 64, 1), w2 = Matrix::random(64, 10, 3);
+    for (uint i = 0; i < w1.rows * w1.cols; i++)
+    {
+        w1.raw_data()[i] *= 0.01f;
+    }
+    Matrix b1 = Matrix::random(64, 1, 2), b2 = Matrix::random(10, 1, 4);
+    Matrix expected_w1 = w1, expected_b1 = b1, expected_w2 = w2, expected_b2 = b2;
+    FCNN model(std::move(w1), std::move(b1), std::move(w2), std::move(b2));
+    Trainer trainer(model, 4, OptimizerConfig::sgd(0.1f));
+    Matrix input = Matrix::random(4, 784, 5);
+    const uint labels[4] = {3, 0, 9, 3};
+
+    // Results cached before a step must miss after it
+    ResultCache cache(1 << 20, 10);
+    std::vector<float> cached(4 * 10);
+    infer_cached(model, cache, input.raw_data(), 4, cached.data());
+    for (uint step = 0; step < 3; step++)
+    {
+        const uint64_t version = model.version();
+        const float expected_loss = fcnn_sgd_step_reference(expected_w1, expected_b1, expected_w2, expected_b2, input, labels, 0.1f);
+        ASSERT_NEAR(trainer.step(input.raw_data(), labels), expected_loss, 1e-4);
+        ASSERT_NE(model.version(), version);
+    }
+    ASSERT_EQ(cache.lookup_rows(input.raw_data(), 4, 784, model.version(), cached.data()).misses.size(), 4);
+    trainer.download_weights();
+    Matrix *results[4] = {&model.weight(0), &model.bias(0), &model.weight(1), &model.bias(1)};
+    Matrix *expected[4] = {&expected_w1, &expected_b1, &expected_w2, &expected_b2};
+    for (uint p = 0; p < 4; p++)
+    {
+        for (uint i = 0; i < expected[p]->rows * expected[p]->cols; i++)
+        {
+            ASSERT_NEAR(results[p]->raw_data()[i], expected[p]->raw_data()[i], 1e-4);
+        }
+    }
+}
+
+TEST(KernelTest, EveryLayerPlanMatchesFpga)
+{
+    FCNN model(Matrix::random(784, 64, 1), Matrix::random(64, 1, 2), Matrix::random(64, 10, 3), Matrix::random(10, 1, 4));
+    Matrix input = Matrix::random(3, 784, 5);
+    const auto plans = LayerPlan::all(FCNN::NUM_LAYERS);
+    Matrix expected = execute_plan(model, input, plans[0]);
+
+    for (const auto &plan : plans)
+    {
+        Matrix result = execute_plan(model, input, plan);
+        for (uint i = 0; i < expected.rows; i++)
+        {
+            for (uint j = 0; j < expected.cols; j++)
+            {
+                ASSERT_NEAR(result(i, j), expected(i, j), 1e-4) << plan.name();
+            }
+        }
+    }
+}
+
+TEST(SchedulerTest, PicksCheapestPlan)
+{
+    CostModel costs;
+    costs.widths = {784, 64, 10};
+    costs.to_device = {10., 0.};
+    costs.to_cpu = {10., 0.};
+    // Transfers only pay off for the first layer, and only for larger batches
+    costs.fpga_layer = {{20., 1.}, {20., 0.}};
+    costs.cpu_layer = {{0., 10.}, {0., 1.}};
+
+    FCNN model;
+    LayerScheduler scheduler(model, costs);
+    ASSERT_EQ(scheduler.plan_for(1).name(), "cpu+cpu");
+    ASSERT_EQ(scheduler.plan_for(16).name(), "fpga+cpu");
+    ASSERT_DOUBLE_EQ(costs.predict(scheduler.plan_for(16), 16), 10. + 36. + 10. + 16.);
+}
+
+TEST(SchedulerTest, DeadlineSchedulerSplitsIntoChunks)
+{
+    FCNN model(Matrix::random(784, 64, 1), Matrix::random(64, 1, 2), Matrix::random(64, 10, 3), Matrix::random(10, 1, 4));
+    Matrix input = Matrix::random(37, 784, 5);
+    input.to_device();
+    auto expected = model(input);
+    finish_cl_queue();
+    expected.to_cpu();
+    finish_cl_queue();
+
+    DeadlineScheduler scheduler(model, {100., 1.}, 8);
+    std::vector<float> bulk(37 * 10), urgent(10), late(10);
+    auto bulk_outcome = scheduler.submit(input.raw_data(), 37, bulk.data());
+    auto urgent_outcome = scheduler.submit(input.raw_data(), 1, urgent.data(), 0, DeadlineScheduler::clock::now() + std::chrono::seconds(10));
+    // Can't be met by any prediction
+    auto late_outcome = scheduler.submit(input.raw_data(), 1, late.data(), 0, DeadlineScheduler::clock::now());
+    ASSERT_EQ(late_outcome.get(), REQUEST_REJECTED);
+    ASSERT_EQ(urgent_outcome.get(), REQUEST_DONE);
+    ASSERT_EQ(bulk_outcome.get(), REQUEST_DONE);
+    for (uint i = 0; i < expected.rows; i++)
+    {
+        for (uint j = 0; j < expected.cols; j++)
+        {
+            ASSERT_NEAR(bulk[i * 10 + j], expected(i, j), 1e-5);
+        }
+    }
+    for (uint j = 0; j < expected.cols; j++)
+    {
+        ASSERT_NEAR(urgent[j], expected(0, j), 1e-5);
+    }
+}
+
+TEST(RegistryTest, EvictsLeastRecentlyUsed)
+{
+    auto loader = [](const uint seed) {
+        return [seed]() {
+            return std::make_shared<FCNN>(Matrix::random(8, 4, seed), Matrix::random(4, 1, seed + 1),
+                                          Matrix::random(4, 3, seed + 2), Matrix::random(3, 1, seed + 3));
+        };
+    };
+    // Five buffers of less than a page each
+    const std::size_t model_bytes = 5 * DEFAULT_ALIGNMENT;
+    ASSERT_EQ(loader(0)()->device_bytes(), model_bytes);
+    ModelRegistry registry(2 * model_bytes);
+    registry.add("test_a", loader(10));
+    registry.add("test_b", loader(20));
+    registry.add("test_c", loader(30));
+
+    registry.get("test_a");
+    registry.get("test_b");
+    registry.get("test_a");
+    // test_b is the least recently used one
+    registry.get("test_c");
+    ASSERT_TRUE(registry.is_resident("test_a"));
+    ASSERT_FALSE(registry.is_resident("test_b"));
+    ASSERT_EQ(registry.resident_bytes(), 2 * model_bytes);
+
+    // Models in use are not evicted
+    auto pinned = registry.get("test_c");
+    registry.prefetch("test_b").get();
+    ASSERT_TRUE(registry.is_resident("test_c"));
+    ASSERT_FALSE(registry.is_resident("test_a"));
+
+    const ModelStats a = registry.stats("test_a"), b = registry.stats("test_b");
+    ASSERT_EQ(a.hits, 1u);
+    ASSERT_EQ(a.misses, 1u);
+    ASSERT_EQ(a.evictions, 1u);
+    ASSERT_EQ(b.loads, 2u);
+    ASSERT_EQ(b.evictions, 1u);
+}
+
+TEST(MetricsTest, HistogramPercentilesWithinBucketError)
+{
+    Histogram histogram;
+    for (uint64_t us = 1; us <= 1000; us++)
+    {
+        histogram.record_ns(us * 1000);
+    }
+    ASSERT_EQ(histogram.count(), 1000);
+    ASSERT_NEAR(histogram.percentile_ns(50), 500e3, 500e3 / Histogram::SUB_BUCKETS);
+    ASSERT_NEAR(histogram.percentile_ns(99), 990e3, 990e3 / Histogram::SUB_BUCKETS);
+    ASSERT_EQ(histogram.count_below(100e3), 100);
+}
+
+TEST(MetricsTest, ExpositionFormat)
+{
+    MetricsRegistry registry;
+    registry.counter("test_requests_total", "Requests").add(3);
+    registry.histogram("test_latency_seconds", "Latency", "layer=\"1\"").record_ns(15000);
+
+    const std::string text = registry.exposition();
+    ASSERT_NE(text.find("# TYPE test_requests_total counter\ntest_requests_total 3\n"), std::string::npos);
+    ASSERT_NE(text.find("test_latency_seconds_bucket{layer=\"1\",le=\"1e-05\"} 0\n"), std::string::npos);
+    ASSERT_NE(text.find("test_latency_seconds_bucket{layer=\"1\",le=\"2e-05\"} 1\n"), std::string::npos);
+    ASSERT_NE(text.find("test_latency_seconds_count{layer=\"1\"} 1\n"), std::string::npos);
+}
+
+TEST(MetricsTest, RooflineCountsWorkFromShapes)
+{
+    const KernelRoofline matmul = roofline_of(TracedKernel{"matmul_kernel", 4, 784, 64, cl::Event()});
+    ASSERT_DOUBLE_EQ(matmul.flops, 2. * 4 * 784 * 64);
+    ASSERT_DOUBLE_EQ(matmul.bytes, 4. * (4 * 784 + 784 * 64 + 2 * 4 * 64));
+    // A small batch hardly reuses the weights
+    ASSERT_TRUE(matmul.memory_bound(PlatformPeaks::aws_f1()));
+    ASSERT_DOUBLE_EQ(matmul.attainable_gflops(PlatformPeaks::aws_f1()), matmul.intensity() * 76.8);
+
+    const KernelRoofline softmax = roofline_of(TracedKernel{"bias_softmax_kernel", 4, 0, 10, cl::Event()});
+    ASSERT_DOUBLE_EQ(softmax.flops, 4. * 4 * 10);
+    ASSERT_DOUBLE_EQ(softmax.bytes, 4. * (2 * 4 * 10 + 10));
+}
+
+TEST(PrecisionTest, Bf16RoundsToNearestEven)
+{
+    ASSERT_EQ(float_to_bf16(1.f), 0x3f80);
+    // Halfway between 0x3f80 and 0x3f81, and between 0x3f81 and 0x3f82
+    ASSERT_EQ(float_to_bf16(1.00390625f), 0x3f80);
+    ASSERT_EQ(float_to_bf16(1.01171875f), 0x3f82);
+    ASSERT_EQ(float_to_bf16(-2.5f), 0xc020);
+    ASSERT_TRUE(std::isnan(bf16_to_float(float_to_bf16(NAN))));
+    for (const float value : {0.f, 0.1f, -3.75f, 6.f, 1e-20f, 3e38f})
+    {
+        ASSERT_NEAR(bf16_to_float(float_to_bf16(value)), value, std::fabs(value) / 256);
+    }
+}
+
+TEST(LoadTest, CorrectsCoordinatedOmission)
+{
+    std::vector<double> latencies;
+    record_corrected(latencies, 50., 100.);
+    ASSERT_EQ(latencies, std::vector<double>({50.}));
+    // A 450us stall hides the requests that were due after 100, 200 and 300us
+    latencies.clear();
+    record_corrected(latencies, 450., 100.);
+    ASSERT_EQ(latencies, std::vector<double>({450., 350., 250., 150.}));
+    latencies.clear();
+    record_corrected(latencies, 450., 0.);
+    ASSERT_EQ(latencies.size(), 1u);
+}
+
+TEST(TuningTest, StoreKeepsBest)
+{
+    const std::string path = "tuning_test.json";
+    std::remove(path.c_str());
+
+    TuningConfig config = {MATMUL_UNROLL, MATMUL_COMPUTE_UNITS, 16, 2, 100.};
+    ASSERT_TRUE(store_tuning_if_better(path, shape_key({784, 64, 10}), config));
+    config.batch_size = 64;
+    config.score = 50.;
+    ASSERT_FALSE(store_tuning_if_better(path, shape_key({784, 64, 10}), config));
+
+    const auto loaded = load_tuning(path, "784x64x10");
+    ASSERT_TRUE(loaded.has_value());
+    ASSERT_EQ(loaded.value().batch_size, 16);
+    ASSERT_EQ(loaded.value().inflight, 2);
+    ASSERT_FALSE(load_tuning(path, "784x32x10").has_value());
+
+    // Invalid entries are neither stored nor loaded
+    config.score = std::nan("");
+    ASSERT_FALSE(store_tuning_if_better(path, shape_key({784, 32, 10}), config));
+    config.batch_size = 0;
+    config.score = 200.;
+    ASSERT_FALSE(store_tuning_if_better(path, shape_key({784, 64, 10}), config));
+    ASSERT_EQ(load_tuning(path, "784x64x10").value().batch_size, 16);
+    JsonValue entry = to_json(config);
+    ASSERT_THROW(tuning_from_json(entry), std::runtime_error);
+    std::remove(path.c_str());
+}
+
+TEST(HostMemoryTest, PoolReusesFreedBlocks)
+{
+    // The pool is opt-in, a small one is enough here. Still disabled with
+    // FCNN_HOST_POOL_MB=0.
+    init_host_memory(16);
+    if (HOST_POOL == NULL)
+    {
+        return;
+    }
+    float *first;
+    {
+        Matrix matrix(64, 784);
+        first = matrix.raw_data();
+        ASSERT_TRUE(HOST_POOL->owns(first));
+        ASSERT_EQ(reinterpret_cast<std::uintptr_t>(first) % DEFAULT_ALIGNMENT, 0);
+    }
+    Matrix reused(64, 784);
+    ASSERT_EQ(reused.raw_data(), first);
+}
+
+TEST(PreprocessTest, DecodesResizesAndPacksRows)
+{
+    const std::string ascii = "P2\n# comment\n2 2\n4\n0 1\n2 4\n";
+    const GrayImage small = decode_pgm(std::vector<uint8_t>(ascii.begin(), ascii.end()));
+    ASSERT_EQ(small.width, 2);
+    ASSERT_FLOAT_EQ(small.pixels[1], 0.25f);
+    ASSERT_FLOAT_EQ(small.pixels[3], 1.f);
+
+    // 56x56 with a bright top-left quadrant halves to 28x28
+    const std::string header = "P5\n56 56\n255\n";
+    std::vector<uint8_t> binary(header.begin(), header.end());
+    for (uint y = 0; y < 56; y++)
+    {
+        for (uint x = 0; x < 56; x++)
+        {
+            binary.push_back(x < 28 && y < 28 ? 255 : 0);
+        }
+    }
+    // 14x14 raw doubles to 28x28
+    std::vector<uint8_t> raw(14 * 14, 51);
+
+    Preprocessor preprocessor(2);
+    Matrix batch = preprocessor.submit({EncodedImage::pgm(binary), EncodedImage::raw(raw, 14, 14)}).get();
+    ASSERT_EQ(batch.rows, 2);
+    ASSERT_EQ(batch.cols, 784);
+    ASSERT_EQ(reinterpret_cast<std::uintptr_t>(batch.raw_data()) % DEFAULT_ALIGNMENT, 0);
+    ASSERT_NEAR(batch(0, 13 * 28 + 13), 1.f, 1e-5);
+    ASSERT_NEAR(batch(0, 14 * 28 + 14), 0.f, 1e-5);
+    for (uint i = 0; i < 784; i++)
+    {
+        ASSERT_NEAR(batch(1, i), 0.2f, 1e-5);
+    }
+
+    ASSERT_THROW(preprocessor.submit({EncodedImage::raw(raw, 28, 28)}).get(), std::runtime_error);
+
+    // Headers claiming more pixels than they carry fail before allocating
+    for (const std::string header : {"P5\n16384 16384\n255\n", "P2\n4 4\n255\n1 2 3\n", "P5\n99999999999 1\n255\n"})
+    {
+        ASSERT_THROW(decode_pgm(std::vector<uint8_t>(header.begin(), header.end())), std::runtime_error);
+    }
+}
+
+TEST(ExprTest, FusedExpressionsMatchLoops)
+{
+    Matrix x = Matrix::random(5, 7, 1), w = Matrix::random(7, 3, 2), bias = Matrix::random(3, 1, 3);
+    Matrix out(5, 3), probabilities(5, 3), sums(5, 1);
+    evaluate_into(relu6(matmul(x, w) * 2.f - as_row(bias)), out);
+    evaluate_into(softmax_rows(out - row_max(out)), probabilities);
+    evaluate_into(row_sum(probabilities), sums);
+    for (uint i = 0; i < 5; i++)
+    {
+        for (uint j = 0; j < 3; j++)
+        {
+            float acc = 0.f;
+            for (uint k = 0; k < 7; k++)
+            {
+                acc += x(i, k) * w(k, j);
+            }
+            ASSERT_NEAR(out(i, j), std::min(std::max(2.f * acc - bias(j, 0), 0.f), 6.f), 1e-5);
+        }
+        ASSERT_NEAR(sums(i, 0), 1.f, 1e-5);
+        const uint best = argmax_rows(out)[i];
+        ASSERT_EQ(argmax_rows(probabilities)[i], best);
+        ASSERT_GE(out(i, best), std::max(out(i, 0), std::max(out(i, 1), out(i, 2))));
+    }
+
+    // In place, and only reductions broadcast over columns
+    Matrix copy = x;
+    evaluate_into(x + x, x);
+    ASSERT_FLOAT_EQ(x(4, 6), 2.f * copy(4, 6));
+    ASSERT_THROW(evaluate_into(x + sums, x), std::runtime_error);
+    ASSERT_THROW(matmul(x, x), std::runtime_error);
+}
+
+TEST(CacheTest, RepeatedRowsSkipTheDevice)
+{
+    Matrix w1 = Matrix::random(784, 64, 1), w2 = Matrix::random(64, 10, 2);
+    evaluate_into((w1 - ScalarExpr(0.5f)) * 0.05f, w1);
+    FCNN model(std::move(w1), Matrix::random(64, 1, 3), std::move(w2), Matrix::random(10, 1, 4));
+    Matrix input = Matrix::random(3, 784, 5);
+    // The last row repeats the first
+    std::copy(input.raw_data(), input.raw_data() + 784, input.raw_data() + 2 * 784);
+    input.to_device(HANDLE, bank_for(ROLE_INPUT));
+    Matrix expected = model(input);
+    finish_cl_queue();
+    expected.to_cpu();
+    finish_cl_queue();
+
+    ResultCache cache(1 << 20, 10);
+    std::vector<float> output(3 * 10);
+    infer_cached(model, cache, input.raw_data(), 3, output.data());
+    for (uint i = 0; i < 3; i++)
+    {
+        for (uint j = 0; j < 10; j++)
+        {
+            ASSERT_NEAR(output[i * 10 + j], expected(i, j), 1e-5);
+        }
+    }
+    // The repeated row still misses within its batch, then all rows hit
+    ASSERT_EQ(cache.stats().misses, 3);
+    ASSERT_EQ(cache.stats().entries, 2);
+    std::vector<float> again(3 * 10);
+    ASSERT_TRUE(cache.lookup_rows(input.raw_data(), 3, 784, model.version(), again.data()).misses.empty());
+    ASSERT_EQ(again, output);
+    ASSERT_EQ(cache.stats().hits, 3);
+
+    // Other weights never see these results
+    ASSERT_EQ(cache.lookup_rows(input.raw_data(), 3, 784, model.version() + 1, again.data()).misses.size(), 3);
+
+    // Capacity holds under churn, least recently used first out
+    ResultCache small(4 * (10 * sizeof(float) + 96), 10, 1);
+    ASSERT_EQ(small.capacity(), 4);
+    std::vector<float> result(10, 1.f);
+    for (uint64_t key = 0; key < 6; key++)
+    {
+        small.insert(key, result.data());
+        if (key == 3)
+        {
+            ASSERT_TRUE(small.lookup(0, result.data()));
+        }
+    }
+    ASSERT_EQ(small.stats().entries, 4);
+    ASSERT_EQ(small.stats().evictions, 2);
+    ASSERT_TRUE(small.lookup(0, result.data()));
+    ASSERT_FALSE(small.lookup(1, result.data()));
+    ASSERT_FALSE(small.lookup(2, result.data()));
+}
+
+TEST(PlacementTest, SpreadConnectsEachLayerToItsBanks)
+{
+    const std::string cfg = Placement::spread().connectivity();
+    ASSERT_NE(cfg.find("nk=matmul_kernel:2"), std::string::npos);
+    ASSERT_NE(cfg.find("sp=matmul_kernel_1.matrixA:DDR[0]"), std::string::npos);
+    ASSERT_NE(cfg.find("sp=matmul_kernel_2.matrixA:DDR[2]"), std::string::npos);
+    ASSERT_NE(cfg.find("sp=matmul_kernel_2.out:DDR[3]"), std::string::npos);
+    ASSERT_EQ(Placement::spread().matmul_kernel_name(1), "matmul_kernel:{matmul_kernel_2}");
+    ASSERT_EQ(Placement::single_bank(1).matmul_kernel_name(1), "matmul_kernel");
+    ASSERT_NE(cfg.find("sp=matmul_transposed_kernel_1.matrixA:DDR[0:3]"), std::string::npos);
+    ASSERT_NE(cfg.find("sp=gemv_kernel_2.x:DDR[2]"), std::string::npos);
+    ASSERT_NE(cfg.find("sp=gemv_kernel_2.out:DDR[3]"), std::string::npos);
+    ASSERT_NE(cfg.find("sp=conv_relu6_kernel_1.weights:DDR[1]"), std::string::npos);
+    ASSERT_NE(cfg.find("sp=conv_relu6_kernel_1.out:DDR[2]"), std::string::npos);
+    ASSERT_NE(Placement::single_bank(1).connectivity().find("sp=matmul_transposed_kernel_1.matrixB:DDR[1]"), std::string::npos);
+}
+
 int main(int argc, char *argv[])
 {
     ::testing::InitGoogleTest(&argc, argv);
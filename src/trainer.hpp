@@ -0,0 +1,274 @@
+#ifndef NNONFPGA_TRAINER
+#define NNONFPGA_TRAINER
+
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <CL/cl2.hpp>
+#include "libnpy.hpp"
+#include "matrix.hpp"
+#include "net.hpp"
+#include "training_kernels.hpp"
+#include "utils.hpp"
+
+// Fine-tunes an FCNN on the device: forward pass, backward pass and
+// optimizer update all run as kernels on the model's device-resident
+// weights, so only the batches go to the card and only the loss comes back.
+// Computes the same as train.py: mean cross-entropy of the softmax output,
+// optimized with SGD or Adam (tinygrad's formulation).
+//
+// The weights are updated in place in device memory. The model can serve
+// inference in between steps; call download_weights() before reading them on
+// the host or saving them.
+
+enum OptimizerAlgorithm
+{
+    SGD = OPTIMIZER_SGD,
+    ADAM = OPTIMIZER_ADAM
+};
+
+struct OptimizerConfig
+{
+    OptimizerAlgorithm algorithm;
+    float learning_rate, beta1, beta2, epsilon;
+
+    static OptimizerConfig sgd(const float learning_rate)
+    {
+        return {SGD, learning_rate, 0.f, 0.f, 0.f};
+    }
+
+    // Defaults of tinygrad's Adam
+    static OptimizerConfig adam(const float learning_rate = 0.001f, const float beta1 = 0.9f, const float beta2 = 0.999f, const float epsilon = 1e-8f)
+    {
+        return {ADAM, learning_rate, beta1, beta2, epsilon};
+    }
+};
+
+class Trainer
+{
+private:
+    // Weight or bias with its gradient and optimizer state, device-only
+    struct Parameter
+    {
+        Matrix *value;
+        cl::Buffer gradient, m, v;
+        uint size;
+    };
+
+    FCNN &model;
+    const uint batch;
+    const OptimizerConfig optimizer;
+    // In-order queue of its own, so the steps need no event chains and
+    // don't wait for unrelated work on HANDLE.q
+    DeviceHandle handle;
+    Matrix input;
+    std::vector<cl::Memory> input_buffers;
+    std::vector<uint> label_staging;
+    cl::Buffer labels, hidden, output, grad_output, grad_hidden, ones, loss;
+    Parameter params[4];
+    cl::Kernel matmul1, bias_relu6, matmul2, bias_softmax, xent_backward, matmul_t, relu6_backward, update;
+    uint steps;
+
+    cl::Buffer scratch(const std::size_t floats, const TensorRole role)
+    {
+        cl::Buffer buffer = device_scratch(sizeof(float) * floats, bank_for(role), handle);
+        handle.q.enqueueFillBuffer(buffer, 0.f, 0, sizeof(float) * floats);
+        return buffer;
+    }
+
+    void zero(cl::Buffer &buffer, const std::size_t floats)
+    {
+        handle.q.enqueueFillBuffer(buffer, 0.f, 0, sizeof(float) * floats);
+    }
+
+    // out (rows x cols) += op(A) * op(B), see matmul_transposed_kernel
+    void enqueue_matmul_t(const cl::Buffer &a, const cl::Buffer &b, const uint rows, const uint inner, const uint cols,
+                          const bool transpose_a, const bool transpose_b, const cl::Buffer &out)
+    {
+        matmul_t.setArg(0, a);
+        matmul_t.setArg(1, b);
+        matmul_t.setArg(2, rows);
+        matmul_t.setArg(3, inner);
+        matmul_t.setArg(4, cols);
+        matmul_t.setArg(5, static_cast<uint>(transpose_a));
+        matmul_t.setArg(6, static_cast<uint>(transpose_b));
+        matmul_t.setArg(7, out);
+        handle.q.enqueueTask(matmul_t);
+    }
+
+public:
+    Trainer(FCNN &model, const uint batch_size, const OptimizerConfig &optimizer = OptimizerConfig::adam())
+        : model(model), batch(batch_size), optimizer(optimizer),
+          input(Matrix::constant(batch_size, model.weight(0).rows, 0.0)), label_staging(batch_size), steps(0)
+    {
+        const uint in = model.weight(0).rows, hidden_dim = model.weight(0).cols, classes = model.weight(1).cols;
+        handle.device = HANDLE.device;
+        handle.context = HANDLE.context;
+        handle.q = cl::CommandQueue(HANDLE.context, HANDLE.device, CL_QUEUE_PROFILING_ENABLE);
+        // The model's weights are uploaded on HANDLE.q
+        finish_cl_queue();
+
+        input.to_device(handle, bank_for(ROLE_INPUT));
+        input_buffers.push_back(input.get_buffer());
+        labels = device_scratch(sizeof(uint) * batch_size, bank_for(ROLE_INPUT), handle);
+        hidden = scratch(batch_size * hidden_dim, ROLE_ACTIVATION);
+        output = scratch(batch_size * classes, ROLE_OUTPUT);
+        grad_output = scratch(batch_size * classes, ROLE_ACTIVATION);
+        grad_hidden = scratch(batch_size * hidden_dim, ROLE_ACTIVATION);
+        loss = scratch(1, ROLE_ACTIVATION);
+        ones = device_scratch(sizeof(float) * batch_size, bank_for(ROLE_ACTIVATION), handle);
+        handle.q.enqueueFillBuffer(ones, 1.f, 0, sizeof(float) * batch_size);
+
+        Matrix *values[4] = {&model.weight(0), &model.bias(0), &model.weight(1), &model.bias(1)};
+        for (uint i = 0; i < 4; i++)
+        {
+            params[i].value = values[i];
+            params[i].size = values[i]->rows * values[i]->cols;
+            params[i].gradient = scratch(params[i].size, ROLE_ACTIVATION);
+            params[i].m = scratch(params[i].size, ROLE_ACTIVATION);
+            params[i].v = scratch(params[i].size, ROLE_ACTIVATION);
+        }
+
+        matmul1 = cl::Kernel(PROGRAM, matmul_kernel_name_for(in, hidden_dim, 0).c_str());
+        matmul1.setArg(0, input.get_buffer());
+        matmul1.setArg(1, model.weight(0).get_buffer());
+        matmul1.setArg(2, batch_size);
+        matmul1.setArg(3, in);
+        matmul1.setArg(4, hidden_dim);
+        matmul1.setArg(5, hidden);
+
+        bias_relu6 = cl::Kernel(PROGRAM, "bias_relu6_kernel");
+        bias_relu6.setArg(0, hidden);
+        bias_relu6.setArg(1, model.bias(0).get_buffer());
+        bias_relu6.setArg(2, batch_size);
+        bias_relu6.setArg(3, hidden_dim);
+
+        matmul2 = cl::Kernel(PROGRAM, matmul_kernel_name_for(hidden_dim, classes, 1).c_str());
+        matmul2.setArg(0, hidden);
+        matmul2.setArg(1, model.weight(1).get_buffer());
+        matmul2.setArg(2, batch_size);
+        matmul2.setArg(3, hidden_dim);
+        matmul2.setArg(4, classes);
+        matmul2.setArg(5, output);
+
+        bias_softmax = cl::Kernel(PROGRAM, "bias_softmax_kernel");
+        bias_softmax.setArg(0, output);
+        bias_softmax.setArg(1, model.bias(1).get_buffer());
+        bias_softmax.setArg(2, batch_size);
+        bias_softmax.setArg(3, classes);
+
+        xent_backward = cl::Kernel(PROGRAM, "softmax_xent_backward_kernel");
+        xent_backward.setArg(0, output);
+        xent_backward.setArg(1, labels);
+        xent_backward.setArg(2, batch_size);
+        xent_backward.setArg(3, classes);
+        xent_backward.setArg(4, grad_output);
+        xent_backward.setArg(5, loss);
+
+        relu6_backward = cl::Kernel(PROGRAM, "relu6_backward_kernel");
+        relu6_backward.setArg(0, hidden);
+        relu6_backward.setArg(1, grad_hidden);
+        relu6_backward.setArg(2, batch_size);
+        relu6_backward.setArg(3, hidden_dim);
+
+        matmul_t = cl::Kernel(PROGRAM, "matmul_transposed_kernel");
+        update = cl::Kernel(PROGRAM, "optimizer_update_kernel");
+        handle.q.finish();
+    }
+
+    Trainer(const Trainer &) = delete;
+    Trainer &operator=(const Trainer &) = delete;
+
+    uint batch_size() const
+    {
+        return batch;
+    }
+
+    // One optimizer step on batch_size() rows of `samples` with class indices
+    // `targets`. Returns the mean loss of the batch before the update.
+    float step(const float *samples, const uint *targets)
+    {
+        const uint in = model.weight(0).rows, hidden_dim = model.weight(0).cols, classes = model.weight(1).cols;
+        memcpy(input.raw_data(), samples, sizeof(float) * batch * in);
+        memcpy(label_staging.data(), targets, sizeof(uint) * batch);
+        handle.q.enqueueMigrateMemObjects(input_buffers, 0);
+        handle.q.enqueueWriteBuffer(labels, CL_FALSE, 0, sizeof(uint) * batch, label_staging.data());
+
+        // Forward, matmul_kernel accumulates into its output
+        zero(hidden, batch * hidden_dim);
+        zero(output, batch * classes);
+        handle.q.enqueueTask(matmul1);
+        handle.q.enqueueTask(bias_relu6);
+        handle.q.enqueueTask(matmul2);
+        handle.q.enqueueTask(bias_softmax);
+
+        // Backward, the gradients are accumulated as well
+        Parameter &w1 = params[0], &b1 = params[1], &w2 = params[2], &b2 = params[3];
+        zero(grad_hidden, batch * hidden_dim);
+        for (auto &param : params)
+        {
+            zero(param.gradient, param.size);
+        }
+        handle.q.enqueueTask(xent_backward);
+        enqueue_matmul_t(hidden, grad_output, hidden_dim, batch, classes, true, false, w2.gradient);
+        enqueue_matmul_t(ones, grad_output, 1, batch, classes, true, false, b2.gradient);
+        enqueue_matmul_t(grad_output, model.weight(1).get_buffer(), batch, classes, hidden_dim, false, true, grad_hidden);
+        handle.q.enqueueTask(relu6_backward);
+        enqueue_matmul_t(input.get_buffer(), grad_hidden, in, batch, hidden_dim, true, false, w1.gradient);
+        enqueue_matmul_t(ones, grad_hidden, 1, batch, hidden_dim, true, false, b1.gradient);
+
+        steps++;
+        float step_size = optimizer.learning_rate;
+        if (optimizer.algorithm == ADAM)
+        {
+            step_size *= std::sqrt(1.f - std::pow(optimizer.beta2, steps)) / (1.f - std::pow(optimizer.beta1, steps));
+        }
+        for (auto &param : params)
+        {
+            update.setArg(0, param.value->get_buffer());
+            update.setArg(1, param.gradient);
+            update.setArg(2, param.m);
+            update.setArg(3, param.v);
+            update.setArg(4, param.size);
+            update.setArg(5, static_cast<uint>(optimizer.algorithm));
+            update.setArg(6, step_size);
+            update.setArg(7, optimizer.beta1);
+            update.setArg(8, optimizer.beta2);
+            update.setArg(9, optimizer.epsilon);
+            handle.q.enqueueTask(update);
+        }
+        // Results cached for the previous weights are stale from here on
+        model.weights_updated();
+
+        float result = 0.f;
+        handle.q.enqueueReadBuffer(loss, CL_TRUE, 0, sizeof(float), &result);
+        return result;
+    }
+
+    // Copies the current weights and biases into the model's host matrices
+    void download_weights()
+    {
+        for (auto &param : params)
+        {
+            param.value->to_cpu(handle);
+        }
+        handle.q.finish();
+    }
+
+    // Writes w1.npy, b1.npy, w2.npy and b2.npy into `weights_dir`
+    void save(const std::string &weights_dir)
+    {
+        download_weights();
+        const char *names[4] = {"w1", "b1", "w2", "b2"};
+        for (uint i = 0; i < 4; i++)
+        {
+            Matrix &value = *params[i].value;
+            const int shape[2] = {static_cast<int>(value.rows), static_cast<int>(value.cols)};
+            aoba::SaveArrayAsNumpy(weights_dir + "/" + names[i] + ".npy", 2, shape, value.raw_data());
+        }
+    }
+};
+
+#endif /* end of include guard: NNONFPGA_TRAINER */
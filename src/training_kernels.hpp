@@ -0,0 +1,33 @@
+typedef unsigned int uint;
+
+// Kernels for training the FCNN on the device (see trainer.hpp). Together
+// with the inference kernels they cover the backward pass of
+// dense -> relu6 -> dense -> softmax with cross-entropy loss.
+
+#define OPTIMIZER_SGD 0
+#define OPTIMIZER_ADAM 1
+
+// out (rows x cols) += op(A) * op(B), where op transposes if requested and
+// `inner` is the shared dimension: A is stored as rows x inner, or inner x
+// rows if transposed; B as inner x cols, or cols x inner if transposed.
+extern "C" void matmul_transposed_kernel(
+    const float *const matrixA, const float *const matrixB, const uint rows, const uint inner, const uint cols,
+    const uint transpose_a, const uint transpose_b, float *const out);
+
+// Gradient of the mean cross-entropy of softmax `probabilities` against
+// `labels` with respect to the logits, and the loss itself in loss[0]
+extern "C" void softmax_xent_backward_kernel(
+    const float *const probabilities, const uint *const labels, const uint batch_size, const uint classes,
+    float *const gradient, float *const loss);
+
+// Masks `gradient` in place where relu6 was saturated. `activation` is the
+// layer's output, which lies strictly within (0, 6) exactly where the
+// derivative is one.
+extern "C" void relu6_backward_kernel(
+    const float *const activation, float *const gradient, const uint batch_size, const uint dim);
+
+// In-place update of `size` parameters. SGD only uses `step_size`; Adam keeps
+// its moments in `m` and `v` and expects the bias-corrected step size.
+extern "C" void optimizer_update_kernel(
+    float *const param, const float *const gradient, float *const m, float *const v, const uint size,
+    const uint algorithm, const float step_size, const float beta1, const float beta2, const float epsilon);
@@ -0,0 +1,138 @@
+#ifndef NNONFPGA_TUNING
+#define NNONFPGA_TUNING
+
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <nonstd/optional.hpp>
+#include "json.hpp"
+#include "matmul_kernel.hpp"
+
+typedef unsigned int uint;
+
+static const std::string DEFAULT_TUNING_FILE = "tuning.json";
+
+// Best configuration found by the autotuner for one model shape. Kernel
+// parameters are fixed when the xclbin is built, host parameters are applied
+// at runtime.
+struct TuningConfig
+{
+    // Kernel parameters
+    uint matmul_unroll;
+    uint compute_units;
+    // Host parameters
+    uint batch_size;
+    uint inflight;
+    // Samples per second; measured on the wall clock in hw mode and on the
+    // simulated device timeline in emulation
+    double score;
+};
+
+// Results are only comparable within one target, so they are stored per
+// XCL_EMULATION_MODE (sw_emu, hw_emu or hw)
+std::string tuning_target()
+{
+    const char *mode = getenv("XCL_EMULATION_MODE");
+    return mode == NULL ? "hw" : mode;
+}
+
+std::string shape_key(const std::vector<uint> &dims)
+{
+    std::ostringstream key;
+    for (std::size_t i = 0; i < dims.size(); i++)
+    {
+        key << (i > 0 ? "x" : "") << dims[i];
+    }
+    return key.str();
+}
+
+JsonValue to_json(const TuningConfig &config)
+{
+    JsonValue result = JsonValue::object();
+    result["matmul_unroll"] = config.matmul_unroll;
+    result["compute_units"] = config.compute_units;
+    result["batch_size"] = config.batch_size;
+    result["inflight"] = config.inflight;
+    result["score"] = config.score;
+    return result;
+}
+
+// Whether `config` can be stored and loaded again. Callers loop in steps of
+// batch_size, so zero would never finish, and JSON has no representation for
+// non-finite scores.
+bool valid_tuning(const TuningConfig &config)
+{
+    return config.batch_size >= 1 && config.inflight >= 1 && std::isfinite(config.score);
+}
+
+TuningConfig tuning_from_json(const JsonValue &value)
+{
+    const double batch_size = value.get("batch_size", 1), inflight = value.get("inflight", 1);
+    if (!(batch_size >= 1 && batch_size <= UINT_MAX) || !(inflight >= 1 && inflight <= UINT_MAX))
+    {
+        throw std::runtime_error("Tuning entry needs a batch_size and inflight of at least 1");
+    }
+    TuningConfig config;
+    config.matmul_unroll = value.get("matmul_unroll", 1);
+    config.compute_units = value.get("compute_units", 1);
+    config.batch_size = batch_size;
+    config.inflight = inflight;
+    config.score = value.get("score", 0.);
+    return config;
+}
+
+nonstd::optional<TuningConfig> load_tuning(const std::string &path, const std::string &key)
+{
+    if (!std::ifstream(path))
+    {
+        return nonstd::optional<TuningConfig>();
+    }
+    const JsonValue root = load_json(path);
+    const std::string target = tuning_target();
+    if (!root.contains(target) || !root.at(target).contains(key))
+    {
+        return nonstd::optional<TuningConfig>();
+    }
+
+    const TuningConfig config = tuning_from_json(root.at(target).at(key));
+    if (config.matmul_unroll != MATMUL_UNROLL || config.compute_units != MATMUL_COMPUTE_UNITS)
+    {
+        std::cerr << "WARNING: " << path << " was tuned for MATMUL_UNROLL=" << config.matmul_unroll
+                  << " MATMUL_COMPUTE_UNITS=" << config.compute_units
+                  << ", rebuild the kernels with these options to match" << std::endl;
+    }
+    return nonstd::optional<TuningConfig>(config);
+}
+
+// Merges `config` into the tuning file, keeping whichever entry scores higher.
+// Returns true if the file was updated. Invalid configurations (see
+// valid_tuning) are never stored.
+bool store_tuning_if_better(const std::string &path, const std::string &key, const TuningConfig &config)
+{
+    if (!valid_tuning(config))
+    {
+        return false;
+    }
+    JsonValue root = JsonValue::object();
+    if (std::ifstream(path))
+    {
+        root = load_json(path);
+    }
+
+    JsonValue &entry = root[tuning_target()][key];
+    if (!entry.is_null() && tuning_from_json(entry).score >= config.score)
+    {
+        return false;
+    }
+    entry = to_json(config);
+    save_json(path, root);
+    return true;
+}
+
+#endif /* end of include guard: NNONFPGA_TUNING */
@@ -3,6 +3,9 @@
 
 #include <iostream>
 #include <string>
+#include "host_memory.hpp"
+#include "placement.hpp"
+#include "specialization.hpp"
 #include "xcl2.hpp"
 
 
@@ -20,8 +23,26 @@ typedef struct DeviceHandle
     cl::Context context;
 } DeviceHandle;
 
-static cl::Kernel MATMUL_KERNEL, BIAS_RELU6_KERNEL, BIAS_SOFTMAX_KERNEL;
+// MATMUL_OUTPUT_KERNEL is the same as MATMUL_KERNEL unless the placement
+// dedicates a compute unit to each layer
+static cl::Kernel MATMUL_KERNEL, MATMUL_OUTPUT_KERNEL, BIAS_RELU6_KERNEL, BIAS_SOFTMAX_KERNEL, CONV_RELU6_KERNEL;
+// bfloat16 path, see bf16_net.hpp
+static cl::Kernel MATMUL_BF16_KERNEL, MATMUL_BF16_OUTPUT_KERNEL, BIAS_RELU6_BF16_KERNEL;
+// Batch-1 path of FCNN, one compute unit per layer (see gemv_kernel.hpp)
+static cl::Kernel GEMV_KERNEL, GEMV_OUTPUT_KERNEL;
 static DeviceHandle HANDLE;
+// Kept to create private kernel objects, e.g. for InferencePlan
+static cl::Program PROGRAM;
+
+// Compute units of the dataflow pipeline (see stream_kernels.hpp). Their
+// stream ports are wired in the xclbin, so each one has a fixed position.
+struct StreamKernels
+{
+    cl::Kernel load, hidden_matmul, bias_relu6, output_matmul, bias_softmax, store;
+};
+static StreamKernels STREAM_KERNELS;
+// One per entry of SPECIALIZED_MATMULS
+static std::vector<cl::Kernel> SPECIALIZED_MATMUL_KERNELS;
 
 DeviceHandle setup_handle()
 {
@@ -37,15 +58,63 @@ DeviceHandle setup_handle()
     return result;
 }
 
-void init_kernels()
+void init_kernels(const std::string &binary = KERNELS_BIN)
 {
+    init_host_memory();
     HANDLE = setup_handle();
-    auto xclBins = xcl::import_binary_file(KERNELS_BIN);
-    std::cout << "Loaded kernels from " << KERNELS_BIN << std::endl;
-    cl::Program program(HANDLE.context, {HANDLE.device}, xclBins);
-    MATMUL_KERNEL = cl::Kernel(program, "matmul_kernel");
+    auto xclBins = xcl::import_binary_file(binary);
+    std::cout << "Loaded kernels from " << binary << std::endl;
+    PROGRAM = cl::Program(HANDLE.context, {HANDLE.device}, xclBins);
+    cl::Program &program = PROGRAM;
+    MATMUL_KERNEL = cl::Kernel(program, PLACEMENT.matmul_kernel_name(0).c_str());
+    MATMUL_OUTPUT_KERNEL = cl::Kernel(program, PLACEMENT.matmul_kernel_name(1).c_str());
     BIAS_RELU6_KERNEL = cl::Kernel(program, "bias_relu6_kernel");
     BIAS_SOFTMAX_KERNEL = cl::Kernel(program, "bias_softmax_kernel");
+    CONV_RELU6_KERNEL = cl::Kernel(program, "conv_relu6_kernel");
+    MATMUL_BF16_KERNEL = cl::Kernel(program, PLACEMENT.matmul_kernel_name(0, "matmul_bf16_kernel").c_str());
+    MATMUL_BF16_OUTPUT_KERNEL = cl::Kernel(program, PLACEMENT.matmul_kernel_name(1, "matmul_bf16_kernel").c_str());
+    BIAS_RELU6_BF16_KERNEL = cl::Kernel(program, "bias_relu6_bf16_kernel");
+    GEMV_KERNEL = cl::Kernel(program, "gemv_kernel:{gemv_kernel_1}");
+    GEMV_OUTPUT_KERNEL = cl::Kernel(program, "gemv_kernel:{gemv_kernel_2}");
+    STREAM_KERNELS.load = cl::Kernel(program, "load_stream_kernel");
+    STREAM_KERNELS.hidden_matmul = cl::Kernel(program, "matmul_stream_kernel:{matmul_stream_kernel_1}");
+    STREAM_KERNELS.bias_relu6 = cl::Kernel(program, "bias_relu6_stream_kernel");
+    STREAM_KERNELS.output_matmul = cl::Kernel(program, "matmul_stream_kernel:{matmul_stream_kernel_2}");
+    STREAM_KERNELS.bias_softmax = cl::Kernel(program, "bias_softmax_stream_kernel");
+    STREAM_KERNELS.store = cl::Kernel(program, "store_stream_kernel");
+    SPECIALIZED_MATMUL_KERNELS.clear();
+    for (const auto &shape : SPECIALIZED_MATMULS)
+    {
+        SPECIALIZED_MATMUL_KERNELS.push_back(cl::Kernel(program, shape.kernel_name().c_str()));
+    }
+}
+
+// Name to create the matmul kernel of `layer` with, specialized for a
+// cols_a x cols_b right operand if possible
+std::string matmul_kernel_name_for(const uint cols_a, const uint cols_b, const uint layer)
+{
+    for (const auto &shape : SPECIALIZED_MATMULS)
+    {
+        if (shape.cols_a == cols_a && shape.cols_b == cols_b)
+        {
+            return shape.kernel_name();
+        }
+    }
+    return PLACEMENT.matmul_kernel_name(layer);
+}
+
+// Matmul kernel specialized for a cols_a x cols_b right operand if the xclbin
+// has one, `generic` otherwise. Both take the same arguments.
+cl::Kernel &matmul_kernel_for(const uint cols_a, const uint cols_b, cl::Kernel &generic)
+{
+    for (std::size_t i = 0; i < SPECIALIZED_MATMULS.size(); i++)
+    {
+        if (SPECIALIZED_MATMULS[i].cols_a == cols_a && SPECIALIZED_MATMULS[i].cols_b == cols_b)
+        {
+            return SPECIALIZED_MATMUL_KERNELS[i];
+        }
+    }
+    return generic;
 }
 
 void finish_cl_queue()
@@ -53,4 +122,27 @@ void finish_cl_queue()
     HANDLE.q.finish();
 }
 
+// Device-side execution time of a finished command. Requires the queue to be
+// created with CL_QUEUE_PROFILING_ENABLE, which setup_handle does.
+double event_duration_ns(const cl::Event &event)
+{
+    const cl_ulong start = event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+    const cl_ulong end = event.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+    return static_cast<double>(end - start);
+}
+
+// Time between the first command starting and the last one finishing
+double events_span_ns(const std::vector<cl::Event> &events)
+{
+    cl_ulong first = 0, last = 0;
+    for (std::size_t i = 0; i < events.size(); i++)
+    {
+        const cl_ulong start = events[i].getProfilingInfo<CL_PROFILING_COMMAND_START>();
+        const cl_ulong end = events[i].getProfilingInfo<CL_PROFILING_COMMAND_END>();
+        first = (i == 0 || start < first) ? start : first;
+        last = end > last ? end : last;
+    }
+    return static_cast<double>(last - first);
+}
+
 #endif /* end of include guard: nn_on_fpga_utils */
\ No newline at end of file
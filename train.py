@@ -52,10 +52,55 @@ class FCNN:
         return self.layer1.parameters() + self.layer2.parameters()
 
 
-def train(outdir: str = None, epochs: int = 1, batch_size: int = 32):
+def evaluate_on_fpga(model: FCNN, X_test: np.ndarray, Y_test: np.ndarray) -> float:
+    """Accuracy of the current weights computed on the FPGA through the `fcnn`
+    bindings, which have to be built and importable"""
+    import fcnn
+
+    device_model = fcnn.FCNN(
+        model.layer1.weight.data,
+        model.layer1.bias.data,
+        model.layer2.weight.data,
+        model.layer2.bias.data,
+    )
+    # Page-aligned inputs are handed to the device without copies
+    x = fcnn.empty_aligned(*X_test.shape)
+    x[:] = X_test
+    y_pred = device_model(x).argmax(axis=1)
+    return (y_pred == Y_test).mean()
+
+
+def save_weights(model: FCNN, outdir: Path):
+    weights = {
+        "w1": model.layer1.weight.data,
+        "b1": model.layer1.bias.data,
+        "w2": model.layer2.weight.data,
+        "b2": model.layer2.bias.data
+    }
+    outdir.mkdir(parents=True, exist_ok=True)
+    for name, val in weights.items():
+        np.save(outdir / f"{name}.npy", val.astype(np.float32))
+
+
+def train(
+    outdir: str = None,
+    epochs: int = 1,
+    batch_size: int = 32,
+    fpga: bool = False,
+    xclbin: str = "xclbin/kernels.xclbin",
+    record: str = None,
+    record_steps: int = 200,
+):
     X_train, Y_train, X_test, Y_test = fetch_mnist()
+    if fpga:
+        import fcnn
+
+        fcnn.init(xclbin)
     model = FCNN(28 * 28, 10)
     optimizer = optim.Adam(model.parameters(), lr=0.01)
+    if record:
+        save_weights(model, Path(record) / "init")
+        recorded_x, recorded_y, recorded_loss = [], [], []
 
     for epoch in range(epochs):
         msg = "loss={loss}"
@@ -68,6 +113,10 @@ def train(outdir: str = None, epochs: int = 1, batch_size: int = 32):
             out = model(x)
             loss = sparse_categorical_crossentropy(out, Y_train[samp])
             status.set_description(msg.format(loss=float(loss.data)))
+            if record and len(recorded_loss) < record_steps:
+                recorded_x.append(X_train[samp].reshape((batch_size, -1)).astype(np.float32) / 255)
+                recorded_y.append(Y_train[samp].astype(np.float32))
+                recorded_loss.append(float(loss.data))
 
             optimizer.zero_grad()
             loss.backward()
@@ -83,19 +132,19 @@ def train(outdir: str = None, epochs: int = 1, batch_size: int = 32):
 
         acc = np.concatenate(correct).mean()
         print("Accuracy:", acc)
+        if fpga:
+            print("FPGA accuracy:", evaluate_on_fpga(model, X_test, Y_test))
+
+    if record:
+        # Replayed by device_train to compare the loss curves
+        np.save(Path(record) / "x.npy", np.concatenate(recorded_x))
+        np.save(Path(record) / "y.npy", np.concatenate(recorded_y))
+        np.save(Path(record) / "loss.npy", np.array(recorded_loss, np.float32))
 
     if not outdir:
         return
 
-    weights = {
-        "w1": model.layer1.weight.data,
-        "b1": model.layer1.bias.data,
-        "w2": model.layer2.weight.data,
-        "b2": model.layer2.bias.data
-    }
-    Path(outdir).mkdir(exist_ok=True)
-    for name, val in weights.items():
-        np.save(Path(outdir) / f"{name}.npy", val.astype(np.float32))
+    save_weights(model, Path(outdir))
 
     # select one example of each class
     indices = np.array([np.argmax(Y_test == i) for i in range(10)])